@@ -0,0 +1,152 @@
+#include "DataDeduplication.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <numeric>
+
+namespace
+{
+    // FNV-1a over the raw bytes of a row, identical rows have identical bytes
+    std::uint64_t hashRow(const float* row, uint32_t numDimensions)
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(row);
+        const size_t numBytes = static_cast<size_t>(numDimensions) * sizeof(float);
+
+        std::uint64_t hash = 0xCBF29CE484222325ull;
+        for (size_t b = 0; b < numBytes; ++b)
+        {
+            hash ^= bytes[b];
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+}
+
+void DataDeduplication::compute(const std::vector<float>& data, uint32_t numDimensions)
+{
+    assert(numDimensions > 0);
+    assert(data.size() % numDimensions == 0);
+
+    const auto numPoints = static_cast<uint32_t>(data.size() / numDimensions);
+    const size_t rowBytes = static_cast<size_t>(numDimensions) * sizeof(float);
+
+    std::vector<std::uint64_t> hashes(numPoints);
+
+#pragma omp parallel for
+    for (std::int64_t i = 0; i < static_cast<std::int64_t>(numPoints); ++i)
+        hashes[i] = hashRow(data.data() + i * numDimensions, numDimensions);
+
+    // Sorting by (hash, index) makes the first point of every group of duplicates come first
+    std::vector<uint32_t> order(numPoints);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&hashes](uint32_t a, uint32_t b) {
+        return hashes[a] != hashes[b] ? hashes[a] < hashes[b] : a < b;
+    });
+
+    // Every point first maps to the original index of its first identical row
+    std::vector<uint32_t> firstOccurrence(numPoints);
+
+    size_t groupBegin = 0;
+    while (groupBegin < numPoints)
+    {
+        size_t groupEnd = groupBegin + 1;
+        while (groupEnd < numPoints && hashes[order[groupEnd]] == hashes[order[groupBegin]])
+            ++groupEnd;
+
+        // Within a group of equal hashes, compare the rows to rule out collisions
+        for (size_t a = groupBegin; a < groupEnd; ++a)
+        {
+            const uint32_t point = order[a];
+            firstOccurrence[point] = point;
+
+            for (size_t b = groupBegin; b < a; ++b)
+            {
+                const uint32_t candidate = order[b];
+                if (firstOccurrence[candidate] == candidate && std::memcmp(data.data() + static_cast<size_t>(point) * numDimensions, data.data() + static_cast<size_t>(candidate) * numDimensions, rowBytes) == 0)
+                {
+                    firstOccurrence[point] = candidate;
+                    break;
+                }
+            }
+        }
+
+        groupBegin = groupEnd;
+    }
+
+    _pointToRepresentative = std::move(firstOccurrence);
+    updateRepresentatives();
+}
+
+void DataDeduplication::setPointToRepresentative(std::vector<uint32_t>&& pointToRepresentative)
+{
+    // Stored mappings already use representative indices, convert them to first occurrences for updateRepresentatives()
+    std::vector<uint32_t> representatives;
+    for (uint32_t i = 0; i < pointToRepresentative.size(); ++i)
+        if (pointToRepresentative[i] == representatives.size())
+            representatives.push_back(i);
+
+    for (auto& representative : pointToRepresentative)
+        representative = representatives[representative];
+
+    _pointToRepresentative = std::move(pointToRepresentative);
+    updateRepresentatives();
+}
+
+void DataDeduplication::updateRepresentatives()
+{
+    const auto numPoints = getNumPoints();
+
+    // Number the representatives in order of their first occurrence
+    std::vector<uint32_t> representativeIndex(numPoints, 0);
+
+    _representatives.clear();
+    for (uint32_t i = 0; i < numPoints; ++i)
+    {
+        if (_pointToRepresentative[i] == i)
+        {
+            representativeIndex[i] = static_cast<uint32_t>(_representatives.size());
+            _representatives.push_back(i);
+        }
+    }
+
+    _multiplicities.assign(_representatives.size(), 0.f);
+    for (uint32_t i = 0; i < numPoints; ++i)
+    {
+        _pointToRepresentative[i] = representativeIndex[_pointToRepresentative[i]];
+        _multiplicities[_pointToRepresentative[i]] += 1.f;
+    }
+}
+
+void DataDeduplication::clear()
+{
+    _pointToRepresentative.clear();
+    _representatives.clear();
+    _multiplicities.clear();
+}
+
+std::vector<float> DataDeduplication::reduce(const std::vector<float>& values, uint32_t numDimensions) const
+{
+    assert(values.size() == static_cast<size_t>(getNumPoints()) * numDimensions);
+
+    std::vector<float> reduced(static_cast<size_t>(getNumRepresentatives()) * numDimensions);
+
+#pragma omp parallel for
+    for (std::int64_t r = 0; r < static_cast<std::int64_t>(getNumRepresentatives()); ++r)
+        std::copy_n(values.begin() + static_cast<size_t>(_representatives[r]) * numDimensions, numDimensions, reduced.begin() + r * numDimensions);
+
+    return reduced;
+}
+
+std::vector<float> DataDeduplication::expand(const std::vector<float>& values, uint32_t numDimensions) const
+{
+    assert(values.size() == static_cast<size_t>(getNumRepresentatives()) * numDimensions);
+
+    std::vector<float> expanded(static_cast<size_t>(getNumPoints()) * numDimensions);
+
+#pragma omp parallel for
+    for (std::int64_t i = 0; i < static_cast<std::int64_t>(getNumPoints()); ++i)
+        std::copy_n(values.begin() + static_cast<size_t>(_pointToRepresentative[i]) * numDimensions, numDimensions, expanded.begin() + i * numDimensions);
+
+    return expanded;
+}
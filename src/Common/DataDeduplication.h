@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * DataDeduplication
+ *
+ * Detects exactly identical rows in row-major point data and collapses them into weighted representatives.
+ * Rows are hashed in parallel, sorted by hash and compared byte-wise within equal hashes, such that hash
+ * collisions never merge distinct rows. Representatives keep the order of their first occurrence.
+ */
+class DataDeduplication
+{
+public:
+    DataDeduplication() = default;
+
+    /**
+     * Find duplicate rows
+     * @param data Row-major point data, numPoints x numDimensions
+     * @param numDimensions Number of dimensions
+     */
+    void compute(const std::vector<float>& data, uint32_t numDimensions);
+
+    /** Restore the state of a previous computation, e.g. when loading a project */
+    void setPointToRepresentative(std::vector<uint32_t>&& pointToRepresentative);
+
+    void clear();
+
+public: // Getter
+    /** Whether any points were collapsed */
+    bool hasDuplicates() const { return getNumRepresentatives() < getNumPoints(); }
+
+    uint32_t getNumPoints() const { return static_cast<uint32_t>(_pointToRepresentative.size()); }
+    uint32_t getNumRepresentatives() const { return static_cast<uint32_t>(_representatives.size()); }
+
+    /** Original point index of every representative */
+    const std::vector<uint32_t>& getRepresentatives() const { return _representatives; }
+
+    /** Number of original points collapsed into every representative */
+    const std::vector<float>& getMultiplicities() const { return _multiplicities; }
+
+    /** Representative index of every original point */
+    const std::vector<uint32_t>& getPointToRepresentative() const { return _pointToRepresentative; }
+
+public: // Mapping
+    /**
+     * Select the rows of the representatives
+     * @param values Row-major values for all original points, getNumPoints() x numDimensions
+     * @param numDimensions Number of values per point
+     * @return Row-major values of the representatives
+     */
+    std::vector<float> reduce(const std::vector<float>& values, uint32_t numDimensions) const;
+
+    /**
+     * Broadcast the rows of the representatives to all original points
+     * @param values Row-major values for the representatives, getNumRepresentatives() x numDimensions
+     * @param numDimensions Number of values per point
+     * @return Row-major values of all original points
+     */
+    std::vector<float> expand(const std::vector<float>& values, uint32_t numDimensions) const;
+
+private:
+    void updateRepresentatives();
+
+private:
+    std::vector<uint32_t>   _pointToRepresentative;     /** Representative index per original point */
+    std::vector<uint32_t>   _representatives;           /** Original point index per representative */
+    std::vector<float>      _multiplicities;            /** Number of original points per representative */
+};
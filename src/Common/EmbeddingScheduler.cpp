@@ -0,0 +1,90 @@
+#include "EmbeddingScheduler.h"
+
+#include "TsneAnalysis.h"
+
+#include <algorithm>
+
+EmbeddingScheduler::EmbeddingScheduler(QObject* parent) :
+    QObject(parent),
+    _entries(),
+    _maxConcurrent(defaultMaxConcurrent)
+{
+}
+
+void EmbeddingScheduler::setMaxConcurrent(int maxConcurrent)
+{
+    _maxConcurrent = std::max(1, maxConcurrent);
+    update();
+}
+
+void EmbeddingScheduler::add(TsneAnalysis* analysis, bool background)
+{
+    if (std::any_of(_entries.begin(), _entries.end(), [analysis](const Entry& entry) { return entry.analysis == analysis; }))
+        return;
+
+    _entries.push_back({ analysis, false, background });
+
+    const auto setComputing = [this, analysis](bool computing) {
+        auto it = std::find_if(_entries.begin(), _entries.end(), [analysis](const Entry& entry) { return entry.analysis == analysis; });
+        if (it == _entries.end())
+            return;
+
+        it->computing = computing;
+
+        // The most recently requested computation runs first
+        if (computing)
+            std::rotate(_entries.begin(), it, it + 1);
+
+        update();
+    };
+
+    connect(analysis, &TsneAnalysis::computationRequested, this, [setComputing]() { setComputing(true); });
+    connect(analysis, &TsneAnalysis::finished, this, [setComputing]() { setComputing(false); });
+    connect(analysis, &TsneAnalysis::aborted, this, [setComputing]() { setComputing(false); });
+
+    // The analysis is partially destroyed at this point, only forget it
+    connect(analysis, &QObject::destroyed, this, [this, analysis]() {
+        _entries.erase(std::remove_if(_entries.begin(), _entries.end(), [analysis](const Entry& entry) { return entry.analysis == analysis; }), _entries.end());
+        update();
+    });
+}
+
+void EmbeddingScheduler::remove(TsneAnalysis* analysis)
+{
+    auto it = std::find_if(_entries.begin(), _entries.end(), [analysis](const Entry& entry) { return entry.analysis == analysis; });
+    if (it == _entries.end())
+        return;
+
+    disconnect(analysis, nullptr, this, nullptr);
+    analysis->setPaused(false);
+
+    _entries.erase(it);
+    update();
+}
+
+void EmbeddingScheduler::prioritize(TsneAnalysis* analysis)
+{
+    auto it = std::find_if(_entries.begin(), _entries.end(), [analysis](const Entry& entry) { return entry.analysis == analysis; });
+    if (it == _entries.end() || it == _entries.begin())
+        return;
+
+    std::rotate(_entries.begin(), it, it + 1);
+    update();
+}
+
+void EmbeddingScheduler::update()
+{
+    int numRunning = 0;
+
+    for (const bool background : { false, true })
+    {
+        for (const Entry& entry : _entries)
+        {
+            if (!entry.computing || entry.background != background)
+                continue;
+
+            entry.analysis->setPaused(numRunning >= _maxConcurrent);
+            numRunning++;
+        }
+    }
+}
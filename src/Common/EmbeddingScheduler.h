@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QObject>
+
+#include <vector>
+
+class TsneAnalysis;
+
+/**
+ * EmbeddingScheduler
+ *
+ * Shares the cores between the t-SNE analyses of a plugin, e.g. the embeddings of several HSNE refinements.
+ * At most a given number of computations run at the same time, the others are paused between two iterations.
+ * The most recently started or prioritized analysis runs first, a paused computation resumes once one with
+ * a higher priority finishes. Background analyses, e.g. speculative precomputations, only run in the slots
+ * that are left over.
+ */
+class EmbeddingScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int defaultMaxConcurrent = 2;
+
+public:
+    EmbeddingScheduler(QObject* parent = nullptr);
+
+    /** Maximum number of computations that run at the same time, at least one */
+    void setMaxConcurrent(int maxConcurrent);
+    int getMaxConcurrent() const { return _maxConcurrent; }
+
+    /** Schedule the computations of an analysis until it is removed or destroyed, background analyses run after all others */
+    void add(TsneAnalysis* analysis, bool background = false);
+    void remove(TsneAnalysis* analysis);
+
+    /** Run an analysis first, e.g. when its embedding is in focus */
+    void prioritize(TsneAnalysis* analysis);
+
+private:
+    /** Run the computing analyses with the highest priority and pause the others */
+    void update();
+
+private:
+    struct Entry
+    {
+        TsneAnalysis*   analysis;
+        bool            computing;      /** Between a computation request and its end */
+        bool            background;     /** Only runs in slots that no other computation needs */
+    };
+
+    std::vector<Entry>  _entries;           /** Scheduled analyses, from highest to lowest priority */
+    int                 _maxConcurrent;     /** Maximum number of computations at the same time */
+};
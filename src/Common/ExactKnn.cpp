@@ -0,0 +1,278 @@
+#include "ExactKnn.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    // Deterministic pseudo-random vantage point selection, such that repeated builds yield the same tree
+    uint32_t selectVantagePoint(uint32_t lower, uint32_t upper)
+    {
+        std::uint64_t h = static_cast<std::uint64_t>(lower) * 0x9E3779B97F4A7C15ull + upper;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        return lower + static_cast<uint32_t>(h % (upper - lower));
+    }
+
+    struct Range
+    {
+        uint32_t lower;
+        uint32_t upper;
+    };
+}
+
+VpTree::VpTree(const float* data, uint32_t numPoints, uint32_t numDimensions, hdi::dr::knn_distance_metric metric) :
+    _points(data),
+    _normalizedData(),
+    _numPoints(numPoints),
+    _numDimensions(numDimensions),
+    _manhattan(metric == hdi::dr::knn_distance_metric::KNN_METRIC_MANHATTAN),
+    _items(),
+    _splits(),
+    _thresholds()
+{
+    assert(supportsMetric(metric));
+
+    // On unit vectors the Euclidean distance is a monotone function of the cosine distance
+    if (metric == hdi::dr::knn_distance_metric::KNN_METRIC_COSINE)
+    {
+        _normalizedData.assign(data, data + static_cast<size_t>(numPoints) * numDimensions);
+
+#pragma omp parallel for
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(numPoints); ++i)
+        {
+            float* p = _normalizedData.data() + i * numDimensions;
+
+            float norm = 0;
+            for (uint32_t d = 0; d < numDimensions; ++d)
+                norm += p[d] * p[d];
+
+            if (norm > 0)
+            {
+                norm = 1.f / std::sqrt(norm);
+                for (uint32_t d = 0; d < numDimensions; ++d)
+                    p[d] *= norm;
+            }
+        }
+
+        _points = _normalizedData.data();
+    }
+
+    build();
+}
+
+bool VpTree::supportsMetric(hdi::dr::knn_distance_metric metric)
+{
+    return metric == hdi::dr::knn_distance_metric::KNN_METRIC_EUCLIDEAN ||
+           metric == hdi::dr::knn_distance_metric::KNN_METRIC_MANHATTAN ||
+           metric == hdi::dr::knn_distance_metric::KNN_METRIC_COSINE;
+}
+
+float VpTree::distance(const float* a, const float* b) const
+{
+    float dist = 0;
+
+    if (_manhattan)
+    {
+        for (uint32_t d = 0; d < _numDimensions; ++d)
+            dist += std::abs(a[d] - b[d]);
+        return dist;
+    }
+
+    for (uint32_t d = 0; d < _numDimensions; ++d)
+    {
+        const float diff = a[d] - b[d];
+        dist += diff * diff;
+    }
+    return std::sqrt(dist);
+}
+
+void VpTree::build()
+{
+    _items.resize(_numPoints);
+    _splits.assign(_numPoints, 0);
+    _thresholds.assign(_numPoints, 0.f);
+
+    for (uint32_t i = 0; i < _numPoints; ++i)
+        _items[i] = i;
+
+    if (_numPoints == 0)
+        return;
+
+    std::vector<Neighbor> work(_numPoints);
+
+    // Partition one node: move the vantage point to the front and split the remaining items at the median distance
+    auto partition = [this, &work](const Range& range, bool parallelDistances) -> uint32_t {
+        const uint32_t lower = range.lower;
+        const uint32_t upper = range.upper;
+
+        std::swap(_items[lower], _items[selectVantagePoint(lower, upper)]);
+        const float* vantagePoint = point(_items[lower]);
+
+#pragma omp parallel for if(parallelDistances)
+        for (std::int64_t i = lower + 1; i < static_cast<std::int64_t>(upper); ++i)
+            work[i] = { distance(vantagePoint, point(_items[i])), _items[i] };
+
+        const uint32_t median = (lower + 1 + upper) / 2;
+        std::nth_element(work.begin() + lower + 1, work.begin() + median, work.begin() + upper,
+            [](const Neighbor& a, const Neighbor& b) { return a.first < b.first; });
+
+        for (uint32_t i = lower + 1; i < upper; ++i)
+            _items[i] = work[i].second;
+
+        _splits[lower] = median;
+        _thresholds[lower] = work[median].first;
+
+        return median;
+    };
+
+    // Level-synchronous construction: few large nodes parallelize internally, many small nodes in parallel with each other
+    const auto numThreads = static_cast<size_t>(omp_get_max_threads());
+
+    std::vector<Range> level = { { 0, _numPoints } };
+    std::vector<Range> nextLevel;
+
+    while (!level.empty())
+    {
+        std::vector<uint32_t> medians(level.size());
+
+        if (level.size() < 4 * numThreads)
+        {
+            for (size_t n = 0; n < level.size(); ++n)
+                if (level[n].upper - level[n].lower > 1)
+                    medians[n] = partition(level[n], level[n].upper - level[n].lower > 4096);
+        }
+        else
+        {
+#pragma omp parallel for schedule(dynamic, 16)
+            for (std::int64_t n = 0; n < static_cast<std::int64_t>(level.size()); ++n)
+                if (level[n].upper - level[n].lower > 1)
+                    medians[n] = partition(level[n], false);
+        }
+
+        nextLevel.clear();
+        for (size_t n = 0; n < level.size(); ++n)
+        {
+            const auto& range = level[n];
+
+            if (range.upper - range.lower <= 1)
+            {
+                _splits[range.lower] = range.upper;
+                continue;
+            }
+
+            if (medians[n] > range.lower + 1)
+                nextLevel.push_back({ range.lower + 1, medians[n] });
+            if (range.upper > medians[n])
+                nextLevel.push_back({ medians[n], range.upper });
+        }
+
+        std::swap(level, nextLevel);
+    }
+}
+
+void VpTree::searchRange(const float* query, uint32_t lower, uint32_t upper, uint32_t k, std::vector<Neighbor>& heap, float& tau) const
+{
+    if (lower >= upper)
+        return;
+
+    const auto heapLess = [](const Neighbor& a, const Neighbor& b) { return a.first < b.first; };
+
+    const uint32_t item = _items[lower];
+    const float dist = distance(query, point(item));
+
+    if (dist < tau || heap.size() < k)
+    {
+        heap.emplace_back(dist, item);
+        std::push_heap(heap.begin(), heap.end(), heapLess);
+
+        if (heap.size() > k)
+        {
+            std::pop_heap(heap.begin(), heap.end(), heapLess);
+            heap.pop_back();
+        }
+
+        if (heap.size() == k)
+            tau = heap.front().first;
+    }
+
+    if (upper - lower == 1)
+        return;
+
+    const uint32_t split = _splits[lower];
+    const float threshold = _thresholds[lower];
+
+    // The left subtree holds distances <= threshold, the right one distances >= threshold
+    if (dist < threshold)
+    {
+        if (dist - tau <= threshold)
+            searchRange(query, lower + 1, split, k, heap, tau);
+        if (dist + tau >= threshold)
+            searchRange(query, split, upper, k, heap, tau);
+    }
+    else
+    {
+        if (dist + tau >= threshold)
+            searchRange(query, split, upper, k, heap, tau);
+        if (dist - tau <= threshold)
+            searchRange(query, lower + 1, split, k, heap, tau);
+    }
+}
+
+void VpTree::searchPoint(uint32_t pointIndex, uint32_t k, std::vector<Neighbor>& neighbors) const
+{
+    neighbors.clear();
+    neighbors.reserve(k + 1);
+
+    float tau = std::numeric_limits<float>::max();
+    searchRange(point(pointIndex), 0, _numPoints, k, neighbors, tau);
+
+    std::sort(neighbors.begin(), neighbors.end());
+}
+
+void computeExactKnn(const float* data, uint32_t numPoints, uint32_t numDimensions, uint32_t numNeighbors, hdi::dr::knn_distance_metric metric, std::vector<float>& distancesSquared, std::vector<int>& indices)
+{
+    numNeighbors = std::min(numNeighbors, numPoints);
+
+    distancesSquared.resize(static_cast<size_t>(numPoints) * numNeighbors);
+    indices.resize(static_cast<size_t>(numPoints) * numNeighbors);
+
+    if (numNeighbors == 0)
+        return;
+
+    const VpTree tree(data, numPoints, numDimensions, metric);
+
+#pragma omp parallel
+    {
+        std::vector<VpTree::Neighbor> neighbors;
+
+#pragma omp for schedule(dynamic, 256)
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(numPoints); ++i)
+        {
+            tree.searchPoint(static_cast<uint32_t>(i), numNeighbors, neighbors);
+
+            // With duplicates the point itself may tie with or be pushed out by others, keep it first
+            auto self = std::find_if(neighbors.begin(), neighbors.end(), [i](const VpTree::Neighbor& n) { return n.second == static_cast<uint32_t>(i); });
+            if (self == neighbors.end())
+            {
+                neighbors.pop_back();
+                neighbors.insert(neighbors.begin(), { 0.f, static_cast<uint32_t>(i) });
+            }
+            else
+                std::rotate(neighbors.begin(), self, self + 1);
+
+            const size_t offset = static_cast<size_t>(i) * numNeighbors;
+            for (uint32_t n = 0; n < numNeighbors; ++n)
+            {
+                const float dist = neighbors[n].first;
+                distancesSquared[offset + n] = dist * dist;
+                indices[offset + n] = static_cast<int>(neighbors[n].second);
+            }
+        }
+    }
+}
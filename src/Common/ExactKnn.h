@@ -0,0 +1,76 @@
+#pragma once
+
+#include "hdi/dimensionality_reduction/knn_utils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * VpTree
+ *
+ * Vantage-point tree for exact k-nearest-neighbor search in low-dimensional data.
+ * Supports the true metrics Euclidean, Manhattan and Cosine (as Euclidean distance on normalized vectors).
+ *
+ * The tree is stored implicitly: the node at position p of the item array covers the range [p, upper),
+ * its left subtree is [p + 1, split) and its right subtree is [split, upper).
+ * Construction is level-synchronous and parallel, queries are thread-safe.
+ */
+class VpTree
+{
+public:
+    using Neighbor = std::pair<float, uint32_t>;    // distance, point index
+
+public:
+    /**
+     * Build the tree over all points
+     * @param data Row-major point data, numPoints x numDimensions, must outlive the tree unless the metric is cosine
+     * @param numPoints Number of points
+     * @param numDimensions Number of dimensions
+     * @param metric Distance metric, see supportsMetric()
+     */
+    VpTree(const float* data, uint32_t numPoints, uint32_t numDimensions, hdi::dr::knn_distance_metric metric);
+
+    /** Whether the tree can be used with the given metric */
+    static bool supportsMetric(hdi::dr::knn_distance_metric metric);
+
+    /**
+     * Search the k nearest neighbors of a point in the tree
+     * @param pointIndex Index of the query point
+     * @param k Number of neighbors, the point itself included
+     * @param neighbors Output, sorted by increasing distance
+     */
+    void searchPoint(uint32_t pointIndex, uint32_t k, std::vector<Neighbor>& neighbors) const;
+
+private:
+    void build();
+    void searchRange(const float* query, uint32_t lower, uint32_t upper, uint32_t k, std::vector<Neighbor>& heap, float& tau) const;
+
+    float distance(const float* a, const float* b) const;
+    const float* point(uint32_t pointIndex) const { return _points + static_cast<size_t>(pointIndex) * _numDimensions; }
+
+private:
+    const float*                    _points;            /** Point data used for distance computations */
+    std::vector<float>              _normalizedData;    /** Normalized copy of the data for the cosine metric */
+    uint32_t                        _numPoints;         /** Number of points */
+    uint32_t                        _numDimensions;     /** Number of dimensions */
+    bool                            _manhattan;         /** L1 instead of L2 distance */
+
+    std::vector<uint32_t>           _items;             /** Point indices in tree order, the vantage point of a node is its first item */
+    std::vector<uint32_t>           _splits;            /** Start of the right subtree per node */
+    std::vector<float>              _thresholds;        /** Median distance to the vantage point per node */
+};
+
+/**
+ * Compute the exact k nearest neighbors of all points with a VP-tree, in parallel.
+ * The output follows the HDI convention: numNeighbors entries per point, the point itself first.
+ * @param data Row-major point data, numPoints x numDimensions
+ * @param numPoints Number of points
+ * @param numDimensions Number of dimensions
+ * @param numNeighbors Number of neighbors per point, including the point itself
+ * @param metric Distance metric, see VpTree::supportsMetric()
+ * @param distancesSquared Output, squared distances, also for the Manhattan metric
+ * @param indices Output, neighbor indices
+ */
+void computeExactKnn(const float* data, uint32_t numPoints, uint32_t numDimensions, uint32_t numNeighbors, hdi::dr::knn_distance_metric metric, std::vector<float>& distancesSquared, std::vector<int>& indices);
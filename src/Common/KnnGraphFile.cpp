@@ -0,0 +1,158 @@
+#include "KnnGraphFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <utility>
+
+namespace
+{
+    constexpr char magic[8] = { 'K', 'N', 'N', 'G', 'R', 'A', 'P', 'H' };
+
+    struct FileHeader
+    {
+        char            magic[8];
+        std::uint32_t   version;
+        std::uint32_t   flags;
+        std::uint64_t   numPoints;
+        std::uint64_t   numEntries;
+    };
+
+    static_assert(sizeof(FileHeader) == 32, "Unexpected padding in FileHeader");
+
+    template<typename T>
+    bool readArray(std::ifstream& stream, std::vector<T>& values, std::uint64_t count)
+    {
+        values.resize(count);
+        stream.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(count * sizeof(T)));
+        return static_cast<bool>(stream);
+    }
+
+    template<typename T>
+    void writeArray(std::ofstream& stream, const std::vector<T>& values)
+    {
+        stream.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+    }
+}
+
+std::uint32_t KnnGraph::maxNumNeighbors() const
+{
+    std::uint64_t maxNumNeighbors = 0;
+    for (size_t i = 0; i + 1 < offsets.size(); i++)
+        maxNumNeighbors = std::max(maxNumNeighbors, offsets[i + 1] - offsets[i]);
+
+    return static_cast<std::uint32_t>(maxNumNeighbors);
+}
+
+std::uint32_t KnnGraph::toFlat(std::vector<float>& flatDistancesSquared, std::vector<int>& flatIndices) const
+{
+    const std::uint32_t numNeighbors = maxNumNeighbors();
+    const std::int64_t numRows = numPoints();
+
+    flatDistancesSquared.assign(static_cast<size_t>(numRows) * numNeighbors, 0.f);
+    flatIndices.assign(static_cast<size_t>(numRows) * numNeighbors, -1);
+
+#pragma omp parallel for
+    for (std::int64_t i = 0; i < numRows; i++)
+    {
+        const size_t flatOffset = static_cast<size_t>(i) * numNeighbors;
+        for (std::uint64_t n = offsets[i]; n < offsets[i + 1]; n++)
+        {
+            flatIndices[flatOffset + n - offsets[i]] = static_cast<int>(indices[n]);
+            flatDistancesSquared[flatOffset + n - offsets[i]] = distancesSquared[n];
+        }
+    }
+
+    return numNeighbors;
+}
+
+bool KnnGraphFile::load(const std::string& fileName, KnnGraph& graph)
+{
+    std::ifstream loadFile(fileName, std::ios::in | std::ios::binary);
+
+    if (!loadFile.is_open())
+    {
+        std::cerr << "Loading kNN graph failed. File could not be opened: " << fileName << std::endl;
+        return false;
+    }
+
+    FileHeader header = {};
+    loadFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!loadFile || std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)
+    {
+        std::cerr << "Loading kNN graph failed. Unknown format or version: " << fileName << std::endl;
+        return false;
+    }
+
+    // Neighbor indices are 32 bit, as are the point indices of the embeddings
+    if (header.numPoints > std::numeric_limits<std::uint32_t>::max())
+    {
+        std::cerr << "Loading kNN graph failed. Too many points: " << header.numPoints << std::endl;
+        return false;
+    }
+
+    std::vector<float> distances;
+    if (!readArray(loadFile, graph.offsets, header.numPoints + 1) || !readArray(loadFile, graph.indices, header.numEntries) || !readArray(loadFile, distances, header.numEntries))
+    {
+        std::cerr << "Loading kNN graph failed. File is truncated: " << fileName << std::endl;
+        graph = KnnGraph();
+        return false;
+    }
+
+    bool valid = graph.offsets.front() == 0 && graph.offsets.back() == header.numEntries;
+    for (size_t i = 1; valid && i < graph.offsets.size(); i++)
+        valid = graph.offsets[i] >= graph.offsets[i - 1];
+
+    valid = valid && std::all_of(graph.indices.begin(), graph.indices.end(), [&header](std::uint32_t index) { return index < header.numPoints; });
+
+    if (!valid)
+    {
+        std::cerr << "Loading kNN graph failed. Offsets or neighbor indices are out of range: " << fileName << std::endl;
+        graph = KnnGraph();
+        return false;
+    }
+
+    if ((header.flags & squaredDistancesFlag) == 0)
+        for (float& distance : distances)
+            distance *= distance;
+
+    graph.distancesSquared = std::move(distances);
+
+    return true;
+}
+
+bool KnnGraphFile::save(const std::string& fileName, const KnnGraph& graph)
+{
+    std::ofstream saveFile(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!saveFile.is_open())
+    {
+        std::cerr << "Saving kNN graph failed. File could not be opened: " << fileName << std::endl;
+        return false;
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.flags = squaredDistancesFlag;
+    header.numPoints = graph.numPoints();
+    header.numEntries = graph.indices.size();
+
+    saveFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeArray(saveFile, graph.offsets);
+    writeArray(saveFile, graph.indices);
+    writeArray(saveFile, graph.distancesSquared);
+
+    saveFile.close();
+
+    if (!saveFile)
+    {
+        std::cerr << "Saving kNN graph failed. File could not be written: " << fileName << std::endl;
+        return false;
+    }
+
+    return true;
+}
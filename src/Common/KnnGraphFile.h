@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * KnnGraph
+ *
+ * Precomputed nearest neighbor graph in compressed sparse row layout, e.g. from an earlier run on the same data
+ * or from an external batch job: the neighbors of point i are indices[offsets[i]] ... indices[offsets[i + 1] - 1].
+ * Rows may differ in length and may contain the point itself.
+ */
+struct KnnGraph
+{
+    std::vector<std::uint64_t>  offsets;            /** Start of every point in indices, number of points + 1 entries */
+    std::vector<std::uint32_t>  indices;            /** Neighbor indices of all points */
+    std::vector<float>          distancesSquared;   /** Squared distance of every neighbor */
+
+    /** Number of points */
+    std::uint32_t numPoints() const { return offsets.empty() ? 0 : static_cast<std::uint32_t>(offsets.size() - 1); }
+
+    /** Number of neighbors of the point with the most neighbors */
+    std::uint32_t maxNumNeighbors() const;
+
+    /**
+     * Fixed-width neighbor lists as used by the similarity utilities, shorter rows are padded with index -1
+     * @param flatDistancesSquared Output, numNeighbors entries per point
+     * @param flatIndices Output, numNeighbors entries per point
+     * @return Number of neighbors per point
+     */
+    std::uint32_t toFlat(std::vector<float>& flatDistancesSquared, std::vector<int>& flatIndices) const;
+};
+
+/**
+ * KnnGraphFile
+ *
+ * Binary file format of a KnnGraph, all values little endian:
+ *   char[8]    magic "KNNGRAPH"
+ *   uint32     version, currently 1
+ *   uint32     flags, bit 0 set if the distances are squared, e.g. as reported by FLANN for the Euclidean metric
+ *   uint64     number of points
+ *   uint64     number of neighbor entries
+ *   uint64[]   number of points + 1 row offsets
+ *   uint32[]   neighbor indices
+ *   float[]    neighbor distances
+ */
+namespace KnnGraphFile
+{
+    constexpr std::uint32_t version = 1;
+
+    /** Distances in the file are squared */
+    constexpr std::uint32_t squaredDistancesFlag = 1;
+
+    /**
+     * Read and validate a neighbor graph
+     * @param fileName Path of the graph file
+     * @param graph Output, distances are squared on loading if needed
+     * @return Whether the file was valid and read completely
+     */
+    bool load(const std::string& fileName, KnnGraph& graph);
+
+    /**
+     * Write a neighbor graph
+     * @param fileName Path of the graph file
+     * @param graph Graph to write, distances are stored squared
+     * @return Whether the file was written completely
+     */
+    bool save(const std::string& fileName, const KnnGraph& graph);
+}
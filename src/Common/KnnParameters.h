@@ -1,7 +1,12 @@
 #pragma once
 
+#include "ExactKnn.h"
+
 #include "hdi/dimensionality_reduction/knn_utils.h"
 
+#include <algorithm>
+#include <cstdint>
+
 /**
  * KnnParameters
  *
@@ -18,7 +23,9 @@ public:
         _AnnoyNumChecksAknn(512),
         _AnnoyNumTrees(4),
         _HNSW_M(16),
-        _HNSW_ef_construction(200)
+        _HNSW_ef_construction(200),
+        _exactKnn(false),
+        _exactKnnMaxDimensions(0)
     {
 
     }
@@ -28,6 +35,8 @@ public:
     void setAnnoyNumTrees(int numTrees) { _AnnoyNumTrees = numTrees; }
     void setHNSWm(int m) { _HNSW_M = m; }
     void setHNSWef(int ef) { _HNSW_ef_construction = ef; }
+    void setExactKnn(bool exactKnn) { _exactKnn = exactKnn; }
+    void setExactKnnMaxDimensions(int maxDimensions) { _exactKnnMaxDimensions = maxDimensions; }
 
     hdi::dr::knn_library getKnnAlgorithm() const { return _knnLibrary; }
     hdi::dr::knn_distance_metric getKnnDistanceMetric() const { return _aknn_metric; }
@@ -35,6 +44,15 @@ public:
     int getAnnoyNumTrees() const { return _AnnoyNumTrees; }
     int getHNSWm() const { return _HNSW_M; }
     int getHNSWef() const { return _HNSW_ef_construction; }
+    bool getExactKnn() const { return _exactKnn; }
+    int getExactKnnMaxDimensions() const { return _exactKnnMaxDimensions; }
+
+    /** Whether the exact VP-tree search is used for data with the given number of dimensions, either selected explicitly or picked automatically for low-dimensional data */
+    bool useExactKnn(uint32_t numDimensions) const {
+        if (!VpTree::supportsMetric(_aknn_metric))
+            return false;
+        return _exactKnn || numDimensions < static_cast<uint32_t>(std::max(_exactKnnMaxDimensions, 0));
+    }
 
 private:
     
@@ -46,4 +64,7 @@ private:
 
     int            _HNSW_M;                         /** hnsw: construction time/accuracy trade-off  */
     int            _HNSW_ef_construction;           /** hnsw: maximum number of outgoing connections in the graph  */
+
+    bool           _exactKnn;                       /** Always use the exact VP-tree search instead of the approximate library */
+    int            _exactKnnMaxDimensions;          /** Automatically use the exact search for data with fewer dimensions than this, 0 disables */
 };
@@ -10,22 +10,28 @@ KnnSettingsAction::KnnSettingsAction(QObject* parent, KnnParameters& knnParamete
     _numTreesAction(this, "Annoy Trees"),
     _numChecksAction(this, "Annoy Checks"),
     _mAction(this, "HNSW M"),
-    _efAction(this, "HNSW ef")
+    _efAction(this, "HNSW ef"),
+    _exactKnnMaxDimensionsAction(this, "Exact kNN below #dims")
 {
     addAction(&_numTreesAction);
     addAction(&_numChecksAction);
     addAction(&_mAction);
     addAction(&_efAction);
+    addAction(&_exactKnnMaxDimensionsAction);
 
     _numTreesAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
     _numChecksAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
     _mAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
     _efAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
+    _exactKnnMaxDimensionsAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
 
     _numTreesAction.initialize(1, 10000, 4);
     _numChecksAction.initialize(1, 10000, 1024);
     _mAction.initialize(2, 300, 16);
     _efAction.initialize(1, 10000, 200);
+    _exactKnnMaxDimensionsAction.initialize(0, 100, 0);
+
+    _exactKnnMaxDimensionsAction.setToolTip("Use the exact VP-tree kNN search instead of the approximate library for data with fewer dimensions than this.\nOnly for the Euclidean, Cosine and Manhattan metrics, 0 disables the automatic selection.");
 
     const auto updateNumTrees = [this]() -> void {
         _knnParameters.setAnnoyNumTrees(_numTreesAction.getValue());
@@ -43,6 +49,10 @@ KnnSettingsAction::KnnSettingsAction(QObject* parent, KnnParameters& knnParamete
         _knnParameters.setHNSWef(_efAction.getValue());
     };
 
+    const auto updateExactKnnMaxDimensions = [this]() -> void {
+        _knnParameters.setExactKnnMaxDimensions(_exactKnnMaxDimensionsAction.getValue());
+    };
+
     const auto updateReadOnly = [this]() -> void {
         const auto enable = !isReadOnly();
 
@@ -50,6 +60,7 @@ KnnSettingsAction::KnnSettingsAction(QObject* parent, KnnParameters& knnParamete
         _numChecksAction.setEnabled(enable);
         _mAction.setEnabled(enable);
         _efAction.setEnabled(enable);
+        _exactKnnMaxDimensionsAction.setEnabled(enable);
     };
 
     connect(&_numTreesAction, &IntegralAction::valueChanged, this, [this, updateNumTrees](const std::int32_t& value) {
@@ -68,6 +79,10 @@ KnnSettingsAction::KnnSettingsAction(QObject* parent, KnnParameters& knnParamete
         updateEf();
     });
 
+    connect(&_exactKnnMaxDimensionsAction, &IntegralAction::valueChanged, this, [this, updateExactKnnMaxDimensions](const std::int32_t& value) {
+        updateExactKnnMaxDimensions();
+    });
+
     connect(this, &GroupAction::readOnlyChanged, this, [this, updateReadOnly](const bool& readOnly) {
         updateReadOnly();
     });
@@ -76,6 +91,7 @@ KnnSettingsAction::KnnSettingsAction(QObject* parent, KnnParameters& knnParamete
     updateNumChecks();
     updateM();
     updateEf();
+    updateExactKnnMaxDimensions();
     updateReadOnly();
 }
 
@@ -87,6 +103,7 @@ void KnnSettingsAction::fromVariantMap(const QVariantMap& variantMap)
     _numChecksAction.fromParentVariantMap(variantMap);
     _mAction.fromParentVariantMap(variantMap);
     _efAction.fromParentVariantMap(variantMap);
+    _exactKnnMaxDimensionsAction.fromParentVariantMap(variantMap);
 }
 
 QVariantMap KnnSettingsAction::toVariantMap() const
@@ -97,6 +114,7 @@ QVariantMap KnnSettingsAction::toVariantMap() const
     _numChecksAction.insertIntoVariantMap(variantMap);
     _mAction.insertIntoVariantMap(variantMap);
     _efAction.insertIntoVariantMap(variantMap);
+    _exactKnnMaxDimensionsAction.insertIntoVariantMap(variantMap);
 
     return variantMap;
 }
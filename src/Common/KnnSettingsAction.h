@@ -30,6 +30,7 @@ public: // Action getters
     IntegralAction& getNumChecksAction() { return _numChecksAction; };
     IntegralAction& getMAction() { return _mAction; };
     IntegralAction& getEfAction() { return _efAction; };
+    IntegralAction& getExactKnnMaxDimensionsAction() { return _exactKnnMaxDimensionsAction; };
 
 public: // Serialization
 
@@ -51,6 +52,7 @@ protected:
     IntegralAction          _numChecksAction;           /** Annoy parameter Checks action */
     IntegralAction          _mAction;                   /** HNSW parameter M action */
     IntegralAction          _efAction;                  /** HNSW parameter ef action */
+    IntegralAction          _exactKnnMaxDimensionsAction;   /** Dimensionality below which the exact kNN search is used automatically */
 
     friend class Widget;
 };
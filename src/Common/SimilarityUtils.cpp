@@ -0,0 +1,367 @@
+#include "SimilarityUtils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace
+{
+    // Non-self neighbors of point i with their distances, in kNN order
+    void gatherNeighbors(const std::vector<float>& distancesSquared, const std::vector<int>& knnIndices, std::int64_t i, uint32_t numNeighbors, std::vector<uint32_t>& selected, std::vector<double>& distances)
+    {
+        const size_t offset = static_cast<size_t>(i) * numNeighbors;
+
+        selected.clear();
+        distances.clear();
+        for (uint32_t n = 0; n < numNeighbors; ++n)
+        {
+            const int neighbor = knnIndices[offset + n];
+            if (neighbor < 0 || neighbor == i)
+                continue;
+
+            selected.push_back(static_cast<uint32_t>(neighbor));
+            distances.push_back(distancesSquared[offset + n]);
+        }
+    }
+
+    // Binary search for the precision beta = 1 / (2 sigma^2) that matches the target perplexity, outputs normalized weights
+    void calibrateGaussianRow(const double* distances, size_t count, double perplexity, double* weights)
+    {
+        const double targetEntropy = std::log(perplexity);
+        constexpr double tolerance = 1e-5;
+        constexpr int maxIterations = 200;
+
+        // Shifting by the smallest distance avoids underflow and does not change the normalized weights
+        const double minDistance = *std::min_element(distances, distances + count);
+
+        double beta = 1;
+        double betaMin = -std::numeric_limits<double>::max();
+        double betaMax = std::numeric_limits<double>::max();
+        double sum = 0;
+
+        for (int iter = 0; iter < maxIterations; ++iter)
+        {
+            sum = 0;
+            double weightedDistances = 0;
+            for (size_t n = 0; n < count; ++n)
+            {
+                weights[n] = std::exp(-beta * (distances[n] - minDistance));
+                sum += weights[n];
+                weightedDistances += weights[n] * (distances[n] - minDistance);
+            }
+
+            const double entropy = std::log(sum) + beta * weightedDistances / sum;
+            const double difference = entropy - targetEntropy;
+
+            if (std::abs(difference) < tolerance)
+                break;
+
+            if (difference > 0)
+            {
+                betaMin = beta;
+                beta = (betaMax == std::numeric_limits<double>::max()) ? beta * 2 : (beta + betaMax) / 2;
+            }
+            else
+            {
+                betaMax = beta;
+                beta = (betaMin == -std::numeric_limits<double>::max()) ? beta / 2 : (beta + betaMin) / 2;
+            }
+        }
+
+        for (size_t n = 0; n < count; ++n)
+            weights[n] /= sum;
+    }
+
+    // Rows of a MapMemEff are filled fastest in index order
+    void writeRow(const std::vector<uint32_t>& selected, const std::vector<double>& values, size_t count, hdi::data::MapMemEff<uint32_t, float>& probRow)
+    {
+        std::vector<std::pair<uint32_t, float>> row;
+        row.reserve(count);
+        for (size_t n = 0; n < count; ++n)
+            if (values[n] > 0)
+                row.emplace_back(selected[n], static_cast<float>(values[n]));
+
+        std::sort(row.begin(), row.end());
+
+        for (const auto& entry : row)
+            probRow[entry.first] = entry.second;
+    }
+
+    // Each perplexity uses as many neighbors as a single-scale computation would, 3 * perplexity
+    size_t numNeighborsForPerplexity(float perplexity, size_t available)
+    {
+        return std::max<size_t>(1, std::min(available, static_cast<size_t>(3 * perplexity)));
+    }
+}
+
+void computeGaussianProbabilities(const std::vector<float>& distancesSquared, const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, float perplexity, ProbDistMatrix& probDist)
+{
+    assert(knnIndices.size() == static_cast<size_t>(numPoints) * numNeighbors);
+    assert(distancesSquared.size() == knnIndices.size());
+
+    probDist.clear();
+    probDist.resize(numPoints);
+
+#pragma omp parallel
+    {
+        std::vector<uint32_t> selected;
+        std::vector<double> distances;
+        std::vector<double> weights;
+
+#pragma omp for schedule(dynamic, 1024)
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(numPoints); ++i)
+        {
+            gatherNeighbors(distancesSquared, knnIndices, i, numNeighbors, selected, distances);
+
+            if (selected.empty())
+                continue;
+
+            weights.resize(selected.size());
+            calibrateGaussianRow(distances.data(), distances.size(), perplexity, weights.data());
+
+            writeRow(selected, weights, selected.size(), probDist[i]);
+        }
+    }
+}
+
+void computeMultiscaleGaussianProbabilities(const std::vector<float>& distancesSquared, const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, const std::vector<float>& perplexities, ProbDistMatrix& probDist)
+{
+    assert(knnIndices.size() == static_cast<size_t>(numPoints) * numNeighbors);
+    assert(distancesSquared.size() == knnIndices.size());
+    assert(!perplexities.empty());
+
+    probDist.clear();
+    probDist.resize(numPoints);
+
+    const double scaleWeight = 1. / perplexities.size();
+
+#pragma omp parallel
+    {
+        std::vector<uint32_t> selected;
+        std::vector<double> distances;
+        std::vector<double> weights;
+        std::vector<double> averaged;
+
+#pragma omp for schedule(dynamic, 256)
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(numPoints); ++i)
+        {
+            gatherNeighbors(distancesSquared, knnIndices, i, numNeighbors, selected, distances);
+
+            if (selected.empty())
+                continue;
+
+            weights.resize(selected.size());
+            averaged.assign(selected.size(), 0.);
+
+            for (const auto perplexity : perplexities)
+            {
+                const size_t count = numNeighborsForPerplexity(perplexity, selected.size());
+                calibrateGaussianRow(distances.data(), count, perplexity, weights.data());
+
+                for (size_t n = 0; n < count; ++n)
+                    averaged[n] += scaleWeight * weights[n];
+            }
+
+            writeRow(selected, averaged, selected.size(), probDist[i]);
+        }
+    }
+}
+
+void computeGaussianProbabilitiesPerPerplexity(const std::vector<float>& distancesSquared, const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, const std::vector<float>& perplexities, std::vector<ProbDistMatrix>& probDists)
+{
+    assert(knnIndices.size() == static_cast<size_t>(numPoints) * numNeighbors);
+    assert(distancesSquared.size() == knnIndices.size());
+
+    probDists.clear();
+    probDists.resize(perplexities.size());
+    for (auto& probDist : probDists)
+        probDist.resize(numPoints);
+
+#pragma omp parallel
+    {
+        std::vector<uint32_t> selected;
+        std::vector<double> distances;
+        std::vector<double> weights;
+
+#pragma omp for schedule(dynamic, 256)
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(numPoints); ++i)
+        {
+            gatherNeighbors(distancesSquared, knnIndices, i, numNeighbors, selected, distances);
+
+            if (selected.empty())
+                continue;
+
+            weights.resize(selected.size());
+
+            for (size_t s = 0; s < perplexities.size(); ++s)
+            {
+                const size_t count = numNeighborsForPerplexity(perplexities[s], selected.size());
+                calibrateGaussianRow(distances.data(), count, perplexities[s], weights.data());
+
+                writeRow(selected, weights, count, probDists[s][i]);
+            }
+        }
+    }
+}
+
+void surrogateDistancesFromProbabilities(const std::vector<float>& probabilities, std::vector<float>& distances)
+{
+    // -log(p) = beta * d + log(Z) is an increasing affine map of the distance per row, which the calibration is invariant to
+    constexpr float maxSurrogate = 104.f;  // -log of the smallest positive float
+
+    distances.resize(probabilities.size());
+
+#pragma omp parallel for
+    for (std::int64_t i = 0; i < static_cast<std::int64_t>(probabilities.size()); ++i)
+        distances[i] = probabilities[i] > 0 ? std::min(-std::log(probabilities[i]), maxSurrogate) : maxSurrogate;
+}
+
+void computeUniformProbabilities(const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, uint32_t k, ProbDistMatrix& probDist)
+{
+    assert(knnIndices.size() == static_cast<size_t>(numPoints) * numNeighbors);
+
+    probDist.clear();
+    probDist.resize(numPoints);
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (std::int64_t i = 0; i < static_cast<std::int64_t>(numPoints); ++i)
+    {
+        const auto* neighbors = knnIndices.data() + i * numNeighbors;
+
+        // The point itself is usually, but not always, the first entry of its neighbor list
+        std::vector<uint32_t> selected;
+        selected.reserve(k);
+        for (uint32_t n = 0; n < numNeighbors && selected.size() < k; ++n)
+            if (neighbors[n] >= 0 && neighbors[n] != i)
+                selected.push_back(static_cast<uint32_t>(neighbors[n]));
+
+        if (selected.empty())
+            continue;
+
+        std::sort(selected.begin(), selected.end());
+
+        const float weight = 1.f / selected.size();
+
+        auto& row = probDist[i];
+        for (const auto neighbor : selected)
+            row[neighbor] = weight;
+    }
+}
+
+void knnProbabilitiesToMatrix(const std::vector<float>& probabilities, const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, ProbDistMatrix& probDist)
+{
+    assert(knnIndices.size() == static_cast<size_t>(numPoints) * numNeighbors);
+    assert(probabilities.size() == knnIndices.size());
+
+    probDist.clear();
+    probDist.resize(numPoints);
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (std::int64_t i = 0; i < static_cast<std::int64_t>(numPoints); ++i)
+    {
+        const size_t offset = static_cast<size_t>(i) * numNeighbors;
+
+        std::vector<std::pair<uint32_t, float>> row;
+        row.reserve(numNeighbors);
+        for (uint32_t n = 0; n < numNeighbors; ++n)
+        {
+            const int neighbor = knnIndices[offset + n];
+            if (neighbor >= 0 && neighbor != i && probabilities[offset + n] > 0)
+                row.emplace_back(static_cast<uint32_t>(neighbor), probabilities[offset + n]);
+        }
+
+        std::sort(row.begin(), row.end());
+
+        auto& probRow = probDist[i];
+        for (const auto& entry : row)
+            probRow[entry.first] = entry.second;
+    }
+}
+
+void applyPointWeights(ProbDistMatrix& probDist, const std::vector<float>& pointWeights)
+{
+    assert(probDist.size() == pointWeights.size());
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (std::int64_t i = 0; i < static_cast<std::int64_t>(probDist.size()); ++i)
+    {
+        auto& row = probDist[i];
+
+        double sum = 0;
+        for (const auto& entry : row)
+            sum += static_cast<double>(entry.second) * pointWeights[entry.first];
+
+        if (sum <= 0)
+            continue;
+
+        const double scale = pointWeights[i] / sum;
+        for (auto& entry : row)
+            entry.second = static_cast<float>(entry.second * pointWeights[entry.first] * scale);
+    }
+}
+
+void symmetrizeProbabilities(ProbDistMatrix& probDist)
+{
+    using Entry = std::pair<uint32_t, float>;
+
+    const auto numPoints = static_cast<std::int64_t>(probDist.size());
+
+    // Count-then-scatter the transposed entries such that every row can afterwards be merged on its own
+    std::vector<std::uint64_t> offsets(numPoints + 1, 0);
+    for (std::int64_t i = 0; i < numPoints; ++i)
+        for (const auto& entry : probDist[i])
+            offsets[entry.first + 1]++;
+
+    for (std::int64_t i = 0; i < numPoints; ++i)
+        offsets[i + 1] += offsets[i];
+
+    std::vector<Entry> transposed(offsets.back());
+    {
+        std::vector<std::uint64_t> insertPos(offsets.begin(), offsets.end() - 1);
+        for (std::int64_t i = 0; i < numPoints; ++i)
+            for (const auto& entry : probDist[i])
+                transposed[insertPos[entry.first]++] = { static_cast<uint32_t>(i), entry.second };  // rows are visited in order, so every transposed row is sorted
+    }
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (std::int64_t i = 0; i < numPoints; ++i)
+    {
+        auto& row = probDist[i];
+
+        std::vector<Entry> own(row.begin(), row.end());
+        std::sort(own.begin(), own.end(), [](const Entry& a, const Entry& b) { return a.first < b.first; });
+
+        auto ownIt = own.cbegin();
+        auto transIt = transposed.cbegin() + offsets[i];
+        const auto transEnd = transposed.cbegin() + offsets[i + 1];
+
+        std::vector<Entry> merged;
+        merged.reserve(own.size() + (transEnd - transIt));
+
+        while (ownIt != own.cend() || transIt != transEnd)
+        {
+            if (transIt == transEnd || (ownIt != own.cend() && ownIt->first < transIt->first))
+            {
+                merged.emplace_back(ownIt->first, 0.5f * ownIt->second);
+                ++ownIt;
+            }
+            else if (ownIt == own.cend() || transIt->first < ownIt->first)
+            {
+                merged.emplace_back(transIt->first, 0.5f * transIt->second);
+                ++transIt;
+            }
+            else
+            {
+                merged.emplace_back(ownIt->first, 0.5f * (ownIt->second + transIt->second));
+                ++ownIt;
+                ++transIt;
+            }
+        }
+
+        row.clear();
+        for (const auto& entry : merged)
+            row[entry.first] = entry.second;
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "hdi/dimensionality_reduction/hd_joint_probability_generator.h"
+
+#include <cstdint>
+#include <vector>
+
+using ProbDistMatrix = hdi::dr::HDJointProbabilityGenerator<float>::sparse_scalar_matrix_type;
+
+/**
+ * Similarity utilities
+ *
+ * Helper functions for computing high-dimensional probability distributions
+ * from nearest neighbor lists, complementing the HDI probability generator
+ */
+
+/**
+ * Compute conditional probabilities with a Gaussian kernel whose bandwidth is calibrated per point to the given perplexity,
+ * following the HDI probability generator. The point itself is skipped.
+ * @param distancesSquared Flat squared neighbor distances, numNeighbors entries per point
+ * @param knnIndices Flat neighbor indices, numNeighbors entries per point
+ * @param numPoints Number of points
+ * @param numNeighbors Number of neighbors per point in knnIndices
+ * @param perplexity Target perplexity
+ * @param probDist Output, resized to numPoints rows
+ */
+void computeGaussianProbabilities(const std::vector<float>& distancesSquared, const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, float perplexity, ProbDistMatrix& probDist);
+
+/**
+ * Compute multi-scale conditional probabilities from a single kNN pass: a Gaussian kernel is calibrated per perplexity
+ * (using the first 3 * perplexity neighbors) and the resulting conditional probabilities are averaged.
+ * The neighbor lists must cover 3 * the largest perplexity.
+ * @param distancesSquared Flat squared neighbor distances, numNeighbors entries per point
+ * @param knnIndices Flat neighbor indices, numNeighbors entries per point
+ * @param numPoints Number of points
+ * @param numNeighbors Number of neighbors per point in knnIndices
+ * @param perplexities Target perplexities
+ * @param probDist Output, resized to numPoints rows
+ */
+void computeMultiscaleGaussianProbabilities(const std::vector<float>& distancesSquared, const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, const std::vector<float>& perplexities, ProbDistMatrix& probDist);
+
+/**
+ * Like computeMultiscaleGaussianProbabilities() but outputs separate conditional probabilities per perplexity instead of their average
+ * @param probDists Output, one matrix per perplexity
+ */
+void computeGaussianProbabilitiesPerPerplexity(const std::vector<float>& distancesSquared, const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, const std::vector<float>& perplexities, std::vector<ProbDistMatrix>& probDists);
+
+/**
+ * Recover distance surrogates -log(p) from Gaussian conditional probabilities, e.g. as computed by the HDI probability generator
+ * for the largest perplexity. Gaussian calibration is invariant to the per-row scale and shift of these surrogates.
+ * @param probabilities Flat conditional probabilities
+ * @param distances Output, surrogate squared distances
+ */
+void surrogateDistancesFromProbabilities(const std::vector<float>& probabilities, std::vector<float>& distances);
+
+/**
+ * Compute conditional probabilities with a uniform kernel: p_j|i = 1/k for the first k neighbors of i, excluding i itself.
+ * @param knnIndices Flat neighbor indices, numNeighbors entries per point
+ * @param numPoints Number of points
+ * @param numNeighbors Number of neighbors per point in knnIndices
+ * @param k Number of neighbors that receive a non-zero probability
+ * @param probDist Output, resized to numPoints rows
+ */
+void computeUniformProbabilities(const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, uint32_t k, ProbDistMatrix& probDist);
+
+/**
+ * Convert flat conditional probabilities as computed by the HDI probability generator into a sparse matrix, skipping the point itself.
+ * @param probabilities Flat conditional probabilities, numNeighbors entries per point
+ * @param knnIndices Flat neighbor indices, numNeighbors entries per point
+ * @param numPoints Number of points
+ * @param numNeighbors Number of neighbors per point in knnIndices
+ * @param probDist Output, resized to numPoints rows
+ */
+void knnProbabilitiesToMatrix(const std::vector<float>& probabilities, const std::vector<int>& knnIndices, uint32_t numPoints, uint32_t numNeighbors, ProbDistMatrix& probDist);
+
+/**
+ * Account for points that stand in for several identical points: the conditional probabilities of every row are
+ * reweighted by the neighbor weights, renormalized and scaled by the weight of the row point.
+ * Symmetrizing the result yields the joint probabilities of the original points aggregated per representative.
+ * @param probDist Conditional probabilities, one row per point
+ * @param pointWeights Number of original points per point
+ */
+void applyPointWeights(ProbDistMatrix& probDist, const std::vector<float>& pointWeights);
+
+/**
+ * Symmetrize conditional probabilities in place, p_ij = p_ji = (p_j|i + p_i|j) / 2, like HDI does for joint probabilities.
+ * Rows are merged independently in parallel.
+ * @param probDist Conditional probabilities, one row per point
+ */
+void symmetrizeProbabilities(ProbDistMatrix& probDist);
@@ -3,7 +3,9 @@
 #include "hdi/utils/glad/glad.h"
 #include "OffscreenBuffer.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <vector>
 
 #include <QCoreApplication>
@@ -20,7 +22,11 @@ TsneWorker::TsneWorker(TsneParameters tsneParameters) :
     _numPoints(0),
     _numDimensions(0),
     _data(),
+    _pointWeights(),
+    _knnDistances(),
+    _knnIndices(),
     _probabilityDistribution(),
+    _sharedProbabilityDistribution(),
     _hasProbabilityDistribution(false),
     _GPGPU_tSNE(),
     _CPU_tSNE(),
@@ -28,6 +34,13 @@ TsneWorker::TsneWorker(TsneParameters tsneParameters) :
     _outEmbedding(),
     _offscreenBuffer(nullptr),
     _shouldStop(false),
+    _paused(false),
+    _pauseMutex(),
+    _resumeCondition(),
+    _refinedSimilarities(),
+    _refinementThread(),
+    _refinementCancelled(false),
+    _restartGradientDescent(false),
     _parentTask(nullptr),
     _tasks(nullptr)
 {
@@ -42,7 +55,7 @@ TsneWorker::TsneWorker(TsneParameters tsneParameters, KnnParameters knnParameter
     assert(numDimensions > 0);
     _numPoints = data.size() / numDimensions;
     _numDimensions = numDimensions;
-    _data = data;
+    _data = std::make_shared<const std::vector<float>>(data);
     _embedding = { static_cast<uint32_t>(_tsneParameters.getNumDimensionsOutput()), _numPoints };
 
     if (initEmbedding)
@@ -56,7 +69,7 @@ TsneWorker::TsneWorker(TsneParameters parameters, KnnParameters knnParameters, s
     assert(numDimensions > 0);
     _numPoints = data.size() / numDimensions;
     _numDimensions = numDimensions;
-    _data = std::move(data);
+    _data = std::make_shared<const std::vector<float>>(std::move(data));
     _embedding = { static_cast<uint32_t>(_tsneParameters.getNumDimensionsOutput()), _numPoints };
 
     if (initEmbedding)
@@ -88,8 +101,27 @@ TsneWorker::TsneWorker(TsneParameters parameters, std::vector<hdi::data::MapMemE
         setInitEmbedding(*initEmbedding);
 }
 
+TsneWorker::TsneWorker(TsneParameters parameters, std::shared_ptr<const ProbDistMatrix> probDist, uint32_t numPoints, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding) :
+    TsneWorker(parameters)
+{
+    assert(probDist);
+    _sharedProbabilityDistribution = std::move(probDist);
+    _hasProbabilityDistribution = true;
+    _numPoints = numPoints;
+    _embedding = { static_cast<uint32_t>(_tsneParameters.getNumDimensionsOutput()), _numPoints };
+    _tsneParameters.setExaggerationFactor(4 + _numPoints / 60000.0);
+
+    if (initEmbedding)
+        setInitEmbedding(*initEmbedding);
+}
+
 TsneWorker::~TsneWorker()
 {
+    // The background computation of progressive mode skips its remaining steps, the neighbor search itself is waited for
+    _refinementCancelled = true;
+    if (_refinementThread.joinable())
+        _refinementThread.join();
+
     delete _offscreenBuffer;
 }
 
@@ -127,6 +159,12 @@ void TsneWorker::setInitEmbedding(const hdi::data::Embedding<float>::scalar_vect
     _tsneParameters.setPresetEmbedding(true);
 }
 
+void TsneWorker::setPointWeights(const std::vector<float>& pointWeights)
+{
+    assert(pointWeights.size() == _numPoints);
+    _pointWeights = pointWeights;
+}
+
 void TsneWorker::setCurrentIteration(int currentIteration)
 {
     if(currentIteration < 0)
@@ -153,7 +191,7 @@ void TsneWorker::createTasks()
     _tasks = new TsneWorkerTasks(this, _parentTask);
 }
 
-hdi::dr::TsneParameters TsneWorker::tsneParameters()
+hdi::dr::TsneParameters TsneWorker::tsneParameters(int restartIteration)
 {
     hdi::dr::TsneParameters tsneParameters;
 
@@ -164,43 +202,89 @@ hdi::dr::TsneParameters TsneWorker::tsneParameters()
     tsneParameters._exponential_decay_iter      = _tsneParameters.getExponentialDecayIter();
     tsneParameters._presetEmbedding             = _tsneParameters.getPresetEmbedding();
 
+    // A gradient descent that is re-initialized mid-way continues the exaggeration schedule instead of repeating it
+    if (restartIteration > 0)
+    {
+        const int exaggerationIter  = _tsneParameters.getExaggerationIter();
+        const int decayIter         = _tsneParameters.getExponentialDecayIter();
+
+        if (restartIteration >= exaggerationIter + decayIter)
+        {
+            tsneParameters._exaggeration_factor         = 1;
+            tsneParameters._mom_switching_iter          = 0;
+            tsneParameters._remove_exaggeration_iter    = 0;
+            tsneParameters._exponential_decay_iter      = 0;
+        }
+        else if (restartIteration >= exaggerationIter)
+        {
+            const double decay = 1. - double(restartIteration - exaggerationIter) / decayIter;
+            tsneParameters._exaggeration_factor         = 1 + (tsneParameters._exaggeration_factor - 1) * decay;
+            tsneParameters._mom_switching_iter          = 0;
+            tsneParameters._remove_exaggeration_iter    = 0;
+            tsneParameters._exponential_decay_iter      = exaggerationIter + decayIter - restartIteration;
+        }
+        else
+        {
+            tsneParameters._mom_switching_iter          = exaggerationIter - restartIteration;
+            tsneParameters._remove_exaggeration_iter    = exaggerationIter - restartIteration;
+        }
+    }
+
     return tsneParameters;
 }
 
-hdi::dr::HDJointProbabilityGenerator<float>::Parameters TsneWorker::probGenParameters()
+hdi::dr::HDJointProbabilityGenerator<float>::Parameters TsneWorker::probGenParameters(const TsneParameters& tsneParameters, const KnnParameters& knnParameters)
 {
     hdi::dr::HDJointProbabilityGenerator<float>::Parameters probGenParams;
 
-    probGenParams._perplexity               = _tsneParameters.getPerplexity();
+    probGenParams._perplexity               = tsneParameters.getPerplexity();
     probGenParams._perplexity_multiplier    = 3;
-    probGenParams._num_trees                = _knnParameters.getAnnoyNumTrees();
-    probGenParams._num_checks               = _knnParameters.getAnnoyNumChecks();
-    probGenParams._aknn_algorithmP1         = _knnParameters.getHNSWm();
-    probGenParams._aknn_algorithmP2         = _knnParameters.getHNSWef();
-    probGenParams._aknn_algorithm           = _knnParameters.getKnnAlgorithm();
-    probGenParams._aknn_metric              = _knnParameters.getKnnDistanceMetric();
+    probGenParams._num_trees                = knnParameters.getAnnoyNumTrees();
+    probGenParams._num_checks               = knnParameters.getAnnoyNumChecks();
+    probGenParams._aknn_algorithmP1         = knnParameters.getHNSWm();
+    probGenParams._aknn_algorithmP2         = knnParameters.getHNSWef();
+    probGenParams._aknn_algorithm           = knnParameters.getKnnAlgorithm();
+    probGenParams._aknn_metric              = knnParameters.getKnnDistanceMetric();
 
     return probGenParams;
 }
 
 void TsneWorker::computeSimilarities()
 {
-    assert(_data.size() == _numDimensions * _numPoints);
+    assert(_data && _data->size() == _numDimensions * _numPoints);
 
     _tasks->getComputingSimilaritiesTask().setRunning();
 
+    // Progressive mode only pays off for the approximate libraries, the exact search has no cheaper variant
+    const bool progressive = _tsneParameters.getProgressiveSimilarities() && !_knnParameters.useExactKnn(_numDimensions);
+
     double t = 0.0;
     {
         hdi::utils::ScopedTimer<double> timer(t);
 
-        _probabilityDistribution.clear();
-        _probabilityDistribution.resize(_numPoints);
-        qDebug() << "Sparse matrix allocated.";
-
-        hdi::dr::HDJointProbabilityGenerator<float> probabilityGenerator;
-
-        qDebug() << "Computing high dimensional probability distributions: Num dims: " << _numDimensions << " Num data points: " << _numPoints;
-        probabilityGenerator.computeJointProbabilityDistribution(_data.data(), _numDimensions, _numPoints, _probabilityDistribution, probGenParameters());         // The _probabilityDistribution is symmetrized here.
+        if (progressive)
+        {
+            qDebug() << "Progressive similarities: computing initial similarities with a coarse kNN graph";
+            Similarities coarse;
+            computeProbabilityDistribution(similarityInputs(), progressiveKnnParameters(), coarse);
+            useSimilarities(std::move(coarse));
+
+            // Refine in the background while the gradient descent already runs on the coarse similarities, stop() cancels it
+            std::packaged_task<Similarities()> refinement([this, inputs = similarityInputs(), knnParameters = _knnParameters]() {
+                Similarities similarities;
+                computeProbabilityDistribution(inputs, knnParameters, similarities, &_refinementCancelled);
+                return similarities;
+            });
+
+            _refinedSimilarities = refinement.get_future();
+            _refinementThread = std::thread(std::move(refinement));
+        }
+        else
+        {
+            Similarities similarities;
+            computeProbabilityDistribution(similarityInputs(), _knnParameters, similarities);
+            useSimilarities(std::move(similarities));
+        }
     }
     
     qDebug() << "================================================================================";
@@ -210,11 +294,219 @@ void TsneWorker::computeSimilarities()
     _tasks->getComputingSimilaritiesTask().setFinished();
 }
 
+void TsneWorker::computeProbabilityDistribution(const SimilarityInputs& inputs, const KnnParameters& knnParameters, Similarities& similarities, const std::atomic<bool>* cancelled)
+{
+    const auto& tsneParameters = inputs.tsneParameters;
+    const auto& pointWeights = inputs.pointWeights;
+    float* data = const_cast<float*>(inputs.data->data());     // HDI takes a non-const pointer, it does not modify the data
+    const uint32_t numPoints = inputs.numPoints;
+    const uint32_t numDimensions = inputs.numDimensions;
+
+    // Checked after the neighbor search, the search itself cannot be interrupted
+    const auto isCancelled = [cancelled]() -> bool { return cancelled && *cancelled; };
+
+    ProbDistMatrix& probDist = similarities.probDist;
+    probDist.clear();
+    probDist.resize(numPoints);
+
+    hdi::dr::HDJointProbabilityGenerator<float> probabilityGenerator;
+
+    qDebug() << "Computing high dimensional probability distributions: Num dims: " << numDimensions << " Num data points: " << numPoints;
+
+    const bool uniformKernel = tsneParameters.getSimilarityType() == SimilarityType::Uniform;
+
+    // Collapsed duplicates contribute with their multiplicity before the conditional probabilities are symmetrized
+    const auto weightAndSymmetrize = [&probDist, &pointWeights, isCancelled]() -> void {
+        if (isCancelled())
+            return;
+
+        if (!pointWeights.empty())
+            applyPointWeights(probDist, pointWeights);
+
+        symmetrizeProbabilities(probDist);
+    };
+
+    // Multi-scale: average Gaussian similarities of several perplexities, all calibrated on the same neighbor lists
+    const auto& perplexities = tsneParameters.getMultiscalePerplexities();
+    const bool multiscale = !uniformKernel && !perplexities.empty();
+    const float maxPerplexity = multiscale ? *std::max_element(perplexities.begin(), perplexities.end()) : static_cast<float>(tsneParameters.getPerplexity());
+
+    const auto multiscaleFromKnn = [&similarities, &probDist, &perplexities, &weightAndSymmetrize, isCancelled, numPoints](std::vector<float>&& distances, std::vector<int>&& indices) -> void {
+        if (isCancelled())
+            return;
+
+        const auto numNeighbors = static_cast<uint32_t>(indices.size() / numPoints);
+
+        qDebug() << "Multi-scale similarities with " << perplexities.size() << " perplexities from " << numNeighbors << " nearest neighbors";
+        computeMultiscaleGaussianProbabilities(distances, indices, numPoints, numNeighbors, perplexities, probDist);
+        weightAndSymmetrize();
+
+        // Keep the neighbor lists such that per-perplexity similarities can be derived later without another search
+        similarities.knnDistances = std::move(distances);
+        similarities.knnIndices = std::move(indices);
+    };
+
+    if (knnParameters.useExactKnn(numDimensions))
+    {
+        // Same neighborhood sizes as the approximate search: k or 3 * perplexity neighbors plus the point itself
+        const auto numNeighbors = uniformKernel ? static_cast<uint32_t>(tsneParameters.getNumNeighborsUniform()) + 1 :
+                                                  static_cast<uint32_t>(maxPerplexity * 3) + 1;
+
+        std::vector<float> distancesSquared;
+        std::vector<int> indices;
+        computeExactKnn(data, numPoints, numDimensions, numNeighbors, knnParameters.getKnnDistanceMetric(), distancesSquared, indices);
+
+        qDebug() << "Exact kNN (VP-tree) with " << numNeighbors << " nearest neighbors";
+        const auto numNeighborsFound = static_cast<uint32_t>(indices.size() / numPoints);
+
+        if (multiscale)
+        {
+            multiscaleFromKnn(std::move(distancesSquared), std::move(indices));
+            return;
+        }
+
+        if (uniformKernel)
+            computeUniformProbabilities(indices, numPoints, numNeighborsFound, numNeighbors - 1, probDist);
+        else
+            computeGaussianProbabilities(distancesSquared, indices, numPoints, numNeighborsFound, static_cast<float>(tsneParameters.getPerplexity()), probDist);
+
+        weightAndSymmetrize();
+    }
+    else if (uniformKernel)
+    {
+        const auto numNeighbors = static_cast<uint32_t>(tsneParameters.getNumNeighborsUniform());
+
+        // Only the neighbor indices are used: search k neighbors (plus the point itself) instead of 3 * perplexity
+        auto probGenParams = probGenParameters(tsneParameters, knnParameters);
+        probGenParams._perplexity               = numNeighbors;
+        probGenParams._perplexity_multiplier    = 1;
+
+        std::vector<float> probabilities;
+        std::vector<int> indices;
+        probabilityGenerator.computeProbabilityDistributions(data, numDimensions, numPoints, probabilities, indices, probGenParams);
+
+        qDebug() << "Uniform kernel similarities with " << numNeighbors << " nearest neighbors";
+        computeUniformProbabilities(indices, numPoints, static_cast<uint32_t>(indices.size() / numPoints), numNeighbors, probDist);
+        weightAndSymmetrize();
+    }
+    else if (multiscale)
+    {
+        // A single kNN pass for the largest perplexity, its probabilities serve as distance surrogates for calibrating all perplexities
+        auto probGenParams = probGenParameters(tsneParameters, knnParameters);
+        probGenParams._perplexity = maxPerplexity;
+
+        std::vector<float> probabilities;
+        std::vector<int> indices;
+        probabilityGenerator.computeProbabilityDistributions(data, numDimensions, numPoints, probabilities, indices, probGenParams);
+
+        std::vector<float> distances;
+        surrogateDistancesFromProbabilities(probabilities, distances);
+
+        multiscaleFromKnn(std::move(distances), std::move(indices));
+    }
+    else if (!pointWeights.empty())
+    {
+        // Conditional probabilities are needed to apply the point weights before symmetrization
+        std::vector<float> probabilities;
+        std::vector<int> indices;
+        probabilityGenerator.computeProbabilityDistributions(data, numDimensions, numPoints, probabilities, indices, probGenParameters(tsneParameters, knnParameters));
+
+        knnProbabilitiesToMatrix(probabilities, indices, numPoints, static_cast<uint32_t>(indices.size() / numPoints), probDist);
+        weightAndSymmetrize();
+    }
+    else
+        probabilityGenerator.computeJointProbabilityDistribution(data, numDimensions, numPoints, probDist, probGenParameters(tsneParameters, knnParameters));         // The probDist is symmetrized here.
+}
+
+std::vector<ProbDistMatrix> TsneWorker::computePerplexityProbabilityDistributions(const std::vector<float>& perplexities) const
+{
+    std::vector<ProbDistMatrix> probDists;
+
+    if (_knnIndices.empty() || perplexities.empty())
+        return probDists;
+
+    const auto numNeighbors = static_cast<uint32_t>(_knnIndices.size() / _numPoints);
+    computeGaussianProbabilitiesPerPerplexity(_knnDistances, _knnIndices, _numPoints, numNeighbors, perplexities, probDists);
+
+    if (!_pointWeights.empty())
+        for (auto& probDist : probDists)
+            applyPointWeights(probDist, _pointWeights);
+
+    return probDists;
+}
+
+KnnParameters TsneWorker::progressiveKnnParameters() const
+{
+    // Few trees/checks and a sparse, shallow HNSW graph: low recall but a fast first layout
+    KnnParameters coarse = _knnParameters;
+    coarse.setAnnoyNumTrees(1);
+    coarse.setAnnoyNumChecks(std::min(_knnParameters.getAnnoyNumChecks(), 128));
+    coarse.setHNSWm(std::min(_knnParameters.getHNSWm(), 8));
+    coarse.setHNSWef(std::min(_knnParameters.getHNSWef(), 32));
+
+    return coarse;
+}
+
+TsneWorker::SimilarityInputs TsneWorker::similarityInputs() const
+{
+    return { _tsneParameters, _data, _pointWeights, _numPoints, _numDimensions };
+}
+
+void TsneWorker::useSimilarities(Similarities&& similarities)
+{
+    _probabilityDistribution = std::move(similarities.probDist);
+    _knnDistances = std::move(similarities.knnDistances);
+    _knnIndices = std::move(similarities.knnIndices);
+}
+
+bool TsneWorker::swapInRefinedSimilarities()
+{
+    // Cancelled similarities are incomplete
+    if (!_refinedSimilarities.valid() || _refinementCancelled)
+        return false;
+
+    if (_refinedSimilarities.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    // The neighbor lists are assigned here on the worker thread, together with the similarities they belong to
+    useSimilarities(_refinedSimilarities.get());
+
+    qDebug() << "Progressive similarities: swapped in refined similarities at iteration " << _currentIteration;
+
+    return true;
+}
+
+void TsneWorker::restartGradientDescent()
+{
+    _restartGradientDescent = false;
+
+    // Start from the current embedding and continue the exaggeration schedule where it was
+    auto params = tsneParameters(_currentIteration);
+    params._presetEmbedding = true;
+
+    if (_tsneParameters.getGradientDescentType() == GradientDescentType::GPU)
+    {
+        _GPGPU_tSNE.reset();
+        _GPGPU_tSNE.initializeWithJointProbabilityDistribution(_probabilityDistribution, &_embedding, params);
+    }
+    else
+    {
+        _CPU_tSNE.reset();
+        _CPU_tSNE.initializeWithJointProbabilityDistribution(_probabilityDistribution, &_embedding, params);
+    }
+}
+
 void TsneWorker::computeGradientDescent(uint32_t iterations)
 {
+    waitWhilePaused();
+
     if (_shouldStop)
         return;
 
+    // Refined similarities that arrived after the previous run, an initialized gradient descent restarts on them
+    if (swapInRefinedSimilarities() && (_GPGPU_tSNE.isInitialized() || _CPU_tSNE.isInitialized()))
+        _restartGradientDescent = true;
+
     const auto updateEmbedding = [this](const TsneData& tsneData) -> void {
         copyEmbeddingOutput();
         emit embeddingUpdate(tsneData);
@@ -229,21 +521,30 @@ void TsneWorker::computeGradientDescent(uint32_t iterations)
         }
         qDebug() << "tSNE: Set up offscreen buffer in " << t_buffer / 1000 << " seconds.";
 
+        if (_restartGradientDescent)
+            restartGradientDescent();
+
         if (!_GPGPU_tSNE.isInitialized())
         {
             auto params = tsneParameters();
 
             // In case of HSNE, the _probabilityDistribution is a non-summetric transition matrix and initialize() symmetrizes it here
             if (_hasProbabilityDistribution)
-                _GPGPU_tSNE.initialize(_probabilityDistribution, &_embedding, params);
+                _GPGPU_tSNE.initialize(inputProbabilityDistribution(), &_embedding, params);
             else
                 _GPGPU_tSNE.initializeWithJointProbabilityDistribution(_probabilityDistribution, &_embedding, params);
 
+            // The gradient descent keeps its own symmetrized copy
+            _sharedProbabilityDistribution.reset();
+
             qDebug() << "A-tSNE (GPU): Exaggeration factor: " << params._exaggeration_factor << ", exaggeration iterations: " << params._remove_exaggeration_iter << ", exaggeration decay iter: " << params._exponential_decay_iter;
         }
     };
 
     auto initCPUTSNE = [this]() {
+        if (_restartGradientDescent)
+            restartGradientDescent();
+
         if (!_CPU_tSNE.isInitialized())
         {
             auto params = tsneParameters();
@@ -253,10 +554,13 @@ void TsneWorker::computeGradientDescent(uint32_t iterations)
 
             // In case of HSNE, the _probabilityDistribution is a non-summetric transition matrix and initialize() symmetrizes it here
             if (_hasProbabilityDistribution)
-                _CPU_tSNE.initialize(_probabilityDistribution, &_embedding, params);
+                _CPU_tSNE.initialize(inputProbabilityDistribution(), &_embedding, params);
             else
                 _CPU_tSNE.initializeWithJointProbabilityDistribution(_probabilityDistribution, &_embedding, params);
 
+            // The gradient descent keeps its own symmetrized copy
+            _sharedProbabilityDistribution.reset();
+
             qDebug() << "t-SNE (CPU, Barnes-Hut): Exaggeration factor: " << params._exaggeration_factor << ", exaggeration iterations: " << params._remove_exaggeration_iter << ", exaggeration decay iter: " << params._exponential_decay_iter << ", theta: " << theta;
         }
     };
@@ -319,6 +623,10 @@ void TsneWorker::computeGradientDescent(uint32_t iterations)
             // Perform t-SNE iteration
             singleTSNEIteration();
 
+            // Continue on the refined similarities as soon as the background computation finished
+            if (swapInRefinedSimilarities())
+                restartGradientDescent();
+
             if (_currentIteration > 0 && _tsneParameters.getUpdateCore() > 0 && _currentIteration % _tsneParameters.getUpdateCore() == 0)
                 updateEmbedding(_outEmbedding);
 
@@ -327,6 +635,9 @@ void TsneWorker::computeGradientDescent(uint32_t iterations)
 
             elapsed += t_grad;
 
+            // Yield to computations with a higher priority
+            waitWhilePaused();
+
             // React to requests to stop
             if (_shouldStop)
                 break;
@@ -361,7 +672,7 @@ void TsneWorker::compute()
 {
     createTasks();
 
-    connect(_parentTask, &Task::requestAbort, this, [this]() -> void { _shouldStop = true; }, Qt::DirectConnection);
+    connect(_parentTask, &Task::requestAbort, this, [this]() -> void { stop(); }, Qt::DirectConnection);
 
     _shouldStop = false;
 
@@ -380,6 +691,14 @@ void TsneWorker::compute()
             computeSimilarities();
 
         computeGradientDescent(_tsneParameters.getNumIterations());
+
+        // Do not hold on to shared similarities when stopped before the initialization
+        _sharedProbabilityDistribution.reset();
+
+        // Keep the refined similarities for continuing, re-initializing and saving, even if the gradient descent finished first.
+        // Similarities that are not ready yet are not waited for, the next continue picks them up.
+        if (swapInRefinedSimilarities())
+            _restartGradientDescent = true;
     }
  
     qDebug() << "t-SNE total compute time: " << t / 1000 << " seconds.";
@@ -400,7 +719,7 @@ void TsneWorker::continueComputation(uint32_t iterations)
     _tasks->getComputingSimilaritiesTask().setEnabled(false);
     _tasks->getInitializeTsneTask().setEnabled(false);
     
-    connect(_parentTask, &Task::requestAbort, this, [this]() -> void { _shouldStop = true; }, Qt::DirectConnection);
+    connect(_parentTask, &Task::requestAbort, this, [this]() -> void { stop(); }, Qt::DirectConnection);
 
     _shouldStop = false;
 
@@ -413,18 +732,49 @@ void TsneWorker::continueComputation(uint32_t iterations)
 
 void TsneWorker::stop()
 {
-    _shouldStop = true;
+    _refinementCancelled = true;
+
+    {
+        std::lock_guard<std::mutex> lock(_pauseMutex);
+        _shouldStop = true;
+    }
+
+    _resumeCondition.notify_all();
+}
+
+void TsneWorker::setPaused(bool paused)
+{
+    {
+        std::lock_guard<std::mutex> lock(_pauseMutex);
+        _paused = paused;
+    }
+
+    _resumeCondition.notify_all();
+}
+
+void TsneWorker::waitWhilePaused()
+{
+    std::unique_lock<std::mutex> lock(_pauseMutex);
+    _resumeCondition.wait(lock, [this]() { return !_paused || _shouldStop; });
 }
 
 TsneAnalysis::TsneAnalysis() :
     _tsneWorker(nullptr),
-    _task(nullptr)
+    _task(nullptr),
+    _paused(false)
 {
     qRegisterMetaType<TsneData>();
 }
 
 TsneAnalysis::~TsneAnalysis()
 {
+    // A paused worker would not return to the event loop, a stopped one also cancels its background similarities
+    if (_tsneWorker)
+    {
+        _tsneWorker->stop();
+        _tsneWorker->setPaused(false);
+    }
+
     _workerThread.quit();           // Signal the thread to quit gracefully
     if (!_workerThread.wait(500))   // Wait for the thread to actually finish
         _workerThread.terminate();  // Terminate thread after 0.5 seconds
@@ -465,21 +815,39 @@ void TsneAnalysis::startComputation(TsneParameters parameters, std::vector<hdi::
     startComputation(_tsneWorker);
 }
 
-void TsneAnalysis::startComputation(TsneParameters parameters, KnnParameters knnParameters, const std::vector<float>& data, uint32_t numDimensions, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding)
+void TsneAnalysis::startComputation(TsneParameters parameters, std::shared_ptr<const ProbDistMatrix> probDist, uint32_t numPoints, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding, int previousIterations)
+{
+    deleteWorker();
+
+    _tsneWorker = new TsneWorker(parameters, std::move(probDist), numPoints, initEmbedding);
+
+    if (previousIterations >= 0)
+        _tsneWorker->setCurrentIteration(previousIterations);
+
+    startComputation(_tsneWorker);
+}
+
+void TsneAnalysis::startComputation(TsneParameters parameters, KnnParameters knnParameters, const std::vector<float>& data, uint32_t numDimensions, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding, const std::vector<float>* pointWeights)
 {
     deleteWorker();
 
     _tsneWorker = new TsneWorker(parameters, knnParameters, data, numDimensions, initEmbedding);
+
+    if (pointWeights)
+        _tsneWorker->setPointWeights(*pointWeights);
     
     startComputation(_tsneWorker);
 }
 
-void TsneAnalysis::startComputation(TsneParameters parameters, KnnParameters knnParameters, std::vector<float>&& data, uint32_t numDimensions, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding)
+void TsneAnalysis::startComputation(TsneParameters parameters, KnnParameters knnParameters, std::vector<float>&& data, uint32_t numDimensions, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding, const std::vector<float>* pointWeights)
 {
     deleteWorker();
 
     _tsneWorker = new TsneWorker(parameters, knnParameters, std::move(data), numDimensions, initEmbedding);
-    
+
+    if (pointWeights)
+        _tsneWorker->setPointWeights(*pointWeights);
+
     startComputation(_tsneWorker);
 }
 
@@ -491,6 +859,7 @@ void TsneAnalysis::continueComputation(int iterations)
     _tsneWorker->changeThread(&_workerThread);
 
     emit continueWorker(iterations);
+    emit computationRequested();
 }
 
 void TsneAnalysis::stopComputation()
@@ -512,9 +881,18 @@ void TsneAnalysis::setInitEmbedding(const hdi::data::Embedding<float>::scalar_ve
         _tsneWorker->setInitEmbedding(initEmbedding);
 }
 
+void TsneAnalysis::setPaused(bool paused)
+{
+    _paused = paused;
+
+    if (_tsneWorker)
+        _tsneWorker->setPaused(paused);
+}
+
 void TsneAnalysis::startComputation(TsneWorker* tsneWorker)
 {
     tsneWorker->setParentTask(_task);
+    tsneWorker->setPaused(_paused);
 
     tsneWorker->changeThread(&_workerThread);
     
@@ -530,6 +908,7 @@ void TsneAnalysis::startComputation(TsneWorker* tsneWorker)
     _workerThread.start();
 
     emit startWorker();
+    emit computationRequested();
     emit started();
 }
 
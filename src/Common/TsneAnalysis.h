@@ -1,6 +1,7 @@
 #pragma once
 
 #include "KnnParameters.h"
+#include "SimilarityUtils.h"
 #include "TsneData.h"
 #include "TsneParameters.h"
 
@@ -13,14 +14,18 @@
 
 #include <QThread>
 
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 class OffscreenBuffer;
 
-using ProbDistMatrix = hdi::dr::HDJointProbabilityGenerator<float>::sparse_scalar_matrix_type;
-
 class TsneWorkerTasks : public QObject
 {
 public:
@@ -57,6 +62,8 @@ public:
     TsneWorker(TsneParameters tsneParameters, const std::vector<hdi::data::MapMemEff<uint32_t, float>>& probDist, uint32_t numPoints, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding);
     // The tsne object expects a probDist that is not symmetrized, no knn are computed, moving the probDist
     TsneWorker(TsneParameters tsneParameters, std::vector<hdi::data::MapMemEff<uint32_t, float>>&& probDist, uint32_t numPoints, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding);
+    // The tsne object expects a probDist that is not symmetrized, no knn are computed, reads the shared probDist in place until the gradient descent is initialized
+    TsneWorker(TsneParameters tsneParameters, std::shared_ptr<const ProbDistMatrix> probDist, uint32_t numPoints, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding);
     ~TsneWorker();
 
     void createTasks();
@@ -64,13 +71,20 @@ public:
 public: // Setter
     void setParentTask(mv::Task* parentTask);
     void setInitEmbedding(const hdi::data::Embedding<float>::scalar_vector_type& initEmbedding);
+    void setPointWeights(const std::vector<float>& pointWeights);
     void setCurrentIteration(int currentIteration);
     void changeThread(QThread* targetThread);
+    // Thread-safe, a paused worker waits before the next gradient descent iteration
+    void setPaused(bool paused);
 
 public: // Getter
+    // Empty when the worker was started with a shared probability distribution
     ProbDistMatrix* getProbabilityDistribution() { return &_probabilityDistribution; };
     int getNumIterations() const;
 
+    /** Conditional (not symmetrized) similarities per perplexity from the neighbor lists of the last multi-scale computation, empty otherwise */
+    std::vector<ProbDistMatrix> computePerplexityProbabilityDistributions(const std::vector<float>& perplexities) const;
+
 public slots:
     void compute();
     void continueComputation(uint32_t iterations);
@@ -82,13 +96,44 @@ signals:
     void aborted();
 
 private:
+    /** Result of a similarity computation */
+    struct Similarities
+    {
+        ProbDistMatrix      probDist;
+        std::vector<float>  knnDistances;       /** Multi-scale mode: (surrogate) squared neighbor distances */
+        std::vector<int>    knnIndices;         /** Multi-scale mode: neighbor indices */
+    };
+
+    /** Everything the similarities depend on, copied for the background computation of progressive mode */
+    struct SimilarityInputs
+    {
+        TsneParameters                              tsneParameters;
+        std::shared_ptr<const std::vector<float>>   data;
+        std::vector<float>                          pointWeights;
+        uint32_t                                    numPoints;
+        uint32_t                                    numDimensions;
+    };
+
     void computeSimilarities();
+    SimilarityInputs similarityInputs() const;
+    void useSimilarities(Similarities&& similarities);
+
+    /** Does not access the worker, the computation stops after its neighbor search once cancelled is set */
+    static void computeProbabilityDistribution(const SimilarityInputs& inputs, const KnnParameters& knnParameters, Similarities& similarities, const std::atomic<bool>* cancelled = nullptr);
     void computeGradientDescent(uint32_t iterations);
+    void waitWhilePaused();
+
+    // Progressive similarities
+    KnnParameters progressiveKnnParameters() const;
+    bool swapInRefinedSimilarities();
+    void restartGradientDescent();
     
     void copyEmbeddingOutput();
 
-    hdi::dr::TsneParameters tsneParameters();
-    hdi::dr::HDJointProbabilityGenerator<float>::Parameters probGenParameters();
+    const ProbDistMatrix& inputProbabilityDistribution() const { return _sharedProbabilityDistribution ? *_sharedProbabilityDistribution : _probabilityDistribution; }
+
+    hdi::dr::TsneParameters tsneParameters(int restartIteration = 0);
+    static hdi::dr::HDJointProbabilityGenerator<float>::Parameters probGenParameters(const TsneParameters& tsneParameters, const KnnParameters& knnParameters);
 
     void resetThread();
 
@@ -98,8 +143,12 @@ private:
     int                                     _currentIteration;              /** Current iteration in the embedding / gradient descent process */
     uint32_t                                _numPoints;                     /** Data variable */
     uint32_t                                _numDimensions;                 /** Data variable */
-    std::vector<float>                      _data;                          /** High-dimensional input data */
+    std::shared_ptr<const std::vector<float>> _data;                        /** High-dimensional input data, shared with the background computation of progressive mode */
+    std::vector<float>                      _pointWeights;                  /** Number of original points per input point when duplicates were collapsed, empty otherwise */
+    std::vector<float>                      _knnDistances;                  /** Multi-scale mode: (surrogate) squared neighbor distances */
+    std::vector<int>                        _knnIndices;                    /** Multi-scale mode: neighbor indices */
     ProbDistMatrix                          _probabilityDistribution;       /** High-dimensional probability distribution encoding point similarities */
+    std::shared_ptr<const ProbDistMatrix>   _sharedProbabilityDistribution; /** Read-only probability distribution owned elsewhere, released once the gradient descent is initialized */
     bool                                    _hasProbabilityDistribution;    /** Check if the worker was initialized with a probability distribution or data */
     GradientDescentGPU                       _GPGPU_tSNE;                   /** GPGPU t-SNE gradient descent implementation */
     GradientDescentCPU                       _CPU_tSNE;                     /** CPU t-SNE gradient descent implementation */
@@ -107,6 +156,13 @@ private:
     TsneData                                _outEmbedding;                  /** Transfer embedding data array */
     OffscreenBuffer*                        _offscreenBuffer;               /** Offscreen OpenGL buffer required to run the gradient descent */
     bool                                    _shouldStop;                    /** Termination flags */
+    bool                                    _paused;                        /** Wait between iterations, guarded by _pauseMutex */
+    std::mutex                              _pauseMutex;                    /** Guards _paused */
+    std::condition_variable                 _resumeCondition;               /** Wakes a paused worker when resumed or stopped */
+    std::future<Similarities>               _refinedSimilarities;           /** Progressive mode: refined similarities computed in the background */
+    std::thread                             _refinementThread;              /** Progressive mode: computes the refined similarities, joined when the worker is deleted */
+    std::atomic<bool>                       _refinementCancelled;           /** Progressive mode: set by stop(), the refined similarities are then discarded */
+    bool                                    _restartGradientDescent;        /** Progressive mode: re-initialize the gradient descent with the refined similarities before continuing */
 
 private: 
     mv::Task*                               _parentTask;                    /** Task: parent */
@@ -126,10 +182,12 @@ public: // Interactions
     void startComputation(TsneParameters parameters, const std::vector<hdi::data::MapMemEff<uint32_t, float>>& probDist, uint32_t numPoints, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding = nullptr, int iterations = -1);
     // Compute embedding based on pre-computed similarites, moves the input probDist
     void startComputation(TsneParameters parameters, std::vector<hdi::data::MapMemEff<uint32_t, float>>&& probDist, uint32_t numPoints, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding = nullptr, int iterations = -1);
-    // Compute similarities (aknn search) and embedding
-    void startComputation(TsneParameters parameters, KnnParameters knnParameters, const std::vector<float>& data, uint32_t numDimensions, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding = nullptr);
+    // Compute embedding based on pre-computed similarites, reads the shared probDist in place without copying it
+    void startComputation(TsneParameters parameters, std::shared_ptr<const ProbDistMatrix> probDist, uint32_t numPoints, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding = nullptr, int iterations = -1);
+    // Compute similarities (aknn search) and embedding, optionally with point weights for collapsed duplicates
+    void startComputation(TsneParameters parameters, KnnParameters knnParameters, const std::vector<float>& data, uint32_t numDimensions, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding = nullptr, const std::vector<float>* pointWeights = nullptr);
     // Compute similarities (aknn search) and embedding, moves the input data
-    void startComputation(TsneParameters parameters, KnnParameters knnParameters, std::vector<float>&& data, uint32_t numDimensions, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding = nullptr);
+    void startComputation(TsneParameters parameters, KnnParameters knnParameters, std::vector<float>&& data, uint32_t numDimensions, const hdi::data::Embedding<float>::scalar_vector_type* initEmbedding = nullptr, const std::vector<float>* pointWeights = nullptr);
     
     void continueComputation(int previousIterations);
     void stopComputation();
@@ -137,12 +195,17 @@ public: // Interactions
 public: // Setter
     void setTask(mv::Task* task);
     void setInitEmbedding(const hdi::data::Embedding<float>::scalar_vector_type& initEmbedding);
+    // Pause or resume the gradient descent between iterations, e.g. by an EmbeddingScheduler, also applies to later computations
+    void setPaused(bool paused);
 
 public: // Getter
+    bool isPaused() const { return _paused; }
     int getNumIterations() const { return (_tsneWorker) ? _tsneWorker->getNumIterations() : -1; };
     bool canContinue() const { return (_tsneWorker) ? _tsneWorker->getNumIterations() >= 1 : false; };
     std::optional<ProbDistMatrix*> getProbabilityDistribution() { return (_tsneWorker) ? std::optional<ProbDistMatrix*>(_tsneWorker->getProbabilityDistribution()) : std::nullopt; };
     const std::optional<ProbDistMatrix*> getProbabilityDistribution() const { return (_tsneWorker) ? std::optional<ProbDistMatrix*>(_tsneWorker->getProbabilityDistribution()) : std::nullopt; };
+    // Separate similarities per perplexity after a multi-scale computation, e.g. to start several embeddings with startComputation() without another kNN search
+    std::vector<ProbDistMatrix> getPerplexityProbabilityDistributions(const std::vector<float>& perplexities) const { return (_tsneWorker) ? _tsneWorker->computePerplexityProbabilityDistributions(perplexities) : std::vector<ProbDistMatrix>(); };
 
 private: // Internal
     void startComputation(TsneWorker* tsneWorker);
@@ -155,6 +218,7 @@ signals:
     void stopWorker();
 
     // Outgoing signals
+    void computationRequested();    // Started or continued
     void embeddingUpdate(const TsneData tsneData);
     void started();
     void finished();
@@ -164,4 +228,5 @@ private:
     QThread         _workerThread;
     TsneWorker*     _tsneWorker;
     mv::Task*       _task;
+    bool            _paused;
 };
@@ -1,11 +1,19 @@
 #pragma once
 
+#include <vector>
+
 enum class GradientDescentType
 {
     GPU,
     CPU,
 };
 
+enum class SimilarityType
+{
+    Gaussian,   // Perplexity-calibrated Gaussian kernel over 3 * perplexity nearest neighbors
+    Uniform,    // Uniform kernel over a small number of nearest neighbors, no bandwidth search
+};
+
 
 class TsneParameters
 {
@@ -19,7 +27,11 @@ public:
         _presetEmbedding(false),
         _exaggerationFactor(4),
         _updateCore(10),
-        _gradientDescentType(GradientDescentType::GPU)
+        _gradientDescentType(GradientDescentType::GPU),
+        _similarityType(SimilarityType::Gaussian),
+        _numNeighborsUniform(15),
+        _progressiveSimilarities(false),
+        _multiscalePerplexities()
     {
 
     }
@@ -33,6 +45,10 @@ public:
     void setExaggerationFactor(double exaggerationFactor) { _exaggerationFactor = exaggerationFactor; }
     void setGradientDescentType(GradientDescentType gradientDescentType) { _gradientDescentType = gradientDescentType; }
     void setUpdateCore(int updateCore) { _updateCore = updateCore; }
+    void setSimilarityType(SimilarityType similarityType) { _similarityType = similarityType; }
+    void setNumNeighborsUniform(int numNeighbors) { _numNeighborsUniform = numNeighbors; }
+    void setProgressiveSimilarities(bool progressive) { _progressiveSimilarities = progressive; }
+    void setMultiscalePerplexities(const std::vector<float>& perplexities) { _multiscalePerplexities = perplexities; }
 
     int getNumIterations() const { return _numIterations; }
     int getPerplexity() const { return _perplexity; }
@@ -43,6 +59,10 @@ public:
     int getExaggerationFactor() const { return _exaggerationFactor; }
     GradientDescentType getGradientDescentType() const { return _gradientDescentType; }
     int getUpdateCore() const { return _updateCore; }
+    SimilarityType getSimilarityType() const { return _similarityType; }
+    int getNumNeighborsUniform() const { return _numNeighborsUniform; }
+    bool getProgressiveSimilarities() const { return _progressiveSimilarities; }
+    const std::vector<float>& getMultiscalePerplexities() const { return _multiscalePerplexities; }
 
 private:
     int _numIterations;
@@ -55,4 +75,9 @@ private:
     GradientDescentType _gradientDescentType;     // Whether to use CPU or GPU gradient descent
 
     int _updateCore;        // Gradient descent iterations after which the embedding data set in ManiVault's core will be updated
+
+    SimilarityType _similarityType;     // Kernel used to compute the high-dimensional similarities
+    int _numNeighborsUniform;           // Number of nearest neighbors for the uniform kernel
+    bool _progressiveSimilarities;      // Start the gradient descent on a cheap approximate kNN graph and swap in the refined similarities once computed
+    std::vector<float> _multiscalePerplexities;     // Gaussian kernel: average the similarities of these perplexities instead of using _perplexity, empty for single-scale
 };
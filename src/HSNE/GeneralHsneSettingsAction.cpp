@@ -1,5 +1,6 @@
 #include "GeneralHsneSettingsAction.h"
 
+#include "EmbeddingScheduler.h"
 #include "HsneSettingsAction.h"
 
 using namespace mv::gui;
@@ -11,31 +12,47 @@ GeneralHsneSettingsAction::GeneralHsneSettingsAction(HsneSettingsAction& hsneSet
     _knnAlgorithmAction(this, "kNN Algorithm"),
     _distanceMetricAction(this, "Distance metric"),
     _numKnnAction(this, "Number of NN"),
-    _startAction(this, "Start")
+    _maxConcurrentEmbeddingsAction(this, "Concurrent embeddings"),
+    _preEmbedClustersAction(this, "Pre-embed clusters", false),
+    _spillInactiveScalesAction(this, "Spill inactive scales", false),
+    _startAction(this, "Start"),
+    _cancelAction(this, "Cancel")
 {
     addAction(&_numScalesAction);
     addAction(&_knnAlgorithmAction);
     addAction(&_distanceMetricAction);
     addAction(&_numKnnAction);
+    addAction(&_maxConcurrentEmbeddingsAction);
+    addAction(&_preEmbedClustersAction);
+    addAction(&_spillInactiveScalesAction);
     addAction(&_startAction);
+    addAction(&_cancelAction);
 
     _knnAlgorithmAction.setDefaultWidgetFlags(OptionAction::ComboBox);
     _numScalesAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
     _distanceMetricAction.setDefaultWidgetFlags(OptionAction::ComboBox);
     _numKnnAction.setDefaultWidgetFlags(IntegralAction::SpinBox | IntegralAction::Slider);
+    _maxConcurrentEmbeddingsAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
 
     _numScalesAction.initialize(1, 10, hsneSettingsAction.getHsneParameters().getNumScales());
-    _knnAlgorithmAction.initialize(QStringList({ "FLANN", "HNSW", "ANNOY" }), "FLANN");
+    _knnAlgorithmAction.initialize(QStringList({ "FLANN", "HNSW", "ANNOY", "VP-Tree (exact)" }), "FLANN");
     _distanceMetricAction.initialize(QStringList({ "Euclidean", "Cosine", "Inner Product", "Manhattan", "Hamming", "Dot" }), "Euclidean");
     _numKnnAction.initialize(3, 300, 90);
+    _maxConcurrentEmbeddingsAction.initialize(1, 16, EmbeddingScheduler::defaultMaxConcurrent);
 
     _numScalesAction.setToolTip("Number of hierarchy scales: e.g. 2 scales indicates one abstraction scale \nabove the data level, which is a scale itself.");
     _startAction.setToolTip("Initialize the HSNE hierarchy and create an embedding");
+    _cancelAction.setToolTip("Stop the hierarchy construction after the current step.\nThe finished scales are kept and the top finished scale is embedded.\nCancelling during the selection mapping skips the linked selections of the new scales.");
+    _preEmbedClustersAction.setToolTip("Cluster the top scale and embed the refinement of every cluster in the background once the top level embedding and the hierarchy are finished.\nRefining a selection that closely matches a cluster continues from its precomputed embedding.");
+    _maxConcurrentEmbeddingsAction.setToolTip("Number of top level and refined embeddings that are computed at the same time.\nThe others are paused until an embedding with a higher priority finishes.\nThe most recently started or selected embedding runs first.");
+    _spillInactiveScalesAction.setToolTip("Write the scales that are neither the top scale nor shown in a refined embedding to a temporary file and release their memory.\nThey are read back when a refinement needs them.");
 
     const auto updateNumScales = [this]() -> void {
         _hsneSettingsAction.getHsneParameters().setNumScales(_numScalesAction.getValue());
         };
 
+    _knnAlgorithmAction.setToolTip("VP-Tree (exact): exact nearest neighbors, fast for data with few dimensions.\nSupports the Euclidean, Cosine and Manhattan metrics, other metrics use the approximate library.");
+
     const auto updateKnnAlgorithm = [this]() -> void {
         if (_knnAlgorithmAction.getCurrentText() == "FLANN")
             _hsneSettingsAction.getKnnParameters().setKnnAlgorithm(hdi::dr::knn_library::KNN_FLANN);
@@ -45,6 +62,9 @@ GeneralHsneSettingsAction::GeneralHsneSettingsAction(HsneSettingsAction& hsneSet
 
         if (_knnAlgorithmAction.getCurrentText() == "ANNOY")
             _hsneSettingsAction.getKnnParameters().setKnnAlgorithm(hdi::dr::knn_library::KNN_ANNOY);
+
+        // Falls back to the previously selected library for metrics that the exact search does not support
+        _hsneSettingsAction.getKnnParameters().setExactKnn(_knnAlgorithmAction.getCurrentText() == "VP-Tree (exact)");
     };
 
     const auto updateDistanceMetric = [this]() -> void {
@@ -78,6 +98,9 @@ GeneralHsneSettingsAction::GeneralHsneSettingsAction(HsneSettingsAction& hsneSet
         _distanceMetricAction.setEnabled(enabled);
         _numScalesAction.setEnabled(enabled);
         _numKnnAction.setEnabled(enabled);
+        _maxConcurrentEmbeddingsAction.setEnabled(enabled);
+        _preEmbedClustersAction.setEnabled(enabled);
+        _spillInactiveScalesAction.setEnabled(enabled);
         _startAction.setEnabled(enabled);
     };
 
@@ -106,6 +129,9 @@ GeneralHsneSettingsAction::GeneralHsneSettingsAction(HsneSettingsAction& hsneSet
     updateNumScales();
     updateNumKnn();
     updateReadOnly();
+
+    // Only enabled while the hierarchy is constructed
+    _cancelAction.setEnabled(false);
 }
 
 void GeneralHsneSettingsAction::fromVariantMap(const QVariantMap& variantMap)
@@ -116,6 +142,9 @@ void GeneralHsneSettingsAction::fromVariantMap(const QVariantMap& variantMap)
     _knnAlgorithmAction.fromParentVariantMap(variantMap);
     _distanceMetricAction.fromParentVariantMap(variantMap);
     _numKnnAction.fromParentVariantMap(variantMap);
+    _maxConcurrentEmbeddingsAction.fromParentVariantMap(variantMap);
+    _preEmbedClustersAction.fromParentVariantMap(variantMap);
+    _spillInactiveScalesAction.fromParentVariantMap(variantMap);
     _startAction.fromParentVariantMap(variantMap);
 }
 
@@ -127,6 +156,9 @@ QVariantMap GeneralHsneSettingsAction::toVariantMap() const
     _knnAlgorithmAction.insertIntoVariantMap(variantMap);
     _distanceMetricAction.insertIntoVariantMap(variantMap);
     _numKnnAction.insertIntoVariantMap(variantMap);
+    _maxConcurrentEmbeddingsAction.insertIntoVariantMap(variantMap);
+    _preEmbedClustersAction.insertIntoVariantMap(variantMap);
+    _spillInactiveScalesAction.insertIntoVariantMap(variantMap);
     _startAction.insertIntoVariantMap(variantMap);
 
     return variantMap;
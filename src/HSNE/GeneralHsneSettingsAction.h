@@ -3,6 +3,7 @@
 #include "actions/GroupAction.h"
 #include "actions/IntegralAction.h"
 #include "actions/OptionAction.h"
+#include "actions/ToggleAction.h"
 #include "actions/TriggerAction.h"
 
 using namespace mv::gui;
@@ -33,7 +34,11 @@ public: // Action getters
     IntegralAction& getNumKnnAction() { return _numKnnAction; };
     OptionAction& getDistanceMetricAction() { return _distanceMetricAction; }
     IntegralAction& getNumScalesAction() { return _numScalesAction; }
+    IntegralAction& getMaxConcurrentEmbeddingsAction() { return _maxConcurrentEmbeddingsAction; }
+    ToggleAction& getPreEmbedClustersAction() { return _preEmbedClustersAction; }
+    ToggleAction& getSpillInactiveScalesAction() { return _spillInactiveScalesAction; }
     TriggerAction& getStartAction() { return _startAction; }
+    TriggerAction& getCancelAction() { return _cancelAction; }
 
 public: // Serialization
 
@@ -55,5 +60,9 @@ protected:
     OptionAction            _knnAlgorithmAction;                    /** KNN algorithm action */
     OptionAction            _distanceMetricAction;                  /** Distance metric action */
     IntegralAction          _numKnnAction;                          /** Number of Knn action */
+    IntegralAction          _maxConcurrentEmbeddingsAction;         /** Number of embeddings that are computed at the same time */
+    ToggleAction            _preEmbedClustersAction;                /** Embed the refinements of top level clusters in the background */
+    ToggleAction            _spillInactiveScalesAction;             /** Keep only the displayed scales in memory */
     TriggerAction           _startAction;                           /** Start action */
+    TriggerAction           _cancelAction;                          /** Cancel the hierarchy construction action */
 };
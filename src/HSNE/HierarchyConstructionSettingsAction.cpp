@@ -1,5 +1,6 @@
 #include "HierarchyConstructionSettingsAction.h"
 
+#include "HsneCacheStore.h"
 #include "HsneSettingsAction.h"
 
 using namespace mv::gui;
@@ -14,9 +15,14 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
     _minWalksRequiredAction(this, "Minimum #walks required"),
     _useOutOfCoreComputationAction(this, "Out-of-core computation"),
     _useMonteCarloSamplingAction(this, "Use Monte Carlo sampling"),
+    _useSparseInfluencePropagationAction(this, "Influence by matrix products"),
+    _useRandomWalkEngineAction(this, "Parallel random walks"),
     _seedAction(this, "Random seed"),
     _saveHierarchyToDiskAction(this, "Save hierarchy to disk"),
-    _saveHierarchyToProjectAction(this, "Save hierarchy to project")
+    _saveHierarchyToProjectAction(this, "Save hierarchy to project"),
+    _cacheDirectoryAction(this, "Cache directory", QString::fromStdString(HsneCacheStore::defaultDirectory().string())),
+    _cacheQuotaAction(this, "Cache quota (GB)"),
+    _knnGraphFileAction(this, "kNN graph file")
 {
     addAction(&_numWalksForLandmarkSelectionAction);
     addAction(&_numWalksForLandmarkSelectionThresholdAction);
@@ -26,8 +32,13 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
     addAction(&_seedAction);
     addAction(&_useOutOfCoreComputationAction);
     addAction(&_useMonteCarloSamplingAction);
+    addAction(&_useSparseInfluencePropagationAction);
+    addAction(&_useRandomWalkEngineAction);
     addAction(&_saveHierarchyToDiskAction);
     addAction(&_saveHierarchyToProjectAction);
+    addAction(&_cacheDirectoryAction);
+    addAction(&_cacheQuotaAction);
+    addAction(&_knnGraphFileAction);
 
     _numWalksForLandmarkSelectionAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
     _numWalksForLandmarkSelectionThresholdAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
@@ -36,9 +47,12 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
     _minWalksRequiredAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
     _useOutOfCoreComputationAction.setDefaultWidgetFlags(ToggleAction::CheckBox);
     _useMonteCarloSamplingAction.setDefaultWidgetFlags(ToggleAction::CheckBox);
+    _useSparseInfluencePropagationAction.setDefaultWidgetFlags(ToggleAction::CheckBox);
+    _useRandomWalkEngineAction.setDefaultWidgetFlags(ToggleAction::CheckBox);
     _seedAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
     _saveHierarchyToDiskAction.setDefaultWidgetFlags(ToggleAction::CheckBox);
     _saveHierarchyToProjectAction.setDefaultWidgetFlags(ToggleAction::CheckBox);
+    _cacheQuotaAction.setDefaultWidgetFlags(IntegralAction::SpinBox);
 
     _numWalksForLandmarkSelectionAction.setToolTip("Number of walks for landmark selection");
     _numWalksForLandmarkSelectionThresholdAction.setToolTip("Number of walks for landmark selection");
@@ -47,9 +61,15 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
     _minWalksRequiredAction.setToolTip("Minimum number of walks required");
     _useOutOfCoreComputationAction.setToolTip("Use out-of-core computation");
     _useMonteCarloSamplingAction.setToolTip("Use Monte Carlo Sampling");
+    _useSparseInfluencePropagationAction.setToolTip("Assign data points to the landmarks of all scales by chaining \nthe area of influence matrices (parallel sparse products) \ninstead of an influence query per data point");
+    _useRandomWalkEngineAction.setToolTip("Construct the scales above the data scale with parallel random walks \non precomputed alias tables, reproducible by the random seed. \nOnly for Monte Carlo landmark selection, HDI is used otherwise");
     _seedAction.setToolTip("Random seed for initialization");
-    _saveHierarchyToDiskAction.setToolTip("Save (load) computed hierarchy to (from) disk. \nWhen computing HSNE again with the same settings, \nthe hierarchy is loaded instead of recomputed");
+    _saveHierarchyToDiskAction.setToolTip("Save (load) computed hierarchy to (from) disk. \nWhen computing HSNE again on the same data values with the same settings, \nthe hierarchy is loaded instead of recomputed");
     _saveHierarchyToProjectAction.setToolTip("Save computed hierarchy when saving a project. \nThis enables selection refinements \nafter loading projects");
+    _cacheDirectoryAction.setToolTip("Directory of the hierarchy cache, can be shared by several ManiVault instances. \nThe entries are kept in its hsne-cache subdirectory");
+    _cacheQuotaAction.setToolTip("Maximum disk space of the hierarchy cache. \nThe least recently used hierarchies are removed first");
+    _knnGraphFileAction.setToolTip("Binary neighbor graph of the input points in compressed sparse row layout, \ne.g. from an earlier run or an external batch job. \nThe data scale is built from it instead of computing the kNN graph");
+    _knnGraphFileAction.setPlaceHolderString("Compute the kNN graph");
 
     const auto& hsneParameters = hsneSettingsAction.getHsneParameters();
 
@@ -60,9 +80,12 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
     _minWalksRequiredAction.initialize(0, 100, hsneParameters.getMinWalksRequired());
     _useOutOfCoreComputationAction.setChecked(hsneParameters.useOutOfCoreComputation());
     _useMonteCarloSamplingAction.setChecked(hsneParameters.useMonteCarloSampling());
+    _useSparseInfluencePropagationAction.setChecked(hsneParameters.useSparseInfluencePropagation());
+    _useRandomWalkEngineAction.setChecked(hsneParameters.useRandomWalkEngine());
     _seedAction.initialize(-1000, 1000, hsneParameters.getSeed());
     _saveHierarchyToDiskAction.setChecked(hsneParameters.getSaveHierarchyToDisk());
     _saveHierarchyToProjectAction.setChecked(true);
+    _cacheQuotaAction.initialize(1, 1000, hsneParameters.getCacheQuotaGB());
     
     collapse();
 
@@ -94,6 +117,14 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
         _hsneSettingsAction.getHsneParameters().useMonteCarloSampling(_useMonteCarloSamplingAction.isChecked());
         };
 
+    const auto updateUseSparseInfluencePropagation = [this]() -> void {
+        _hsneSettingsAction.getHsneParameters().useSparseInfluencePropagation(_useSparseInfluencePropagationAction.isChecked());
+    };
+
+    const auto updateUseRandomWalkEngine = [this]() -> void {
+        _hsneSettingsAction.getHsneParameters().useRandomWalkEngine(_useRandomWalkEngineAction.isChecked());
+    };
+
     const auto updateUseOutOfCoreComputation = [this]() -> void {
         _hsneSettingsAction.getHsneParameters().useOutOfCoreComputation(_useOutOfCoreComputationAction.isChecked());
     };
@@ -102,6 +133,25 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
         _hsneSettingsAction.getHsneParameters().setSaveHierarchyToDisk(_saveHierarchyToDiskAction.isChecked());
     };
 
+    const auto updateCacheDirectory = [this]() -> void {
+        _hsneSettingsAction.getHsneParameters().setCacheDirectory(_cacheDirectoryAction.getString().trimmed().toStdString());
+    };
+
+    const auto updateCacheQuota = [this]() -> void {
+        _hsneSettingsAction.getHsneParameters().setCacheQuotaGB(_cacheQuotaAction.getValue());
+    };
+
+    const auto updateKnnGraphFile = [this]() -> void {
+        _hsneSettingsAction.getHsneParameters().setKnnGraphFile(_knnGraphFileAction.getString().trimmed().toStdString());
+    };
+
+    const auto updateCacheEnabled = [this]() -> void {
+        const auto enabled = !isReadOnly() && _saveHierarchyToDiskAction.isChecked();
+
+        _cacheDirectoryAction.setEnabled(enabled);
+        _cacheQuotaAction.setEnabled(enabled);
+    };
+
     const auto updateReadOnly = [this]() -> void {
         const auto enabled = !isReadOnly();
 
@@ -112,7 +162,10 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
         _minWalksRequiredAction.setEnabled(enabled);
         _useOutOfCoreComputationAction.setEnabled(enabled);
         _useMonteCarloSamplingAction.setEnabled(enabled);
+        _useSparseInfluencePropagationAction.setEnabled(enabled);
+        _useRandomWalkEngineAction.setEnabled(enabled);
         _seedAction.setEnabled(enabled);
+        _knnGraphFileAction.setEnabled(enabled);
     };
 
     connect(&_numWalksForLandmarkSelectionAction, &IntegralAction::valueChanged, this, [this, updateNumWalksForLandmarkSelectionAction]() {
@@ -143,16 +196,38 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
         updateUseMonteCarloSampling();
     });
 
+    connect(&_useSparseInfluencePropagationAction, &ToggleAction::toggled, this, [this, updateUseSparseInfluencePropagation]() {
+        updateUseSparseInfluencePropagation();
+    });
+
+    connect(&_useRandomWalkEngineAction, &ToggleAction::toggled, this, [this, updateUseRandomWalkEngine]() {
+        updateUseRandomWalkEngine();
+    });
+
     connect(&_seedAction, &IntegralAction::valueChanged, this, [this, updateSeed]() {
         updateSeed();
     });
 
-    connect(&_saveHierarchyToDiskAction, &ToggleAction::toggled, this, [this, updateSaveHierarchyToDiskAction]() {
+    connect(&_saveHierarchyToDiskAction, &ToggleAction::toggled, this, [this, updateSaveHierarchyToDiskAction, updateCacheEnabled]() {
         updateSaveHierarchyToDiskAction();
+        updateCacheEnabled();
+    });
+
+    connect(&_cacheDirectoryAction, &StringAction::stringChanged, this, [this, updateCacheDirectory]() {
+        updateCacheDirectory();
+    });
+
+    connect(&_cacheQuotaAction, &IntegralAction::valueChanged, this, [this, updateCacheQuota]() {
+        updateCacheQuota();
+    });
+
+    connect(&_knnGraphFileAction, &StringAction::stringChanged, this, [this, updateKnnGraphFile]() {
+        updateKnnGraphFile();
     });
 
-    connect(this, &GroupAction::readOnlyChanged, this, [this, updateReadOnly](const bool& readOnly) {
+    connect(this, &GroupAction::readOnlyChanged, this, [this, updateReadOnly, updateCacheEnabled](const bool& readOnly) {
         updateReadOnly();
+        updateCacheEnabled();
     });
 
     updateNumWalksForLandmarkSelectionAction();
@@ -162,9 +237,15 @@ HierarchyConstructionSettingsAction::HierarchyConstructionSettingsAction(HsneSet
     updateMinWalksRequired();
     updateUseOutOfCoreComputation();
     updateUseMonteCarloSampling();
+    updateUseSparseInfluencePropagation();
+    updateUseRandomWalkEngine();
     updateSeed();
     updateSaveHierarchyToDiskAction();
+    updateCacheDirectory();
+    updateCacheQuota();
+    updateKnnGraphFile();
     updateReadOnly();
+    updateCacheEnabled();
 }
 
 void HierarchyConstructionSettingsAction::fromVariantMap(const QVariantMap& variantMap)
@@ -177,10 +258,15 @@ void HierarchyConstructionSettingsAction::fromVariantMap(const QVariantMap& vari
     _numWalksForAreaOfInfluenceAction.fromParentVariantMap(variantMap);
     _minWalksRequiredAction.fromParentVariantMap(variantMap);
     _useMonteCarloSamplingAction.fromParentVariantMap(variantMap);
+    _useSparseInfluencePropagationAction.fromParentVariantMap(variantMap);
+    _useRandomWalkEngineAction.fromParentVariantMap(variantMap);
     _useOutOfCoreComputationAction.fromParentVariantMap(variantMap);
     _seedAction.fromParentVariantMap(variantMap);
     _saveHierarchyToDiskAction.fromParentVariantMap(variantMap);
     _saveHierarchyToProjectAction.fromParentVariantMap(variantMap);
+    _cacheDirectoryAction.fromParentVariantMap(variantMap);
+    _cacheQuotaAction.fromParentVariantMap(variantMap);
+    _knnGraphFileAction.fromParentVariantMap(variantMap);
 }
 
 QVariantMap HierarchyConstructionSettingsAction::toVariantMap() const
@@ -193,10 +279,15 @@ QVariantMap HierarchyConstructionSettingsAction::toVariantMap() const
     _numWalksForAreaOfInfluenceAction.insertIntoVariantMap(variantMap);
     _minWalksRequiredAction.insertIntoVariantMap(variantMap);
     _useMonteCarloSamplingAction.insertIntoVariantMap(variantMap);
+    _useSparseInfluencePropagationAction.insertIntoVariantMap(variantMap);
+    _useRandomWalkEngineAction.insertIntoVariantMap(variantMap);
     _useOutOfCoreComputationAction.insertIntoVariantMap(variantMap);
     _seedAction.insertIntoVariantMap(variantMap);
     _saveHierarchyToDiskAction.insertIntoVariantMap(variantMap);
     _saveHierarchyToProjectAction.insertIntoVariantMap(variantMap);
+    _cacheDirectoryAction.insertIntoVariantMap(variantMap);
+    _cacheQuotaAction.insertIntoVariantMap(variantMap);
+    _knnGraphFileAction.insertIntoVariantMap(variantMap);
 
     return variantMap;
 }
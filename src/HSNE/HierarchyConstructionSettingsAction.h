@@ -3,6 +3,7 @@
 #include "actions/DecimalAction.h"
 #include "actions/GroupAction.h"
 #include "actions/IntegralAction.h"
+#include "actions/StringAction.h"
 #include "actions/ToggleAction.h"
 
 using namespace mv::gui;
@@ -37,9 +38,14 @@ public: // Action getters
     IntegralAction& getMinWalksRequiredAction() { return _minWalksRequiredAction; }
     ToggleAction& getUseOutOfCoreComputationAction() { return _useOutOfCoreComputationAction; }
     ToggleAction& getUseMonteCarloSamplingAction() { return _useMonteCarloSamplingAction; }
+    ToggleAction& getUseSparseInfluencePropagationAction() { return _useSparseInfluencePropagationAction; }
+    ToggleAction& getUseRandomWalkEngineAction() { return _useRandomWalkEngineAction; }
     IntegralAction& getSeedAction() { return _seedAction; }
     ToggleAction& getSaveHierarchyToDiskAction() { return _saveHierarchyToDiskAction; }
     ToggleAction& getSaveHierarchyToProjectAction() { return _saveHierarchyToProjectAction; }
+    StringAction& getCacheDirectoryAction() { return _cacheDirectoryAction; }
+    IntegralAction& getCacheQuotaAction() { return _cacheQuotaAction; }
+    StringAction& getKnnGraphFileAction() { return _knnGraphFileAction; }
 
 public: // Serialization
 
@@ -64,7 +70,12 @@ protected:
     IntegralAction          _minWalksRequiredAction;                            /** Minimum number of walks required action */
     ToggleAction            _useOutOfCoreComputationAction;                     /** Use out of core computation action */
     ToggleAction            _useMonteCarloSamplingAction;                       /** Use Monte Carlo sampling on/off action */
+    ToggleAction            _useSparseInfluencePropagationAction;               /** Compute the influence hierarchy with sparse matrix products on/off action */
+    ToggleAction            _useRandomWalkEngineAction;                         /** Construct the scales with parallel alias table walks on/off action */
     IntegralAction          _seedAction;                                        /** Random seed action */
     ToggleAction            _saveHierarchyToDiskAction;                         /** Save computed hierarchy to disk action */
     ToggleAction            _saveHierarchyToProjectAction;                      /** Save computed hierarchy to project action */
+    StringAction            _cacheDirectoryAction;                              /** Directory of the hierarchy cache store action */
+    IntegralAction          _cacheQuotaAction;                                  /** Disk quota of the hierarchy cache store action */
+    StringAction            _knnGraphFileAction;                                /** Precomputed neighbor graph of the data scale action */
 };
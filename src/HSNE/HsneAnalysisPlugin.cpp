@@ -17,6 +17,7 @@
 #include "hdi/dimensionality_reduction/hierarchical_sne.h"
 
 #include <fstream>
+#include <numeric>
 
 Q_PLUGIN_METADATA(IID "nl.tudelft.HsneAnalysisPlugin")
 
@@ -27,18 +28,32 @@ HsneAnalysisPlugin::HsneAnalysisPlugin(const PluginFactory* factory) :
     AnalysisPlugin(factory),
     _hierarchy(std::make_unique<HsneHierarchy>()),
     _hierarchyThread(),
+    _embeddingScheduler(),
+    _speculativeRefinements(*_hierarchy, _embeddingScheduler),
     _tsneAnalysis(),
     _hsneSettingsAction(nullptr),
     _selectionHelperData(nullptr)
 {
     setObjectName("HSNE");
+
+    _embeddingScheduler.add(&_tsneAnalysis);
 }
 
 HsneAnalysisPlugin::~HsneAnalysisPlugin()
 {
-    _hierarchyThread.quit();           // Signal the thread to quit gracefully
-    if (!_hierarchyThread.wait(500))   // Wait for the thread to actually finish
-        _hierarchyThread.terminate();  // Terminate thread after 0.5 seconds
+    // A running construction stops at its next checkpoint, e.g. after the scale it is adding or within the selection mapping
+    _hierarchy->requestCancel();
+
+    _hierarchyThread.quit();            // Signal the thread to quit gracefully
+
+    // Never terminated, that would leave the hierarchy, its task and the cache store in the middle of a step.
+    // The kNN search and the scales computed by HDI cannot be interrupted, the next checkpoint may take a while.
+    if (!_hierarchyThread.wait(1000))
+    {
+        qDebug() << "HsneAnalysisPlugin: waiting for the hierarchy construction to reach its next checkpoint";
+        _hierarchyThread.wait();
+        qDebug() << "HsneAnalysisPlugin: hierarchy construction stopped";
+    }
 }
 
 void HsneAnalysisPlugin::init()
@@ -67,6 +82,28 @@ void HsneAnalysisPlugin::init()
     int numHierarchyScales = std::max(1L, std::lround(log10(inputDataset->getNumPoints())) - 2);
     _hsneSettingsAction->getGeneralHsneSettingsAction().getNumScalesAction().setValue(numHierarchyScales);
 
+    auto& maxConcurrentEmbeddingsAction = _hsneSettingsAction->getGeneralHsneSettingsAction().getMaxConcurrentEmbeddingsAction();
+    _embeddingScheduler.setMaxConcurrent(maxConcurrentEmbeddingsAction.getValue());
+
+    connect(&maxConcurrentEmbeddingsAction, &IntegralAction::valueChanged, this, [this](int32_t value) {
+        _embeddingScheduler.setMaxConcurrent(value);
+    });
+
+    // Refinements of the top level embedding start from precomputed ones where possible
+    _hsneSettingsAction->getTopLevelScaleAction().setSpeculativeRefinements(&_speculativeRefinements);
+
+    connect(&_hsneSettingsAction->getGeneralHsneSettingsAction().getPreEmbedClustersAction(), &ToggleAction::toggled, this, [this](bool toggled) {
+        if (!toggled)
+            _speculativeRefinements.clear();
+    });
+
+    auto& spillInactiveScalesAction = _hsneSettingsAction->getGeneralHsneSettingsAction().getSpillInactiveScalesAction();
+    _hierarchy->setSpillInactiveScales(spillInactiveScalesAction.isChecked());
+
+    connect(&spillInactiveScalesAction, &ToggleAction::toggled, this, [this](bool toggled) {
+        _hierarchy->setSpillInactiveScales(toggled);
+    });
+
     // Manage UI elements attached to output data set
     outputDataset->getDataHierarchyItem().select(true);
     outputDataset->_infoAction->collapse();
@@ -96,7 +133,7 @@ void HsneAnalysisPlugin::init()
     const auto updateComputationAction = [this, &computationAction]() {
         const auto isRunning = computationAction.getRunningAction().isChecked();
 
-        computationAction.getStartComputationAction().setEnabled(!isRunning);
+        computationAction.getStartComputationAction().setEnabled(!isRunning && !_hierarchyRunning && _hierarchy->isInitialized());
         computationAction.getContinueComputationAction().setEnabled(!isRunning && _tsneAnalysis.canContinue());
         computationAction.getStopComputationAction().setEnabled(isRunning);
     };
@@ -104,15 +141,32 @@ void HsneAnalysisPlugin::init()
     connect(&_tsneAnalysis, &TsneAnalysis::finished, this, [this, &computationAction, updateComputationAction]() {
         computationAction.getRunningAction().setChecked(false);
 
-        _hsneSettingsAction->setReadOnly(false);
+        // The hierarchy settings stay read-only until the influence hierarchy is finished
+        if (!_hierarchyRunning)
+            _hsneSettingsAction->setReadOnly(false);
+
+        _hsneSettingsAction->getGradientDescentSettingsAction().setReadOnly(false);
+        _hsneSettingsAction->getTopLevelScaleAction().setReadOnly(_hierarchyRunning);
 
         updateComputationAction();
+
+        // The refinements need the influence hierarchy, otherwise they start once the hierarchy is finished
+        if (!_hierarchyRunning)
+            startSpeculativeRefinements();
     });
 
     connect(&_tsneAnalysis, &TsneAnalysis::aborted, this, [this, &computationAction, updateComputationAction]() {
+        // Restarted by computeTopLevelEmbedding, the embedding keeps running
+        if (_restartingEmbedding)
+            return;
+
         computationAction.getRunningAction().setChecked(false);
 
-        _hsneSettingsAction->setReadOnly(false);
+        if (!_hierarchyRunning)
+            _hsneSettingsAction->setReadOnly(false);
+
+        _hsneSettingsAction->getGradientDescentSettingsAction().setReadOnly(false);
+        _hsneSettingsAction->getTopLevelScaleAction().setReadOnly(_hierarchyRunning);
 
         updateComputationAction();
     });
@@ -125,6 +179,7 @@ void HsneAnalysisPlugin::init()
         int numLandmarks = topScale.size();
         TsneParameters tsneParameters = _hsneSettingsAction->getTsneParameters();
 
+        // Embed straight from the matrix in the hierarchy
         _tsneAnalysis.startComputation(tsneParameters, _hierarchy->getTransitionMatrixAtScale(topScaleIndex), numLandmarks);
     });
 
@@ -145,21 +200,60 @@ void HsneAnalysisPlugin::init()
         updateComputationAction();
     });
 
-    // once HsneHierarchy::initialize is done, it'll emit HsneHierarchy::finished
+    // once HsneHierarchy::initialize has added all scales, it'll emit HsneHierarchy::scalesFinished and when it is done HsneHierarchy::finished
     connect(this, &HsneAnalysisPlugin::startHierarchyWorker, _hierarchy.get(), &HsneHierarchy::initialize);
 
-    connect(_hierarchy.get(), &HsneHierarchy::finished, this, [this]() {
-        
+    // The top level embedding only needs the scales, it runs while the hierarchy thread computes the selection mapping
+    connect(_hierarchy.get(), &HsneHierarchy::scalesFinished, this, &HsneAnalysisPlugin::computeTopLevelEmbedding);
+
+    connect(_hierarchy.get(), &HsneHierarchy::finished, this, [this, &computationAction, updateComputationAction]() {
+        _hierarchyRunning = false;
+
+        _hsneSettingsAction->getGeneralHsneSettingsAction().getCancelAction().setEnabled(false);
         _hsneSettingsAction->getGeneralHsneSettingsAction().setReadOnly(false);
         _hsneSettingsAction->getHierarchyConstructionSettingsAction().setReadOnly(false);
-        _hsneSettingsAction->getTopLevelScaleAction().setReadOnly(false);
-        _hsneSettingsAction->getGradientDescentSettingsAction().setReadOnly(false);
         _hsneSettingsAction->getKnnSettingsAction().setReadOnly(false);
 
+        // A running top level embedding re-enables its settings once it is finished
+        if (!computationAction.getRunningAction().isChecked())
+        {
+            _hsneSettingsAction->getTopLevelScaleAction().setReadOnly(false);
+            _hsneSettingsAction->getGradientDescentSettingsAction().setReadOnly(false);
+        }
+
+        updateComputationAction();
+
+        // The top level embedding finished before the influence hierarchy
+        if (!computationAction.getRunningAction().isChecked() && _tsneAnalysis.canContinue())
+            startSpeculativeRefinements();
+
         _hsneSettingsAction->getGeneralHsneSettingsAction().getStartAction().setText("Recompute");
         _hsneSettingsAction->getGeneralHsneSettingsAction().getStartAction().setToolTip("Recomputing does not change the selection mapping.\n If the data size changed, prefer creating a new HSNE analysis.");
 
-        computeTopLevelEmbedding();
+        // A cancelled selection mapping is computed by the next recompute, the selection is linked then
+        if (_topLevelSelectionPending && _hierarchy->hasSelectionMapping(_hierarchy->getTopScale()))
+            linkTopLevelSelection();
+
+        _hierarchy->spillInactiveScales();
+    });
+
+    // Cancelled before any scale above the data scale finished, there is nothing to embed
+    connect(_hierarchy.get(), &HsneHierarchy::cancelled, this, [this]() {
+        _hierarchyRunning = false;
+
+        _hsneSettingsAction->getGeneralHsneSettingsAction().getCancelAction().setEnabled(false);
+        _hsneSettingsAction->getGeneralHsneSettingsAction().setReadOnly(false);
+        _hsneSettingsAction->getHierarchyConstructionSettingsAction().setReadOnly(false);
+        _hsneSettingsAction->getGradientDescentSettingsAction().setReadOnly(false);
+        _hsneSettingsAction->getKnnSettingsAction().setReadOnly(false);
+
+        // The top level scale stays read-only, there is no scale to embed or refine
+
+        getOutputDataset<Points>()->getTask().setAborted();
+    });
+
+    connect(&_hsneSettingsAction->getGeneralHsneSettingsAction().getCancelAction(), &TriggerAction::triggered, this, [this]() {
+        _hierarchy->requestCancel();
     });
 
     connect(&_hsneSettingsAction->getGeneralHsneSettingsAction().getStartAction(), &TriggerAction::triggered, this, [this](bool toggled) {
@@ -173,7 +267,11 @@ void HsneAnalysisPlugin::init()
                 return;
         }
 
+        // Set before stopping the embedding, its aborted handler then leaves the hierarchy settings read-only
+        _hierarchyRunning = true;
+
         _tsneAnalysis.stopComputation();
+        _speculativeRefinements.clear();
 
         _hsneSettingsAction->getGeneralHsneSettingsAction().setReadOnly(true);
         _hsneSettingsAction->getHierarchyConstructionSettingsAction().setReadOnly(true);
@@ -181,6 +279,7 @@ void HsneAnalysisPlugin::init()
         _hsneSettingsAction->getGradientDescentSettingsAction().setReadOnly(true);
         _hsneSettingsAction->getTopLevelScaleAction().getComputationAction().getStartComputationAction().setEnabled(false);
         _hsneSettingsAction->getKnnSettingsAction().setReadOnly(true);
+        _hsneSettingsAction->getGeneralHsneSettingsAction().getCancelAction().setEnabled(true);
 
         // Initialize the HSNE algorithm with the given parameters and compute the hierarchy
         auto inputData      = getInputDataset<Points>();
@@ -215,12 +314,17 @@ void HsneAnalysisPlugin::init()
     });
 
     _eventListener.addSupportedEventType(static_cast<std::uint32_t>(EventType::DatasetAboutToBeRemoved));
+    _eventListener.addSupportedEventType(static_cast<std::uint32_t>(EventType::DatasetDataSelectionChanged));
     _eventListener.registerDataEventByType(PointType, [this](DatasetEvent* dataEvent) {
         const auto& datasetID       = dataEvent->getDataset()->getId();
         const auto& outputDatasetID = getOutputDataset<Points>()->getId();
 
+        // The embedding the analyst works with gets the cores first
+        if (dataEvent->getType() == EventType::DatasetDataSelectionChanged && outputDatasetID == datasetID)
+            _embeddingScheduler.prioritize(&_tsneAnalysis);
+
         // If the removed dataset is the output data (top level embedding), remove the accompanying _selectionHelperData
-        if (outputDatasetID == datasetID)
+        if (dataEvent->getType() == EventType::DatasetAboutToBeRemoved && outputDatasetID == datasetID)
         {
             if (!_selectionHelperData.isValid())
                 return;
@@ -244,6 +348,9 @@ void HsneAnalysisPlugin::init()
 
 void HsneAnalysisPlugin::computeTopLevelEmbedding()
 {
+    // Precomputed refinements belong to the previous top level
+    _speculativeRefinements.clear();
+
     auto embeddingDataset = getOutputDataset<Points>();
 
     auto& datasetTask = embeddingDataset->getTask();
@@ -272,18 +379,8 @@ void HsneAnalysisPlugin::computeTopLevelEmbedding()
         // Select the appropriate points to create a subset from
         selectionDataset->indices.resize(numLandmarks);
 
-        if (inputDataset->isFull())
-        {
-            for (uint32_t i = 0; i < numLandmarks; i++)
-                selectionDataset->indices[i] = topScale._landmark_to_original_data_idx[i];
-        }
-        else
-        {
-            std::vector<unsigned int> globalIndices;
-            inputDataset->getGlobalIndices(globalIndices);
-            for (uint32_t i = 0; i < numLandmarks; i++)
-                selectionDataset->indices[i] = globalIndices[topScale._landmark_to_original_data_idx[i]];
-        }
+        for (uint32_t i = 0; i < numLandmarks; i++)
+            selectionDataset->indices[i] = _hierarchy->getLandmarkGlobalIndex(topScaleIndex, i);
 
         // Create the subset and clear the selection
         auto selectionHelperCount = inputDataset->getProperty("selectionHelperCount").toInt();
@@ -294,51 +391,59 @@ void HsneAnalysisPlugin::computeTopLevelEmbedding()
 
         embeddingDataset->setSourceDataset(_selectionHelperData);
 
-        // Add linked selection between the upper embedding and the bottom layer
-        {
-            LandmarkMap& landmarkMap = _hierarchy->getInfluenceHierarchy().getMap()[topScaleIndex];
-
-            mv::SelectionMap mapping;
-            auto& selectionMap = mapping.getMap();
-
-            if (inputDataset->isFull())
-            {
-                std::vector<unsigned int> globalIndices;
-                _selectionHelperData->getGlobalIndices(globalIndices);
-
-                for (unsigned int i = 0; i < landmarkMap.size(); i++)
-                {
-                    selectionMap[globalIndices[i]] = landmarkMap[i];
-                }
-            }
-            else
-            {
-                std::vector<unsigned int> globalIndices;
-                inputDataset->getGlobalIndices(globalIndices);
-                for (unsigned int i = 0; i < landmarkMap.size(); i++)
-                {
-                    std::vector<unsigned int> bottomMap = landmarkMap[i];
-                    for (unsigned int j = 0; j < bottomMap.size(); j++)
-                    {
-                        bottomMap[j] = globalIndices[bottomMap[j]];
-                    }
-                    auto bottomLevelIdx = _hierarchy->getScale(topScaleIndex)._landmark_to_original_data_idx[i];
-                    selectionMap[globalIndices[bottomLevelIdx]] = bottomMap;
-                }
-            }
-
-            embeddingDataset->addLinkedData(inputDataset, mapping);
-        }
+        // The influence hierarchy is still being computed, link the selection once the hierarchy is finished
+        _topLevelSelectionPending = true;
     }
 
     // Set t-SNE parameters
     TsneParameters tsneParameters = _hsneSettingsAction->getTsneParameters();
 
-    // Embed data
+    // Embed data straight from the matrix in the hierarchy
+    _restartingEmbedding = true;
     _tsneAnalysis.stopComputation();
+    _restartingEmbedding = false;
+
     _tsneAnalysis.startComputation(tsneParameters, _hierarchy->getTransitionMatrixAtScale(topScaleIndex), numLandmarks);
 }
 
+void HsneAnalysisPlugin::startSpeculativeRefinements()
+{
+    // Use the idle time while the analyst looks at the top level embedding
+    const int topScaleIndex = _hierarchy->getTopScale();
+    if (_hsneSettingsAction->getGeneralHsneSettingsAction().getPreEmbedClustersAction().isChecked() && topScaleIndex > 0 && !_speculativeRefinements.isStarted(topScaleIndex))
+        _speculativeRefinements.start(topScaleIndex, _hsneSettingsAction->getTsneParameters());
+}
+
+void HsneAnalysisPlugin::linkTopLevelSelection()
+{
+    _topLevelSelectionPending = false;
+
+    auto embeddingDataset = getOutputDataset<Points>();
+    auto inputDataset = getInputDataset<Points>();
+    const int topScaleIndex = _hierarchy->getTopScale();
+
+    // Add linked selection between the upper embedding and the bottom layer
+    const unsigned int numLandmarks = _hierarchy->getScale(topScaleIndex).size();
+
+    std::vector<uint32_t> landmarks(numLandmarks);
+    std::iota(landmarks.begin(), landmarks.end(), 0u);
+
+    std::vector<unsigned int> keys;
+    if (inputDataset->isFull())
+        _selectionHelperData->getGlobalIndices(keys);
+    else
+    {
+        keys.resize(numLandmarks);
+        for (unsigned int i = 0; i < numLandmarks; i++)
+            keys[i] = _hierarchy->getLandmarkGlobalIndex(topScaleIndex, i);
+    }
+
+    mv::SelectionMap mapping;
+    _hierarchy->getSelectionMapping(topScaleIndex, landmarks, keys, mapping);
+
+    embeddingDataset->addLinkedData(inputDataset, mapping);
+}
+
 void HsneAnalysisPlugin::continueComputation()
 {
     getOutputDataset()->getTask().setRunning();
@@ -365,7 +470,18 @@ void HsneAnalysisPlugin::fromVariantMap(const QVariantMap& variantMap)
 
     if (_hsneSettingsAction->getHierarchyConstructionSettingsAction().getSaveHierarchyToProjectAction().isChecked())
     {
-        if (variantMap.contains("HsneHierarchy") && variantMap.contains("HsneInfluenceHierarchy"))
+        if (variantMap.contains("HsneCache"))
+        {
+            // Copy the influence hierarchy instead of borrowing it from the mapped file, the temporary project directory may be removed
+            const auto loadPathCache = QDir::cleanPath(projects().getTemporaryDirPath(AbstractProjectManager::TemporaryDirType::Open) + QDir::separator() + variantMap["HsneCache"].toString());
+            bool loadedCache = _hierarchy->loadCacheFile(loadPathCache.toStdString(), /* borrowInfluenceHierarchy = */ false);
+
+            _hierarchy->setIsInitialized(true);
+
+            if (!loadedCache)
+                qWarning("HsneAnalysisPlugin::fromVariantMap: HSNE hierarchy was NOT loaded successfully");
+        }
+        else if (variantMap.contains("HsneHierarchy") && variantMap.contains("HsneInfluenceHierarchy"))
         {
             hdi::utils::CoutLog log;
 
@@ -386,6 +502,8 @@ void HsneAnalysisPlugin::fromVariantMap(const QVariantMap& variantMap)
             qWarning("HsneAnalysisPlugin::fromVariantMap: HSNE hierarchy cannot be loaded from project since the project file does not seem to contain a saved HSNE hierarchy");
     }
 
+    _hierarchy->spillInactiveScales();
+
     _selectionHelperData = mv::data().getDataset(variantMap["selectionHelperDataGUID"].toString());
     _hsneSettingsAction->getGeneralHsneSettingsAction().getStartAction().setText("Recompute");
     _hsneSettingsAction->getGeneralHsneSettingsAction().getStartAction().setToolTip("Recomputing does not change the selection mapping.\n If the data size changed, prefer creating a new HSNE analysis.");
@@ -399,31 +517,15 @@ QVariantMap HsneAnalysisPlugin::toVariantMap() const
 
     if (_hsneSettingsAction->getHierarchyConstructionSettingsAction().getSaveHierarchyToProjectAction().isChecked() && _hierarchy->isInitialized())
     {
-        // Handle HSNE Hierarchy
-        {
-            const auto fileName = QUuid::createUuid().toString(QUuid::WithoutBraces) + ".bin";
-            const auto filePath = QDir::cleanPath(projects().getTemporaryDirPath(AbstractProjectManager::TemporaryDirType::Save) + QDir::separator() + fileName).toStdString();
-
-            std::ofstream saveFile(filePath, std::ios::out | std::ios::binary);
-
-            if (!saveFile.is_open())
-                std::cerr << "Caching failed. File could not be opened. " << std::endl;
-            else
-            {
-                hdi::dr::IO::saveHSNE(_hierarchy->getHsne(), saveFile, nullptr);
-                saveFile.close();
-                variantMap["HsneHierarchy"] = fileName;
-            }
-        }
+        // Handle HSNE Hierarchy and InfluenceHierarchy
+        const auto fileName = QUuid::createUuid().toString(QUuid::WithoutBraces) + ".hsnec";
+        const auto filePath = QDir::cleanPath(projects().getTemporaryDirPath(AbstractProjectManager::TemporaryDirType::Save) + QDir::separator() + fileName).toStdString();
 
-        // Handle HSNE InfluenceHierarchy
-        {
-            const auto fileName = QUuid::createUuid().toString(QUuid::WithoutBraces) + ".bin";
-            const auto filePath = QDir::cleanPath(projects().getTemporaryDirPath(AbstractProjectManager::TemporaryDirType::Save) + QDir::separator() + fileName).toStdString();
+        if (_hierarchy->saveCacheFile(filePath))
+            variantMap["HsneCache"] = fileName;
 
-            _hierarchy->saveCacheHsneInfluenceHierarchy(filePath, _hierarchy->getInfluenceHierarchy().getMap());
-            variantMap["HsneInfluenceHierarchy"] = fileName;
-        }
+        // Saving reloaded the spilled scales
+        _hierarchy->spillInactiveScales();
     }
 
     variantMap["selectionHelperDataGUID"] = QVariant::fromValue(_selectionHelperData->getId());
@@ -4,8 +4,10 @@
 
 #include <event/EventListener.h>
 
+#include "EmbeddingScheduler.h"
 #include "HsneHierarchy.h"
 #include "HsneSettingsAction.h"
+#include "SpeculativeRefinements.h"
 #include "TsneAnalysis.h"
 
 using namespace mv::plugin;
@@ -32,8 +34,15 @@ public:
     void computeTopLevelEmbedding();
     void continueComputation();
 
+    /** Link the selection of the top level embedding to the input data, requires the influence hierarchy */
+    void linkTopLevelSelection();
+
+    /** Pre-embed the refinements of the top level clusters if enabled, requires the influence hierarchy */
+    void startSpeculativeRefinements();
+
     HsneHierarchy& getHierarchy() { return *_hierarchy.get(); }
     TsneAnalysis& getTsneAnalysis() { return _tsneAnalysis; }
+    EmbeddingScheduler& getEmbeddingScheduler() { return _embeddingScheduler; }
 
     HsneSettingsAction& getHsneSettingsAction() { return *_hsneSettingsAction; }
 
@@ -58,10 +67,15 @@ signals:
 private:
     std::unique_ptr<HsneHierarchy> _hierarchy;      /** HSNE hierarchy */
     QThread                 _hierarchyThread;       /** Qt Thread for managing HSNE hierarchy computation */
+    EmbeddingScheduler      _embeddingScheduler;    /** Shares the cores between the top level and refined embeddings */
+    SpeculativeRefinements  _speculativeRefinements;    /** Refinements of top level clusters, embedded in the background */
     TsneAnalysis            _tsneAnalysis;          /** TSNE analysis */
     HsneSettingsAction*     _hsneSettingsAction;    /** Pointer to HSNE settings action */
     EventListener           _eventListener;         /** Listen to ManiVault events */
     mv::Dataset<Points>     _selectionHelperData;   /** Invisible selection helper dataset */
+    bool                    _topLevelSelectionPending = false;  /** Whether the selection helper awaits its linked selection */
+    bool                    _hierarchyRunning = false;          /** Whether the hierarchy is constructed, its settings stay read-only until it is finished or cancelled */
+    bool                    _restartingEmbedding = false;       /** Whether computeTopLevelEmbedding stops the running embedding, its aborted signal is ignored */
 };
 
 class HsneAnalysisPluginFactory : public AnalysisPluginFactory
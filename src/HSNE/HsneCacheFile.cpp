@@ -0,0 +1,407 @@
+#include "HsneCacheFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include <QFile>
+
+namespace
+{
+    constexpr char magic[8] = { 'H', 'S', 'N', 'E', 'C', 'S', 'R', '\0' };
+    constexpr char spillMagic[8] = { 'H', 'S', 'N', 'E', 'S', 'P', 'L', '\0' };
+    constexpr std::uint64_t alignment = 64;
+
+    struct FileHeader
+    {
+        char            magic[8];
+        std::uint32_t   version;
+        std::uint32_t   numScales;
+        std::uint64_t   numInfluenceMaps;
+    };
+
+    struct SpillHeader
+    {
+        char            magic[8];
+        std::uint32_t   version;
+        std::uint32_t   reserved;
+    };
+
+    // One non-zero of a sparse matrix row, same layout as the key-value pairs of hdi::data::MapMemEff<uint32_t, float>
+    struct SparseEntry
+    {
+        std::uint32_t   column;
+        float           value;
+    };
+
+    static_assert(sizeof(SparseEntry) == 8, "Unexpected padding in SparseEntry");
+    static_assert(alignment % alignof(std::uint64_t) == 0, "Sections must be aligned for all element types");
+
+    class SectionWriter
+    {
+    public:
+        explicit SectionWriter(std::ofstream& stream) : _stream(stream), _position(0) {}
+
+        void writeRaw(const void* data, std::uint64_t numBytes)
+        {
+            if (numBytes == 0)
+                return;
+
+            _stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(numBytes));
+            _position += numBytes;
+        }
+
+        /** Element count, padding up to the next aligned offset, elements */
+        template<typename T>
+        void writeArray(const T* data, std::uint64_t count)
+        {
+            writeRaw(&count, sizeof(count));
+            pad();
+            writeRaw(data, count * sizeof(T));
+        }
+
+        template<typename T>
+        void writeArray(const std::vector<T>& values) { writeArray(values.data(), values.size()); }
+
+        void writeSparseMatrix(const HsneMatrix& matrix)
+        {
+            std::vector<std::uint64_t> offsets(matrix.size() + 1, 0);
+            for (size_t row = 0; row < matrix.size(); row++)
+                offsets[row + 1] = offsets[row] + matrix[row].size();
+
+            writeArray(offsets);
+
+            const std::uint64_t numEntries = offsets.back();
+            writeRaw(&numEntries, sizeof(numEntries));
+            pad();
+
+            std::vector<SparseEntry> rowEntries;
+            for (const auto& row : matrix)
+            {
+                rowEntries.clear();
+                for (const auto& entry : row)
+                    rowEntries.push_back({ entry.first, entry.second });
+
+                writeRaw(rowEntries.data(), rowEntries.size() * sizeof(SparseEntry));
+            }
+        }
+
+    private:
+        void pad()
+        {
+            static const char zeros[alignment] = {};
+            writeRaw(zeros, (alignment - _position % alignment) % alignment);
+        }
+
+    private:
+        std::ofstream&  _stream;
+        std::uint64_t   _position;
+    };
+
+    class SectionReader
+    {
+    public:
+        SectionReader(const unsigned char* data, std::uint64_t size) : _data(data), _size(size), _position(0), _ok(true) {}
+
+        bool ok() const { return _ok; }
+
+        bool readRaw(void* destination, std::uint64_t numBytes)
+        {
+            if (!_ok || numBytes > _size - _position)
+                return _ok = false;
+
+            std::memcpy(destination, _data + _position, numBytes);
+            _position += numBytes;
+            return true;
+        }
+
+        /** Pointer to the elements of the next section in the mapped memory, nullptr on failure */
+        template<typename T>
+        const T* readArray(std::uint64_t& count)
+        {
+            count = 0;
+            if (!readRaw(&count, sizeof(count)))
+                return nullptr;
+
+            _position += (alignment - _position % alignment) % alignment;
+
+            if (_position > _size || count > (_size - _position) / sizeof(T))
+            {
+                _ok = false;
+                count = 0;
+                return nullptr;
+            }
+
+            const T* elements = reinterpret_cast<const T*>(_data + _position);
+            _position += count * sizeof(T);
+            return elements;
+        }
+
+    private:
+        const unsigned char*    _data;
+        std::uint64_t           _size;
+        std::uint64_t           _position;
+        bool                    _ok;
+    };
+
+    // Offsets must start at zero, not decrease and end at the number of elements they index
+    bool validOffsets(const std::uint64_t* offsets, std::uint64_t numOffsets, std::uint64_t numElements)
+    {
+        if (numOffsets == 0 || offsets[0] != 0 || offsets[numOffsets - 1] != numElements)
+            return false;
+
+        for (std::uint64_t i = 1; i < numOffsets; i++)
+            if (offsets[i] < offsets[i - 1])
+                return false;
+
+        return true;
+    }
+
+    template<typename T>
+    bool readVector(SectionReader& reader, std::vector<T>& values)
+    {
+        std::uint64_t count = 0;
+        const T* elements = reader.readArray<T>(count);
+
+        if (!reader.ok())
+            return false;
+
+        values.assign(elements, elements + count);
+        return true;
+    }
+
+    bool readSparseMatrix(SectionReader& reader, HsneMatrix& matrix)
+    {
+        std::uint64_t numOffsets = 0;
+        std::uint64_t numEntries = 0;
+        const std::uint64_t* offsets = reader.readArray<std::uint64_t>(numOffsets);
+        const SparseEntry* entries = reader.readArray<SparseEntry>(numEntries);
+
+        if (!reader.ok() || !validOffsets(offsets, numOffsets, numEntries))
+            return false;
+
+        matrix.clear();
+        matrix.resize(numOffsets - 1);
+
+#pragma omp parallel for
+        for (std::int64_t row = 0; row < static_cast<std::int64_t>(numOffsets - 1); row++)
+        {
+            auto& rowMemory = matrix[row].memory();
+            rowMemory.resize(offsets[row + 1] - offsets[row]);
+
+            const SparseEntry* rowEntries = entries + offsets[row];
+            for (size_t k = 0; k < rowMemory.size(); k++)
+                rowMemory[k] = { rowEntries[k].column, rowEntries[k].value };
+        }
+
+        return true;
+    }
+
+    // Offsets and indices sections of an influence map, a borrowed map keeps the file mapped
+    bool readLandmarkMap(SectionReader& reader, LandmarkMap& landmarkMap, const std::shared_ptr<QFile>& file, bool borrow)
+    {
+        std::uint64_t numOffsets = 0;
+        std::uint64_t numIndices = 0;
+        const std::uint64_t* offsets = reader.readArray<std::uint64_t>(numOffsets);
+        const unsigned int* indices = reader.readArray<unsigned int>(numIndices);
+
+        if (!reader.ok() || (numOffsets > 0 && !validOffsets(offsets, numOffsets, numIndices)))
+            return false;
+
+        if (numOffsets == 0)
+            landmarkMap = LandmarkMap();
+        else if (borrow)
+            landmarkMap = LandmarkMap(offsets, indices, numOffsets - 1, file);
+        else
+            landmarkMap = LandmarkMap(std::vector<std::uint64_t>(offsets, offsets + numOffsets), std::vector<unsigned int>(indices, indices + numIndices));
+
+        return true;
+    }
+}
+
+bool HsneCacheFile::save(const std::string& fileName, const Hsne& hsne, const std::vector<LandmarkMap>& influenceHierarchy)
+{
+    std::ofstream saveFile(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!saveFile.is_open())
+    {
+        std::cerr << "Caching failed. File could not be opened: " << fileName << std::endl;
+        return false;
+    }
+
+    const auto& hierarchy = hsne.hierarchy();
+
+    FileHeader header = {};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.numScales = static_cast<std::uint32_t>(hierarchy.size());
+    header.numInfluenceMaps = influenceHierarchy.size();
+
+    SectionWriter writer(saveFile);
+    writer.writeRaw(&header, sizeof(header));
+
+    for (const auto& scale : hierarchy)
+    {
+        writer.writeArray(scale._landmark_to_original_data_idx);
+        writer.writeArray(scale._landmark_to_previous_scale_idx);
+        writer.writeArray(scale._previous_scale_to_landmark_idx);
+        writer.writeArray(scale._landmark_weight);
+        writer.writeSparseMatrix(scale._transition_matrix);
+        writer.writeSparseMatrix(scale._area_of_influence);
+    }
+
+    for (const LandmarkMap& landmarkMap : influenceHierarchy)
+    {
+        writer.writeArray(landmarkMap.offsetsData(), landmarkMap.size() == 0 ? 0 : landmarkMap.size() + 1);
+        writer.writeArray(landmarkMap.indicesData(), landmarkMap.numIndices());
+    }
+
+    saveFile.close();
+
+    if (!saveFile)
+    {
+        std::cerr << "Caching failed. File could not be written: " << fileName << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool HsneCacheFile::load(const std::string& fileName, Hsne& hsne, std::vector<LandmarkMap>& influenceHierarchy, bool borrowInfluenceHierarchy)
+{
+    auto file = std::make_shared<QFile>(QString::fromStdString(fileName));
+
+    if (!file->open(QIODevice::ReadOnly) || file->size() < static_cast<qint64>(sizeof(FileHeader)))
+        return false;
+
+    // The mapping stays valid until the file is closed, i.e. until the last landmark map borrowing from it is gone
+    const unsigned char* data = file->map(0, file->size());
+
+    if (data == nullptr)
+    {
+        std::cerr << "Loading cache failed: File could not be mapped: " << fileName << std::endl;
+        return false;
+    }
+
+    SectionReader reader(data, static_cast<std::uint64_t>(file->size()));
+
+    FileHeader header = {};
+    reader.readRaw(&header, sizeof(header));
+
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)
+    {
+        std::cout << "Cache file " << fileName << " has an unknown format or version. Cannot load cache." << std::endl;
+        return false;
+    }
+
+    auto& hierarchy = hsne.hierarchy();
+    hierarchy.clear();
+    hierarchy.resize(header.numScales);
+
+    for (auto& scale : hierarchy)
+    {
+        if (!readVector(reader, scale._landmark_to_original_data_idx) ||
+            !readVector(reader, scale._landmark_to_previous_scale_idx) ||
+            !readVector(reader, scale._previous_scale_to_landmark_idx) ||
+            !readVector(reader, scale._landmark_weight) ||
+            !readSparseMatrix(reader, scale._transition_matrix) ||
+            !readSparseMatrix(reader, scale._area_of_influence))
+        {
+            hierarchy.clear();
+            return false;
+        }
+    }
+
+    std::vector<LandmarkMap> landmarkMaps(header.numInfluenceMaps);
+
+    for (LandmarkMap& landmarkMap : landmarkMaps)
+    {
+        if (!readLandmarkMap(reader, landmarkMap, file, borrowInfluenceHierarchy))
+        {
+            hierarchy.clear();
+            return false;
+        }
+    }
+
+    influenceHierarchy = std::move(landmarkMaps);
+
+    return true;
+}
+
+bool HsneCacheFile::saveScale(const std::string& fileName, const Hsne::scale_type& scale, const LandmarkMap& influenceMap)
+{
+    std::ofstream saveFile(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!saveFile.is_open())
+    {
+        std::cerr << "Spilling scale failed. File could not be opened: " << fileName << std::endl;
+        return false;
+    }
+
+    SpillHeader header = {};
+    std::memcpy(header.magic, spillMagic, sizeof(spillMagic));
+    header.version = version;
+
+    SectionWriter writer(saveFile);
+    writer.writeRaw(&header, sizeof(header));
+
+    writer.writeArray(influenceMap.offsetsData(), influenceMap.size() == 0 ? 0 : influenceMap.size() + 1);
+    writer.writeArray(influenceMap.indicesData(), influenceMap.numIndices());
+
+    writer.writeArray(scale._landmark_to_previous_scale_idx);
+    writer.writeArray(scale._previous_scale_to_landmark_idx);
+    writer.writeArray(scale._landmark_weight);
+    writer.writeSparseMatrix(scale._transition_matrix);
+    writer.writeSparseMatrix(scale._area_of_influence);
+
+    saveFile.close();
+
+    if (!saveFile)
+    {
+        std::cerr << "Spilling scale failed. File could not be written: " << fileName << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool HsneCacheFile::loadScale(const std::string& fileName, Hsne::scale_type* scale, LandmarkMap* influenceMap)
+{
+    auto file = std::make_shared<QFile>(QString::fromStdString(fileName));
+
+    const unsigned char* data = nullptr;
+    if (file->open(QIODevice::ReadOnly) && file->size() >= static_cast<qint64>(sizeof(SpillHeader)))
+        data = file->map(0, file->size());
+
+    if (data == nullptr)
+    {
+        std::cerr << "Loading spilled scale failed: File could not be mapped: " << fileName << std::endl;
+        return false;
+    }
+
+    SectionReader reader(data, static_cast<std::uint64_t>(file->size()));
+
+    SpillHeader header = {};
+    reader.readRaw(&header, sizeof(header));
+
+    if (std::memcmp(header.magic, spillMagic, sizeof(spillMagic)) != 0 || header.version != version)
+        return false;
+
+    // Parsed in any case, the scale arrays follow it
+    LandmarkMap loadedInfluenceMap;
+    if (!readLandmarkMap(reader, loadedInfluenceMap, file, /* borrow = */ true))
+        return false;
+
+    if (influenceMap != nullptr)
+        *influenceMap = std::move(loadedInfluenceMap);
+
+    if (scale == nullptr)
+        return true;
+
+    return readVector(reader, scale->_landmark_to_previous_scale_idx) &&
+        readVector(reader, scale->_previous_scale_to_landmark_idx) &&
+        readVector(reader, scale->_landmark_weight) &&
+        readSparseMatrix(reader, scale->_transition_matrix) &&
+        readSparseMatrix(reader, scale->_area_of_influence);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "HsneHierarchy.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * HsneCacheFile
+ *
+ * Single-file binary format for an HSNE hierarchy and its influence hierarchy.
+ *
+ * After a versioned header, all arrays are stored as contiguous sections: a 64-bit element count
+ * followed by the elements, starting at a 64-byte aligned file offset. Per scale the file holds the
+ * landmark index arrays, the landmark weights and the transition and area of influence matrices in
+ * compressed sparse row layout, followed by the influence hierarchy in compressed sparse row layout.
+ *
+ * Files are loaded through a memory mapping: the influence hierarchy can be used in place from the
+ * mapped pages, the scales of the HDI hierarchy are filled with one bulk copy per array or matrix row.
+ */
+namespace HsneCacheFile
+{
+    /** Current version of the format, files of other versions are rejected */
+    constexpr std::uint32_t version = 2;
+
+    /**
+     * Write a hierarchy to disk
+     * @param fileName Path of the cache file
+     * @param hsne HSNE hierarchy
+     * @param influenceHierarchy Influence hierarchy, one landmark map per scale
+     * @return Whether the file was written completely
+     */
+    bool save(const std::string& fileName, const Hsne& hsne, const std::vector<LandmarkMap>& influenceHierarchy);
+
+    /**
+     * Read a hierarchy from disk
+     * @param fileName Path of the cache file
+     * @param hsne Output, the scales of the hierarchy are replaced
+     * @param influenceHierarchy Output, one landmark map per scale
+     * @param borrowInfluenceHierarchy Let the landmark maps reference the mapped file instead of copying them, keeps the file mapped as long as the maps live
+     * @return Whether the file was valid and read completely
+     */
+    bool load(const std::string& fileName, Hsne& hsne, std::vector<LandmarkMap>& influenceHierarchy, bool borrowInfluenceHierarchy);
+
+    /**
+     * Write one scale to a spill file, see HsneHierarchy::spillInactiveScales(). Same section layout, without the
+     * landmark to data point indices, which stay in memory: first the influence map, then the other scale arrays and matrices.
+     * @param fileName Path of the spill file
+     * @param scale Scale of the HSNE hierarchy
+     * @param influenceMap Influence map of the scale, may be empty
+     * @return Whether the file was written completely
+     */
+    bool saveScale(const std::string& fileName, const Hsne::scale_type& scale, const LandmarkMap& influenceMap);
+
+    /**
+     * Read a scale from a spill file
+     * @param fileName Path of the spill file
+     * @param scale Output, the arrays and matrices written by saveScale() are replaced, nullptr to skip them
+     * @param influenceMap Output, references the mapped file, which stays mapped as long as the map lives, nullptr to skip it
+     * @return Whether the file was valid and read completely
+     */
+    bool loadScale(const std::string& fileName, Hsne::scale_type* scale, LandmarkMap* influenceMap);
+}
@@ -0,0 +1,312 @@
+#include "HsneCacheStore.h"
+
+#include "HsneCacheFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <system_error>
+
+#include <QLockFile>
+#include <QStandardPaths>
+#include <QString>
+#include <QUuid>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // Entries are only ever written to and evicted from this subdirectory, never from the configured directory itself
+    constexpr auto _SUBDIRECTORY_ = "hsne-cache";
+
+    constexpr auto _ENTRY_EXTENSION_ = ".hsnec";
+    constexpr auto _DESCRIPTION_SUFFIX_ = "_parameters.json";
+    constexpr auto _LOCK_FILE_NAME_ = "hsne-cache.lock";
+    constexpr auto _TEMPORARY_MARKER_ = ".tmp-";
+
+    // Wait up to this long for other processes using the cache directory
+    constexpr int _LOCK_TIMEOUT_MS_ = 30000;
+
+    // Finalizer of splitmix64
+    std::uint64_t mix(std::uint64_t h)
+    {
+        h ^= h >> 30;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 27;
+        h *= 0x94D049BB133111EBull;
+        h ^= h >> 31;
+        return h;
+    }
+
+    std::uint64_t hashBytes(const unsigned char* bytes, size_t numBytes, std::uint64_t seed)
+    {
+        std::uint64_t h = seed ^ mix(numBytes);
+
+        size_t b = 0;
+        for (; b + 8 <= numBytes; b += 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, bytes + b, 8);
+            h = mix(h ^ mix(word + seed));
+        }
+
+        std::uint64_t tail = 0;
+        std::memcpy(&tail, bytes + b, numBytes - b);
+        return mix(h ^ mix(tail + seed));
+    }
+
+    constexpr std::uint64_t _SEEDS_[2] = { 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full };
+
+    // Keys are the 32 hexadecimal digits of Key::toString()
+    bool isKey(const std::string& key)
+    {
+        return key.size() == 32 && std::all_of(key.begin(), key.end(), [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+    }
+
+    bool endsWith(const std::string& value, const std::string& suffix)
+    {
+        return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    class DirectoryLock
+    {
+    public:
+        explicit DirectoryLock(const fs::path& directory) :
+            _lockFile(QString::fromStdString((directory / _LOCK_FILE_NAME_).string()))
+        {
+            // A lock held longer than this is assumed to belong to a crashed process
+            _lockFile.setStaleLockTime(10 * 60 * 1000);
+            _locked = _lockFile.tryLock(_LOCK_TIMEOUT_MS_);
+
+            if (!_locked)
+                std::cerr << "HsneCacheStore: could not lock the cache directory " << directory.string() << std::endl;
+        }
+
+        bool isLocked() const { return _locked; }
+
+    private:
+        QLockFile   _lockFile;
+        bool        _locked = false;
+    };
+}
+
+HsneCacheStore::Key::Key() :
+    _hashes{ _SEEDS_[0], _SEEDS_[1] }
+{
+}
+
+void HsneCacheStore::Key::addBytes(const void* bytes, size_t numBytes)
+{
+    for (int i = 0; i < 2; i++)
+        _hashes[i] = hashBytes(static_cast<const unsigned char*>(bytes), numBytes, _hashes[i]);
+}
+
+void HsneCacheStore::Key::addData(const std::vector<float>& data)
+{
+    // Chunks are hashed in parallel and their hashes combined in order, independent of the number of threads
+    constexpr size_t chunkSize = size_t(1) << 20;
+    const auto numChunks = static_cast<std::int64_t>((data.size() + chunkSize - 1) / chunkSize);
+
+    std::vector<std::uint64_t> chunkHashes(2 * numChunks);
+
+#pragma omp parallel for
+    for (std::int64_t c = 0; c < numChunks; c++)
+    {
+        const size_t begin = static_cast<size_t>(c) * chunkSize;
+        const size_t count = std::min(chunkSize, data.size() - begin);
+        const auto* bytes = reinterpret_cast<const unsigned char*>(data.data() + begin);
+
+        for (int i = 0; i < 2; i++)
+            chunkHashes[2 * c + i] = hashBytes(bytes, count * sizeof(float), _SEEDS_[i]);
+    }
+
+    add(static_cast<std::uint64_t>(data.size()));
+    addBytes(chunkHashes.data(), chunkHashes.size() * sizeof(std::uint64_t));
+}
+
+void HsneCacheStore::Key::add(const std::vector<bool>& values)
+{
+    std::vector<unsigned char> bytes(values.begin(), values.end());
+
+    add(static_cast<std::uint64_t>(bytes.size()));
+    addBytes(bytes.data(), bytes.size());
+}
+
+std::string HsneCacheStore::Key::toString() const
+{
+    static const char digits[] = "0123456789abcdef";
+
+    std::string key;
+    for (const std::uint64_t hash : _hashes)
+        for (int shift = 60; shift >= 0; shift -= 4)
+            key.push_back(digits[(hash >> shift) & 0xF]);
+
+    return key;
+}
+
+HsneCacheStore::HsneCacheStore(const fs::path& directory, std::uint64_t quotaBytes) :
+    _directory(directory / _SUBDIRECTORY_),
+    _quotaBytes(quotaBytes)
+{
+}
+
+fs::path HsneCacheStore::defaultDirectory()
+{
+    return fs::path(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation).toStdString()) / "ManiVault";
+}
+
+fs::path HsneCacheStore::getEntryPath(const std::string& key) const
+{
+    return _directory / (key + _ENTRY_EXTENSION_);
+}
+
+fs::path HsneCacheStore::getDescriptionPath(const std::string& key) const
+{
+    return _directory / (key + _DESCRIPTION_SUFFIX_);
+}
+
+bool HsneCacheStore::load(const std::string& key, Hsne& hsne, std::vector<LandmarkMap>& influenceHierarchy)
+{
+    const auto entryPath = getEntryPath(key);
+
+    std::error_code error;
+    if (!fs::exists(entryPath, error))
+        return false;
+
+    // Hold the lock while mapping, such that no other process evicts the entry in the meantime
+    DirectoryLock lock(_directory);
+    if (!lock.isLocked())
+        return false;
+
+    std::cout << "HsneCacheStore: loading " << entryPath.string() << std::endl;
+
+    if (!HsneCacheFile::load(entryPath.string(), hsne, influenceHierarchy, /* borrowInfluenceHierarchy = */ true))
+    {
+        std::cerr << "HsneCacheStore: invalid entry " << entryPath.string() << std::endl;
+        return false;
+    }
+
+    // Mark as recently used
+    fs::last_write_time(entryPath, fs::file_time_type::clock::now(), error);
+
+    return true;
+}
+
+bool HsneCacheStore::store(const std::string& key, const Hsne& hsne, const std::vector<LandmarkMap>& influenceHierarchy)
+{
+    std::error_code error;
+    fs::create_directories(_directory, error);
+
+    // Write without holding the lock, other processes only ever see complete entries
+    const auto entryPath = getEntryPath(key);
+    const auto temporaryPath = fs::path(entryPath.string() + _TEMPORARY_MARKER_ + QUuid::createUuid().toString(QUuid::WithoutBraces).toStdString());
+
+    std::cout << "HsneCacheStore: writing " << entryPath.string() << std::endl;
+
+    if (!HsneCacheFile::save(temporaryPath.string(), hsne, influenceHierarchy))
+    {
+        fs::remove(temporaryPath, error);
+        return false;
+    }
+
+    DirectoryLock lock(_directory);
+    if (!lock.isLocked())
+    {
+        fs::remove(temporaryPath, error);
+        return false;
+    }
+
+    fs::rename(temporaryPath, entryPath, error);
+    if (error)
+    {
+        // E.g. another process has the same entry mapped, which then is just as good
+        std::cerr << "HsneCacheStore: could not store " << entryPath.string() << ": " << error.message() << std::endl;
+        fs::remove(temporaryPath, error);
+        return false;
+    }
+
+    evict(key);
+
+    return true;
+}
+
+void HsneCacheStore::evict(const std::string& keepKey) const
+{
+    struct Entry
+    {
+        fs::file_time_type      lastUse = fs::file_time_type::min();
+        std::uint64_t           numBytes = 0;
+        std::vector<fs::path>   files;
+    };
+
+    // Only entry files and the descriptions of entries are considered, any other file is left alone, as are unfinished writes of other processes
+    std::map<std::string, Entry> entries;
+    std::map<std::string, fs::path> descriptions;
+
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(_directory, error))
+    {
+        const std::string fileName = file.path().filename().string();
+
+        if (!file.is_regular_file(error))
+            continue;
+
+        if (endsWith(fileName, _ENTRY_EXTENSION_))
+        {
+            const std::string key = fileName.substr(0, fileName.size() - std::strlen(_ENTRY_EXTENSION_));
+            if (!isKey(key))
+                continue;
+
+            Entry& entry = entries[key];
+            entry.numBytes += file.file_size(error);
+            entry.files.push_back(file.path());
+            entry.lastUse = file.last_write_time(error);
+        }
+        else if (endsWith(fileName, _DESCRIPTION_SUFFIX_))
+        {
+            const std::string key = fileName.substr(0, fileName.size() - std::strlen(_DESCRIPTION_SUFFIX_));
+            if (isKey(key))
+                descriptions[key] = file.path();
+        }
+    }
+
+    for (const auto& [key, path] : descriptions)
+    {
+        auto entry = entries.find(key);
+        if (entry == entries.end())
+            continue;
+
+        entry->second.numBytes += fs::file_size(path, error);
+        entry->second.files.push_back(path);
+    }
+
+    std::uint64_t totalBytes = 0;
+    std::vector<std::pair<fs::file_time_type, std::string>> byLastUse;
+    for (const auto& [key, entry] : entries)
+    {
+        totalBytes += entry.numBytes;
+        if (key != keepKey)
+            byLastUse.emplace_back(entry.lastUse, key);
+    }
+
+    std::sort(byLastUse.begin(), byLastUse.end());
+
+    for (const auto& [lastUse, key] : byLastUse)
+    {
+        if (totalBytes <= _quotaBytes)
+            break;
+
+        const Entry& entry = entries[key];
+
+        bool removed = true;
+        for (const auto& path : entry.files)
+            removed &= fs::remove(path, error);
+
+        if (removed)
+        {
+            std::cout << "HsneCacheStore: evicted " << key << std::endl;
+            totalBytes -= entry.numBytes;
+        }
+    }
+}
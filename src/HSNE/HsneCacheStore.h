@@ -0,0 +1,90 @@
+#pragma once
+
+#include "HsneHierarchy.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * HsneCacheStore
+ *
+ * Central directory of cached HSNE hierarchies, shared by all data sets and ManiVault instances.
+ *
+ * Entries are keyed by a hash of everything the hierarchy depends on: the input values, the enabled
+ * dimensions and the HSNE parameters. Renamed or reloaded data sets thus hit the cache, while changed
+ * data never does. Every use of an entry refreshes its time stamp, and storing an entry evicts the
+ * least recently used entries until the directory fits the disk quota. A lock file serializes access
+ * of several processes to the directory.
+ */
+class HsneCacheStore
+{
+public:
+    /**
+     * Incremental 128-bit hash of the inputs of a hierarchy
+     */
+    class Key
+    {
+    public:
+        Key();
+
+        /** Hash the point values, in parallel over chunks */
+        void addData(const std::vector<float>& data);
+
+        void addBytes(const void* bytes, size_t numBytes);
+
+        template<typename T>
+        void add(const T& value)
+        {
+            static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>, "Only plain values can be hashed");
+            addBytes(&value, sizeof(T));
+        }
+
+        void add(const std::vector<bool>& values);
+
+        /** Hexadecimal representation, used as file name */
+        std::string toString() const;
+
+    private:
+        std::uint64_t   _hashes[2];     /** Two independently seeded 64-bit hashes */
+    };
+
+public:
+    /**
+     * @param directory Cache directory, the entries are kept in its own subdirectory which is created when needed
+     * @param quotaBytes Maximum size of all entries on disk
+     */
+    HsneCacheStore(const std::filesystem::path& directory, std::uint64_t quotaBytes);
+
+    /** Default cache directory in the user's cache location */
+    static std::filesystem::path defaultDirectory();
+
+    const std::filesystem::path& getDirectory() const { return _directory; }
+
+    /** Path of the file with a description of the parameters of an entry */
+    std::filesystem::path getDescriptionPath(const std::string& key) const;
+
+    /**
+     * Load an entry, the influence hierarchy is used in place from the mapped cache file
+     * @return Whether the entry exists and was valid
+     */
+    bool load(const std::string& key, Hsne& hsne, std::vector<LandmarkMap>& influenceHierarchy);
+
+    /**
+     * Store an entry and evict the least recently used entries exceeding the quota
+     * @return Whether the entry was stored
+     */
+    bool store(const std::string& key, const Hsne& hsne, const std::vector<LandmarkMap>& influenceHierarchy);
+
+private:
+    std::filesystem::path getEntryPath(const std::string& key) const;
+
+    /** Remove least recently used entries until all entries fit the quota, never removes keepKey. Call while holding the lock. */
+    void evict(const std::string& keepKey) const;
+
+private:
+    std::filesystem::path   _directory;     /** Subdirectory of the entries in the cache directory */
+    std::uint64_t           _quotaBytes;    /** Maximum size of all entries */
+};
@@ -1,27 +1,35 @@
 #include "HsneHierarchy.h"
 
+#include "HsneCacheFile.h"
+#include "HsneCacheStore.h"
 #include "HsneParameters.h"
+#include "KnnGraphFile.h"
 #include "KnnParameters.h"
-
-#include "DataHierarchyItem.h"
-#include "ImageData/Images.h"
+#include "RandomWalkEngine.h"
+#include "SimilarityUtils.h"
 
 #include "hdi/utils/cout_log.h"
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <numeric>
+#include <utility>
 
 #include "nlohmann/json.hpp"
 
-#include <QFileInfo>
+#include <QDir>
 #include <QString>
 
-// set suffix strings for cache
-constexpr auto _CACHE_SUBFOLDER_ = "hsne-cache";
-constexpr auto _HIERARCHY_CACHE_EXTENSION_ = "_hierarchy.hsne";
-constexpr auto _INFLUENCE_TOPDOWN_CACHE_EXTENSION_ = "_influence-tp-hierarchy.hsne";
-constexpr auto _PARAMETERS_CACHE_EXTENSION_ = "_parameters.hsne";
-constexpr auto _PARAMETERS_CACHE_VERSION_ = "1.0";
+// Part of every cache key, change when the hierarchy computation changes in a way that invalidates cached hierarchies
+constexpr auto _PARAMETERS_CACHE_VERSION_ = "3.0";
+
+// Area of influence walks of RandomWalkEngine that do not reach a landmark within this number of steps are discarded
+constexpr std::uint32_t _MAX_INFLUENCE_WALK_LENGTH_ = 100;
 
 namespace
 {
@@ -46,30 +54,88 @@ namespace
         params._num_neighbors = parameters.getNumNearestNeighbors();
         return params;
     }
+
+    template<typename T>
+    std::uint64_t heapBytes(const std::vector<T>& values)
+    {
+        return values.capacity() * sizeof(T);
+    }
+
+    std::uint64_t heapBytes(const HsneMatrix& matrix)
+    {
+        std::uint64_t numBytes = heapBytes<hdi::data::MapMemEff<uint32_t, float>>(matrix);
+        for (const auto& row : matrix)
+            numBytes += heapBytes(row.memory());
+        return numBytes;
+    }
 }
 
-/**
- * Compute for every scale except the bottom scale, which landmark influences which bottom scale point
- */
-void InfluenceHierarchy::initialize(HsneHierarchy& hierarchy)
+bool InfluenceHierarchy::initialize(HsneHierarchy& hierarchy, bool sparseProducts, int firstScale)
 {
-    _influenceMap.resize(hierarchy.getNumScales());
+    const int numScales = hierarchy.getNumScales();
+
+    // Keep the maps of the existing scales
+    firstScale = std::max(firstScale, 1);
+    _influenceMap.resize(numScales);
+    for (int scale = firstScale; scale < numScales; scale++)
+        _influenceMap[scale].clear();
+
+    int numDataPoints = hierarchy.getScale(0).size();
+
+    // Top influencing landmark per scale and data point, -1 if none was found. Empty for the scales whose map is kept.
+    std::vector<std::vector<int>> topLandmarks(numScales);
+    for (int scale = firstScale; scale < numScales; scale++)
+        topLandmarks[scale].resize(numDataPoints, -1);
+
+    if (sparseProducts)
+        computeTopLandmarksBySparseProducts(hierarchy, topLandmarks);
+    else
+        computeTopLandmarksPerDataPoint(hierarchy, topLandmarks);
+
+    if (hierarchy.isCancelRequested())
+        return false;
 
-    // For every scale except the bottom scale resize the landmark map to the number of landmarks
-    for (int scale = 1; scale < hierarchy.getNumScales(); scale++)
+    // Count-then-scatter per scale into flat arrays: visiting the data points in order gives every landmark a sorted list, regardless of the number of threads
+#pragma omp parallel for
+    for (int scale = firstScale; scale < numScales; scale++)
     {
-        int numLandmarks = hierarchy.getScale(scale).size();
+        const int numLandmarks = hierarchy.getScale(scale).size();
+        const auto& scaleTopLandmarks = topLandmarks[scale];
+
+        std::vector<std::uint64_t> offsets(numLandmarks + 1, 0);
+        for (const int landmark : scaleTopLandmarks)
+            if (landmark >= 0)
+                offsets[landmark + 1]++;
+
+        for (int landmark = 0; landmark < numLandmarks; landmark++)
+            offsets[landmark + 1] += offsets[landmark];
+
+        std::vector<unsigned int> indices(offsets.back());
+        std::vector<std::uint64_t> insertPos(offsets.begin(), offsets.end() - 1);
 
-        _influenceMap[scale].resize(numLandmarks);
+        for (int i = 0; i < numDataPoints; i++)
+            if (scaleTopLandmarks[i] >= 0)
+                indices[insertPos[scaleTopLandmarks[i]]++] = i;
+
+        _influenceMap[scale] = LandmarkMap(std::move(offsets), std::move(indices));
     }
 
-    auto& bottomScale = hierarchy.getScale(0);
+    return true;
+}
 
-    int numDataPoints = bottomScale.size();
+void InfluenceHierarchy::computeTopLandmarksPerDataPoint(HsneHierarchy& hierarchy, std::vector<std::vector<int>>& topLandmarks) const
+{
+    const int numScales = hierarchy.getNumScales();
+    const int numDataPoints = hierarchy.getScale(0).size();
 
-#pragma omp parallel for
+    // Every iteration only writes its own entries, so no synchronization is needed
+#pragma omp parallel for schedule(dynamic, 256)
     for (int i = 0; i < numDataPoints; i++)
     {
+        // The remaining points are skipped once the hierarchy is cancelled
+        if (hierarchy.isCancelRequested())
+            continue;
+
         std::vector<std::unordered_map<unsigned int, float>> influence;
 
         float thresh = 0.01f;
@@ -83,9 +149,9 @@ void InfluenceHierarchy::initialize(HsneHierarchy& hierarchy)
             redo = 0;
             if (tries++ < 3)
             {
-                for (int scale = 1; scale < hierarchy.getNumScales(); scale++)
+                for (int scale = 1; scale < numScales; scale++)
                 {
-                    if (influence[scale].size() < 1)
+                    if (!topLandmarks[scale].empty() && influence[scale].size() < 1)
                     {
                         redo = scale;
                     }
@@ -100,14 +166,18 @@ void InfluenceHierarchy::initialize(HsneHierarchy& hierarchy)
         }
         //////
 
-        for (int scale = 1; scale < hierarchy.getNumScales(); scale++)
+        for (int scale = 1; scale < numScales; scale++)
         {
+            if (topLandmarks[scale].empty())
+                continue;
+
             float maxInfluence = 0;
             int topInfluencingLandmark = -1;
 
+            // Ties go to the lowest landmark index, independent of the hash map iteration order
             for (auto& landmark : influence[scale])
             {
-                if (landmark.second >= maxInfluence)
+                if (landmark.second > maxInfluence || (landmark.second == maxInfluence && (topInfluencingLandmark == -1 || static_cast<int>(landmark.first) < topInfluencingLandmark)))
                 {
                     maxInfluence = landmark.second;
                     topInfluencingLandmark = landmark.first;
@@ -120,14 +190,579 @@ void InfluenceHierarchy::initialize(HsneHierarchy& hierarchy)
                 continue;
             }
 
-            #pragma omp critical
+            topLandmarks[scale][i] = topInfluencingLandmark;
+        }
+    }
+}
+
+void InfluenceHierarchy::computeTopLandmarksBySparseProducts(const HsneHierarchy& hierarchy, std::vector<std::vector<int>>& topLandmarks) const
+{
+    const int numScales = hierarchy.getNumScales();
+    const int numDataPoints = hierarchy.getScale(0).size();
+
+    // Same relative threshold as the first per-point query, the strongest entry of a row is always kept instead of retrying
+    constexpr float thresh = 0.01f;
+
+    // Rows are computed in blocks, every block collects its own compressed rows which are concatenated afterwards
+    constexpr int blockSize = 4096;
+    const int numBlocks = (numDataPoints + blockSize - 1) / blockSize;
+
+    struct SparseRows
+    {
+        std::vector<std::uint64_t>  offsets = { 0 };
+        std::vector<uint32_t>       columns;
+        std::vector<float>          values;
+    };
+
+    // Influence of the landmarks of the previous scale on every data point: row i of the chained product AoI_1 * ... * AoI_(scale - 1)
+    SparseRows influence;
+
+    for (int scale = 1; scale < numScales; scale++)
+    {
+        if (hierarchy.isCancelRequested())
+            return;
+
+        const auto& areaOfInfluence = hierarchy.getScale(scale)._area_of_influence;
+        const auto numLandmarks = hierarchy.getScale(scale).size();
+        const bool keepRows = scale + 1 < numScales;
+
+        auto& scaleTopLandmarks = topLandmarks[scale];
+        std::vector<SparseRows> blocks(numBlocks);
+
+#pragma omp parallel
+        {
+            // Dense accumulator over the landmarks of this scale, only the touched entries are visited and reset
+            std::vector<float> accumulator(numLandmarks, 0.f);
+            std::vector<char> isTouched(numLandmarks, 0);
+            std::vector<uint32_t> touched;
+
+            const auto accumulate = [&](uint32_t previousIndex, float weight) {
+                for (const auto& entry : areaOfInfluence[previousIndex])
+                {
+                    if (!isTouched[entry.first])
+                    {
+                        isTouched[entry.first] = 1;
+                        touched.push_back(entry.first);
+                    }
+                    accumulator[entry.first] += weight * entry.second;
+                }
+            };
+
+#pragma omp for schedule(dynamic, 1)
+            for (int b = 0; b < numBlocks; b++)
             {
-                _influenceMap[scale][topInfluencingLandmark].push_back(i);
+                SparseRows& block = blocks[b];
+                const int rowEnd = std::min(numDataPoints, (b + 1) * blockSize);
+
+                for (int i = b * blockSize; i < rowEnd; i++)
+                {
+                    touched.clear();
+
+                    if (scale == 1)
+                        accumulate(i, 1.f);
+                    else
+                        for (auto k = influence.offsets[i]; k < influence.offsets[i + 1]; k++)
+                            accumulate(influence.columns[k], influence.values[k]);
+
+                    std::sort(touched.begin(), touched.end());
+
+                    // Ties go to the lowest landmark index
+                    float sum = 0;
+                    int topInfluencingLandmark = -1;
+                    for (const uint32_t landmark : touched)
+                    {
+                        sum += accumulator[landmark];
+                        if (topInfluencingLandmark == -1 || accumulator[landmark] > accumulator[topInfluencingLandmark])
+                            topInfluencingLandmark = landmark;
+                    }
+
+                    if (!scaleTopLandmarks.empty())
+                        scaleTopLandmarks[i] = sum > 0 ? topInfluencingLandmark : -1;
+
+                    for (const uint32_t landmark : touched)
+                    {
+                        const float value = sum > 0 ? accumulator[landmark] / sum : 0.f;
+
+                        if (keepRows && value > 0 && (value >= thresh || static_cast<int>(landmark) == topInfluencingLandmark))
+                        {
+                            block.columns.push_back(landmark);
+                            block.values.push_back(value);
+                        }
+
+                        accumulator[landmark] = 0.f;
+                        isTouched[landmark] = 0;
+                    }
+
+                    if (keepRows)
+                        block.offsets.push_back(block.columns.size());
+                }
             }
         }
+
+        for (int i = 0; i < static_cast<int>(scaleTopLandmarks.size()); i++)
+            if (scaleTopLandmarks[i] == -1)
+                std::cerr << "Failed to find landmark for point " << i << " at scale " << scale << std::endl;
+
+        if (!keepRows)
+            break;
+
+        // Concatenate the blocks into the rows for the next scale
+        SparseRows nextInfluence;
+        nextInfluence.offsets.resize(static_cast<size_t>(numDataPoints) + 1);
+
+        std::vector<std::uint64_t> blockStarts(numBlocks + 1, 0);
+        for (int b = 0; b < numBlocks; b++)
+            blockStarts[b + 1] = blockStarts[b] + blocks[b].columns.size();
+
+        nextInfluence.columns.resize(blockStarts.back());
+        nextInfluence.values.resize(blockStarts.back());
+
+#pragma omp parallel for
+        for (int b = 0; b < numBlocks; b++)
+        {
+            const SparseRows& block = blocks[b];
+            const auto rowBegin = static_cast<size_t>(b) * blockSize;
+
+            for (size_t r = 1; r < block.offsets.size(); r++)
+                nextInfluence.offsets[rowBegin + r] = blockStarts[b] + block.offsets[r];
+
+            std::copy(block.columns.begin(), block.columns.end(), nextInfluence.columns.begin() + blockStarts[b]);
+            std::copy(block.values.begin(), block.values.end(), nextInfluence.values.begin() + blockStarts[b]);
+        }
+
+        influence = std::move(nextInfluence);
     }
 }
 
+HsneHierarchy::~HsneHierarchy()
+{
+    // Unmap the spill files before their directory is removed
+    _influenceHierarchy.getMap().clear();
+}
+
+void HsneHierarchy::getTransitionMatrixForSelection(int currentScale, HsneMatrix& transitionMatrix, const std::vector<uint32_t>& landmarkIdxs)
+{
+    std::vector<HsneMatrix> transitionMatrices;
+    getTransitionMatricesForSelections(currentScale, transitionMatrices, { landmarkIdxs });
+
+    transitionMatrix = std::move(transitionMatrices.front());
+}
+
+void HsneHierarchy::getTransitionMatricesForSelections(int currentScale, std::vector<HsneMatrix>& transitionMatrices, const std::vector<std::vector<uint32_t>>& selections)
+{
+    // Get full transition matrix of the previous scale
+    const int scale = currentScale - 1;
+    const HsneMatrix& fullTransitionMatrix = getScale(scale)._transition_matrix;
+
+    std::vector<int>& selectionIndices = getSelectionLookup(scale);
+
+    // The selections are concatenated, the lookup holds the position of every selected landmark in the concatenation
+    const size_t numSelections = selections.size();
+    std::vector<std::int64_t> selectionOffsets(numSelections + 1, 0);
+    std::vector<char> sortedSelections(numSelections);
+
+    bool overlapping = false;
+
+    transitionMatrices.clear();
+    transitionMatrices.resize(numSelections);
+
+    for (size_t s = 0; s < numSelections; s++)
+    {
+        selectionOffsets[s + 1] = selectionOffsets[s] + static_cast<std::int64_t>(selections[s].size());
+
+        for (size_t i = 0; i < selections[s].size(); i++)
+        {
+            int& position = selectionIndices[selections[s][i]];
+            overlapping |= position >= 0 && position < selectionOffsets[s];
+            position = static_cast<int>(selectionOffsets[s] + i);
+        }
+
+        // Rows stay sorted by column when the selection is sorted, as the lookup preserves the order
+        sortedSelections[s] = std::is_sorted(selections[s].begin(), selections[s].end());
+
+        transitionMatrices[s].resize(selections[s].size());
+    }
+
+    // Landmarks in several selections have a single position, extract such selections one by one
+    if (overlapping)
+    {
+        for (const auto& selection : selections)
+            for (const uint32_t landmark : selection)
+                selectionIndices[landmark] = -1;
+
+        for (size_t s = 0; s < numSelections; s++)
+            getTransitionMatrixForSelection(currentScale, transitionMatrices[s], selections[s]);
+
+        return;
+    }
+
+    const std::int64_t numSelected = selectionOffsets.back();
+
+    // One sweep over the rows of all selections, a column belongs to the selection of the row if its position falls in the range of that selection
+#pragma omp parallel for schedule(dynamic, 256)
+    for (std::int64_t p = 0; p < numSelected; p++)
+    {
+        const auto s = static_cast<size_t>(std::upper_bound(selectionOffsets.begin(), selectionOffsets.end(), p) - selectionOffsets.begin() - 1);
+        const std::int64_t begin = selectionOffsets[s];
+        const std::int64_t end = selectionOffsets[s + 1];
+
+        auto& row = transitionMatrices[s][p - begin].memory();
+
+        for (const auto& entry : fullTransitionMatrix[selections[s][p - begin]])
+        {
+            const int position = selectionIndices[entry.first];
+            if (position >= begin && position < end)
+                row.emplace_back(static_cast<uint32_t>(position - begin), entry.second);
+        }
+
+        if (!sortedSelections[s])
+            std::sort(row.begin(), row.end());
+    }
+
+    for (const auto& selection : selections)
+        for (const uint32_t landmark : selection)
+            selectionIndices[landmark] = -1;
+}
+
+size_t HsneHierarchy::getInfluencedLandmarksInPreviousScale(int currentScale, const std::vector<unsigned int>& indices, float threshold, std::vector<uint32_t>& influencedLandmarks)
+{
+    std::vector<std::vector<uint32_t>> influencedPerSelection;
+    const auto numInfluenced = getInfluencedLandmarksInPreviousScale(currentScale, { indices }, threshold, influencedPerSelection);
+
+    influencedLandmarks = std::move(influencedPerSelection.front());
+
+    return numInfluenced.front();
+}
+
+std::vector<size_t> HsneHierarchy::getInfluencedLandmarksInPreviousScale(int currentScale, const std::vector<std::vector<unsigned int>>& selections, float threshold, std::vector<std::vector<uint32_t>>& influencedLandmarks)
+{
+    const auto& areaOfInfluence = getScale(currentScale)._area_of_influence;
+    const LandmarkMap& influencedPoints = getTransposedAreaOfInfluence(currentScale);
+    std::vector<int>& selectionIndices = getSelectionLookup(currentScale);
+
+    // The lookup holds the selection of every selected landmark
+    const auto numSelections = static_cast<int>(selections.size());
+    std::vector<unsigned int> selected;
+    bool overlapping = false;
+
+    for (int s = 0; s < numSelections; s++)
+    {
+        for (const unsigned int landmark : selections[s])
+        {
+            overlapping |= selectionIndices[landmark] >= 0 && selectionIndices[landmark] != s;
+            selectionIndices[landmark] = s;
+        }
+
+        selected.insert(selected.end(), selections[s].begin(), selections[s].end());
+    }
+
+    std::vector<size_t> numInfluenced(numSelections, 0);
+    influencedLandmarks.assign(numSelections, {});
+
+    // Landmarks in several selections have a single entry in the lookup, query such selections one by one
+    if (overlapping)
+    {
+        for (const auto& selection : selections)
+            for (const unsigned int landmark : selection)
+                selectionIndices[landmark] = -1;
+
+        for (int s = 0; s < numSelections; s++)
+            numInfluenced[s] = getInfluencedLandmarksInPreviousScale(currentScale, selections[s], threshold, influencedLandmarks[s]);
+
+        return numInfluenced;
+    }
+
+    const auto numSelected = static_cast<std::int64_t>(selected.size());
+
+    // Collect the previous scale points influenced by any selected landmark, per block of selected landmarks
+    constexpr std::int64_t blockSize = 1024;
+    const std::int64_t numBlocks = (numSelected + blockSize - 1) / blockSize;
+    std::vector<std::vector<uint32_t>> blockPoints(numBlocks);
+
+#pragma omp parallel for
+    for (std::int64_t b = 0; b < numBlocks; b++)
+    {
+        const std::int64_t end = std::min(numSelected, (b + 1) * blockSize);
+        for (std::int64_t i = b * blockSize; i < end; i++)
+        {
+            const auto points = influencedPoints[selected[i]];
+            blockPoints[b].insert(blockPoints[b].end(), points.begin(), points.end());
+        }
+    }
+
+    std::vector<uint32_t> touched;
+    for (const auto& points : blockPoints)
+        touched.insert(touched.end(), points.begin(), points.end());
+
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+    // Sum the influence of every selection per touched point in row order, like HDI, which keeps the result deterministic
+    struct Influence
+    {
+        int         selection;
+        uint32_t    point;
+        float       influence;
+    };
+
+    const auto numTouched = static_cast<std::int64_t>(touched.size());
+    const std::int64_t numTouchedBlocks = (numTouched + blockSize - 1) / blockSize;
+    std::vector<std::vector<Influence>> blockInfluences(numTouchedBlocks);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (std::int64_t b = 0; b < numTouchedBlocks; b++)
+    {
+        // A point is influenced by few landmarks, and thus few selections
+        std::vector<std::pair<int, double>> probabilities;
+
+        const std::int64_t end = std::min(numTouched, (b + 1) * blockSize);
+        for (std::int64_t k = b * blockSize; k < end; k++)
+        {
+            probabilities.clear();
+
+            for (const auto& entry : areaOfInfluence[touched[k]])
+            {
+                const int s = selectionIndices[entry.first];
+                if (s < 0)
+                    continue;
+
+                auto it = std::find_if(probabilities.begin(), probabilities.end(), [s](const auto& probability) { return probability.first == s; });
+                if (it == probabilities.end())
+                    probabilities.emplace_back(s, entry.second);
+                else
+                    it->second += entry.second;
+            }
+
+            for (const auto& [s, probability] : probabilities)
+                blockInfluences[b].push_back({ s, touched[k], static_cast<float>(probability) });
+        }
+    }
+
+    for (const auto& selection : selections)
+        for (const unsigned int landmark : selection)
+            selectionIndices[landmark] = -1;
+
+    // Blocks and points within a block are in index order, which keeps the landmarks of every selection sorted
+    for (const auto& influences : blockInfluences)
+    {
+        for (const Influence& influence : influences)
+        {
+            if (influence.influence > 0)
+                numInfluenced[influence.selection]++;
+
+            if (influence.influence > threshold)
+                influencedLandmarks[influence.selection].push_back(influence.point);
+        }
+    }
+
+    return numInfluenced;
+}
+
+void HsneHierarchy::getSelectionMapping(int scale, const std::vector<uint32_t>& landmarks, const std::vector<unsigned int>& keys, mv::SelectionMap& mapping) const
+{
+    assert(landmarks.size() == keys.size());
+
+    const LandmarkMap& landmarkMap = _influenceHierarchy.getMap()[scale];
+    const auto numLandmarks = static_cast<std::int64_t>(landmarks.size());
+
+    // Point lists are written once, in global indices, and moved into the mapping afterwards
+    std::vector<std::vector<unsigned int>> points(numLandmarks);
+
+#pragma omp parallel for schedule(dynamic, 256)
+    for (std::int64_t i = 0; i < numLandmarks; i++)
+    {
+        const auto landmarkPoints = landmarkMap[landmarks[i]];
+
+        std::vector<unsigned int>& globalPoints = points[i];
+        globalPoints.reserve(landmarkPoints.size());
+        for (const unsigned int point : landmarkPoints)
+            globalPoints.push_back(getGlobalIndex(point));
+    }
+
+    auto& selectionMap = mapping.getMap();
+    for (std::int64_t i = 0; i < numLandmarks; i++)
+        selectionMap[keys[i]] = std::move(points[i]);
+}
+
+std::vector<int>& HsneHierarchy::getSelectionLookup(int scale)
+{
+    // Dense lookup table, allocated once per scale and only touched at the selected landmarks afterwards
+    if (_selectionLookup.size() < _hsne->hierarchy().size())
+        _selectionLookup.resize(_hsne->hierarchy().size());
+
+    std::vector<int>& selectionIndices = _selectionLookup[scale];
+    if (selectionIndices.size() != _hsne->scale(scale).size())
+        selectionIndices.assign(_hsne->scale(scale).size(), -1);
+
+    return selectionIndices;
+}
+
+const LandmarkMap& HsneHierarchy::getTransposedAreaOfInfluence(int scale)
+{
+    if (_transposedAreaOfInfluence.size() < _hsne->hierarchy().size())
+        _transposedAreaOfInfluence.resize(_hsne->hierarchy().size());
+
+    LandmarkMap& influencedPoints = _transposedAreaOfInfluence[scale];
+    if (influencedPoints.size() == _hsne->scale(scale).size())
+        return influencedPoints;
+
+    const auto& areaOfInfluence = getScale(scale)._area_of_influence;
+    const size_t numLandmarks = _hsne->scale(scale).size();
+
+    // Count-then-scatter, visiting the previous scale points in order keeps the points of every landmark sorted
+    std::vector<std::uint64_t> offsets(numLandmarks + 1, 0);
+    for (const auto& row : areaOfInfluence)
+        for (const auto& entry : row)
+            offsets[entry.first + 1]++;
+
+    for (size_t landmark = 0; landmark < numLandmarks; landmark++)
+        offsets[landmark + 1] += offsets[landmark];
+
+    std::vector<unsigned int> points(offsets.back());
+    std::vector<std::uint64_t> insertPos(offsets.begin(), offsets.end() - 1);
+
+    for (size_t point = 0; point < areaOfInfluence.size(); point++)
+        for (const auto& entry : areaOfInfluence[point])
+            points[insertPos[entry.first]++] = static_cast<unsigned int>(point);
+
+    influencedPoints = LandmarkMap(std::move(offsets), std::move(points));
+
+    return influencedPoints;
+}
+
+void HsneHierarchy::retainScale(int scale)
+{
+    if (scale >= static_cast<int>(_retainedScales.size()))
+        _retainedScales.resize(scale + 1, 0);
+
+    _retainedScales[scale]++;
+}
+
+void HsneHierarchy::releaseScale(int scale)
+{
+    if (scale < static_cast<int>(_retainedScales.size()) && _retainedScales[scale] > 0)
+        _retainedScales[scale]--;
+}
+
+void HsneHierarchy::setSpillInactiveScales(bool spill)
+{
+    _spillInactiveScales = spill;
+
+    if (spill)
+        spillInactiveScales();
+    else
+        restoreSpilledScales();
+}
+
+void HsneHierarchy::spillInactiveScales()
+{
+    if (!_spillInactiveScales || !_isInit || !_hsne)
+        return;
+
+    if (!_spillDirectory)
+    {
+        _spillDirectory = std::make_unique<QTemporaryDir>(QDir(QDir::tempPath()).filePath("hsne-spill-XXXXXX"));
+
+        if (!_spillDirectory->isValid())
+        {
+            std::cerr << "HsneHierarchy::spillInactiveScales(): spill directory could not be created: " << _spillDirectory->errorString().toStdString() << std::endl;
+            _spillDirectory.reset();
+            return;
+        }
+    }
+
+    const int numScales = static_cast<int>(_hsne->hierarchy().size());
+    _spilledScales.resize(numScales);
+
+    auto& influenceMaps = _influenceHierarchy.getMap();
+
+    std::uint64_t releasedBytes = 0;
+    int numSpilled = 0;
+
+    for (int scale = 0; scale < numScales; scale++)
+    {
+        SpilledScale& spilledScale = _spilledScales[scale];
+
+        // The top scale is displayed and its transition matrix may be borrowed by the top level embedding
+        const bool retained = scale == getTopScale() || (scale < static_cast<int>(_retainedScales.size()) && _retainedScales[scale] > 0);
+        if (retained || spilledScale.released)
+            continue;
+
+        auto& hsneScale = _hsne->scale(scale);
+
+        // Scales do not change after construction, the file of an earlier spill is still valid
+        if (spilledScale.fileName.empty())
+        {
+            const std::string fileName = QDir(_spillDirectory->path()).filePath(QString("scale%1.hsnes").arg(scale)).toStdString();
+            const bool hasInfluenceMap = scale < static_cast<int>(influenceMaps.size());
+
+            if (!HsneCacheFile::saveScale(fileName, hsneScale, hasInfluenceMap ? influenceMaps[scale] : LandmarkMap()))
+                continue;
+
+            spilledScale.fileName = fileName;
+
+            // Serve the influence map from the mapped file, its pages can be dropped by the OS instead of being swapped
+            if (hasInfluenceMap)
+                HsneCacheFile::loadScale(fileName, nullptr, &influenceMaps[scale]);
+        }
+
+        releasedBytes += heapBytes(hsneScale._landmark_to_previous_scale_idx) + heapBytes(hsneScale._previous_scale_to_landmark_idx) + heapBytes(hsneScale._landmark_weight);
+        releasedBytes += heapBytes(hsneScale._transition_matrix) + heapBytes(hsneScale._area_of_influence);
+
+        // Swapping with empty containers frees their memory, clear() would keep it
+        decltype(hsneScale._landmark_to_previous_scale_idx)().swap(hsneScale._landmark_to_previous_scale_idx);
+        decltype(hsneScale._previous_scale_to_landmark_idx)().swap(hsneScale._previous_scale_to_landmark_idx);
+        decltype(hsneScale._landmark_weight)().swap(hsneScale._landmark_weight);
+        HsneMatrix().swap(hsneScale._transition_matrix);
+        HsneMatrix().swap(hsneScale._area_of_influence);
+
+        // Refinement lookups are rebuilt on first use
+        if (scale < static_cast<int>(_transposedAreaOfInfluence.size()))
+            _transposedAreaOfInfluence[scale] = LandmarkMap();
+        if (scale < static_cast<int>(_selectionLookup.size()))
+            std::vector<int>().swap(_selectionLookup[scale]);
+
+        spilledScale.released = true;
+        numSpilled++;
+    }
+
+    if (numSpilled > 0)
+        std::cout << "Spilled " << numSpilled << " inactive HSNE scales, released " << releasedBytes / (1 << 20) << " MB of scale matrices" << std::endl;
+}
+
+void HsneHierarchy::restoreSpilledScales()
+{
+    auto& influenceMaps = _influenceHierarchy.getMap();
+
+    for (int scale = 0; scale < static_cast<int>(_spilledScales.size()); scale++)
+    {
+        reloadScale(scale);
+
+        // Copy the influence map out of the spill file before it is removed
+        if (!_spilledScales[scale].fileName.empty() && scale < static_cast<int>(influenceMaps.size()))
+            influenceMaps[scale].detach();
+    }
+
+    _spilledScales.clear();
+    _spillDirectory.reset();
+}
+
+void HsneHierarchy::reloadScale(int scale) const
+{
+    if (scale >= static_cast<int>(_spilledScales.size()) || !_spilledScales[scale].released)
+        return;
+
+    SpilledScale& spilledScale = _spilledScales[scale];
+
+    if (!HsneCacheFile::loadScale(spilledScale.fileName, &_hsne->scale(scale), nullptr))
+    {
+        std::cerr << "HsneHierarchy::reloadScale(): scale " << scale << " could not be read from " << spilledScale.fileName << std::endl;
+        return;
+    }
+
+    spilledScale.released = false;
+}
+
 void HsneHierarchy::printScaleInfo() const
 {
     std::cout << "Landmark to Orig size: " << _hsne->scale(getNumScales() - 1)._landmark_to_original_data_idx.size() << std::endl;
@@ -155,37 +790,40 @@ void HsneHierarchy::setDataAndParameters(const mv::Dataset<Points>& inputData, c
     _numScales = parameters.getNumScales();
     _numPoints = _inputData->getNumPoints();
     _numDimensions = numEnabledDimensions;
+    _exactKnn = knnParameters.useExactKnn(numEnabledDimensions);
+    _knnGraphFile = parameters.getKnnGraphFile();
+    _sparseInfluence = parameters.useSparseInfluencePropagation();
+    _randomWalkEngine = parameters.useRandomWalkEngine();
 
-    // Check for source data file path
-    std::string inputLoadPath = std::string();
-    {
-        mv::Dataset<Images> inputdataImage = nullptr;
-        for (auto childHierarchyItem : _inputData->getDataHierarchyItem().getChildren()) {
+    _inputDataName = _inputData->text().toStdString();
 
-            if (childHierarchyItem->getDataType() == ImageType) {
-                inputdataImage = childHierarchyItem->getDataset();
-                break;
-            }
-        }
+    // initialize() extends or replaces the previous hierarchy, all of its scales have to be in memory
+    restoreSpilledScales();
 
-        if (inputdataImage.isValid())
-        {
-            auto imageFilePath = inputdataImage->getImageFilePaths();
-            if(!imageFilePath.isEmpty())
-                inputLoadPath = QFileInfo(imageFilePath.first()).dir().absolutePath().toStdString();
-        }
-    }
+    // A request of an earlier construction does not apply to this one
+    _cancelRequested = false;
 
-    // Set cache paths
-    if (inputLoadPath == std::string())
-        _cachePath = std::filesystem::current_path() / _CACHE_SUBFOLDER_;
-    else
-        _cachePath = std::filesystem::path(inputLoadPath) / _CACHE_SUBFOLDER_;
+    // Refinement lookups of a previous hierarchy
+    _transposedAreaOfInfluence.clear();
 
-    _inputDataName = _inputData->text().toStdString();
-    _cachePathFileName = _cachePath / _inputDataName;
+    // Translate once per analysis instead of on every refinement
+    _globalIndices.clear();
+    if (!_inputData->isFull())
+        _inputData->getGlobalIndices(_globalIndices);
+
+    // Central cache store, entries are found by content instead of data set name
+    _cacheDirectory = parameters.getCacheDirectory().empty() ? HsneCacheStore::defaultDirectory() : Path(parameters.getCacheDirectory());
+    _cacheQuotaBytes = static_cast<std::uint64_t>(parameters.getCacheQuotaGB()) << 30;
 
-    _hsne = std::make_unique<Hsne>();
+    // Keep an existing hierarchy, initialize() extends it when only the number of scales changed
+    if (!_hsne)
+        _hsne = std::make_shared<Hsne>();
+}
+
+bool HsneHierarchy::hasSelectionMapping(int scale) const
+{
+    const auto& influenceMaps = _influenceHierarchy.getMap();
+    return scale < static_cast<int>(influenceMaps.size()) && influenceMaps[scale].size() == _hsne->scale(scale).size();
 }
 
 void HsneHierarchy::initParentTask()
@@ -204,13 +842,124 @@ void HsneHierarchy::initialize()
 {
     assert(_inputData.isValid());
 
+    // The hierarchy is changed from here on, e.g. spillInactiveScales() must not touch it until it is finished
+    _isInit = false;
+
     hdi::utils::CoutLog log;
 
-    // Check of hsne data can be loaded from cache on disk, otherwise compute hsne hierarchy
-    bool hsneLoadedFromCache = loadCache(_params, log);
-    if (hsneLoadedFromCache == false) {
+    // Load data and enabled dimensions
+    std::vector<float> data;
+    std::vector<unsigned int> dimensionIndices;
+    data.resize((_inputData->isFull() ? _inputData->getNumPoints() : _inputData->indices.size()) * _numDimensions);
+    for (int i = 0; i < _inputData->getNumDimensions(); i++)
+        if (_enabledDimensions[i]) dimensionIndices.push_back(i);
+
+    _inputData->populateDataForDimensions<std::vector<float>, std::vector<unsigned int>>(data, dimensionIndices);
+
+    // A precomputed neighborhood graph replaces the kNN search, its rows are the input points
+    KnnGraph knnGraph;
+    bool useKnnGraph = false;
+    if (!_knnGraphFile.empty())
+    {
+        useKnnGraph = KnnGraphFile::load(_knnGraphFile, knnGraph);
+
+        if (useKnnGraph && knnGraph.numPoints() != _numPoints)
+        {
+            std::cerr << "HsneHierarchy::initialize(): kNN graph " << _knnGraphFile << " has " << knnGraph.numPoints() << " points, the input data " << _numPoints << std::endl;
+            useKnnGraph = false;
+        }
+
+        if (!useKnnGraph)
+        {
+            std::cerr << "HsneHierarchy::initialize(): computing the kNN graph instead" << std::endl;
+            knnGraph = KnnGraph();
+        }
+    }
+
+    // The key identifies the hierarchy independent of its number of scales
+    const std::string cacheKey = computeCacheKey(data, _params, useKnnGraph ? &knnGraph : nullptr);
+
+    // Reuse the hierarchy in memory if only the number of scales differs or scales were not finished, e.g. after cancelling.
+    // A recompute with unchanged settings builds a new hierarchy, unless it is found in the cache store.
+    bool hierarchyReused = false;
+    if (!_hierarchyKey.empty() && _hierarchyKey == cacheKey && !_hsne->hierarchy().empty())
+    {
+        const int availableScales = static_cast<int>(_hsne->hierarchy().size());
+
+        hierarchyReused = availableScales != _numScales;
+        for (int scale = 1; scale < std::min(availableScales, _numScales) && !hierarchyReused; scale++)
+            hierarchyReused = !hasSelectionMapping(scale);
+
+        if (hierarchyReused)
+            std::cout << "Reusing the HSNE hierarchy in memory with " << availableScales << " scales" << std::endl;
+    }
+
+    if (!hierarchyReused)
+    {
+        // Load into a new hierarchy, the current one may still be borrowed by an embedding
+        _hsne = std::make_shared<Hsne>();
+        hierarchyReused = loadCache(cacheKey, log);
+    }
+
+    // First scale without a landmark map, -1 if the reused hierarchy is complete
+    int firstNewScale = -1;
+
+    if (hierarchyReused) {
+        // A hierarchy with more scales than requested serves the lower scales as they are
+        const int availableScales = static_cast<int>(_hsne->hierarchy().size());
+
+        // Scales whose selection mapping was skipped by cancelling an earlier construction
+        for (int scale = 1; scale < std::min(availableScales, _numScales); scale++)
+        {
+            if (!hasSelectionMapping(scale))
+            {
+                firstNewScale = scale;
+                break;
+            }
+        }
+
+        if (availableScales < _numScales)
+        {
+            std::cout << "Adding " << _numScales - availableScales << " scales to the existing HSNE hierarchy" << std::endl;
+
+            // Adding scales may move the existing scales in memory, do not change a borrowed hierarchy
+            if (_hsne.use_count() > 1)
+                _hsne = std::make_shared<Hsne>(*_hsne);
+
+            _hsne->setLogger(&log);
+
+            if (!_hsneHasParameters)
+            {
+                // HDI only takes its parameters on initialization: initialize on the data scale of the loaded hierarchy, then put the loaded scales back
+                auto scales = std::move(_hsne->hierarchy());
+                _hsne->setDimensionality(_numDimensions);
+                _hsne->initialize(scales[0]._transition_matrix, _params);
+                _hsne->hierarchy() = std::move(scales);
+                _hsneHasParameters = true;
+            }
+
+            _parentTask->setProgress(.33f, "Adding scales");
+
+            float progressStep = .33f / (_numScales - availableScales);
+
+            for (int s = availableScales; s < _numScales; ++s) {
+                if (takeCancelRequest())
+                    break;
+
+                addScale();
+                _parentTask->setProgress(.33f + (s - availableScales + 1) * progressStep, "Adding scales");
+            }
+
+            if (firstNewScale < 0)
+                firstNewScale = availableScales;
+        }
+    }
+    else {
         std::cout << "Initializing HSNE hierarchy" << std::endl;
 
+        _hsne = std::make_shared<Hsne>();
+        _influenceHierarchy.getMap().clear();
+
         // Set up a logger
         _hsne->setLogger(&log);
 
@@ -219,109 +968,360 @@ void HsneHierarchy::initialize()
 
         _parentTask->setProgress(.1f, "Data similarities");
 
-        // Load data and enabled dimensions
-        std::vector<float> data;
-        std::vector<unsigned int> dimensionIndices;
-        data.resize((_inputData->isFull() ? _inputData->getNumPoints() : _inputData->indices.size()) * _numDimensions);
-        for (int i = 0; i < _inputData->getNumDimensions(); i++)
-            if (_enabledDimensions[i]) dimensionIndices.push_back(i);
+        // Initialize HSNE with the input data and the given parameters
+        if (useKnnGraph)
+        {
+            std::vector<float> distancesSquared;
+            std::vector<int> indices;
+            const uint32_t numNeighbors = knnGraph.toFlat(distancesSquared, indices);
+            knnGraph = KnnGraph();
 
-        _inputData->populateDataForDimensions<std::vector<float>, std::vector<unsigned int>>(data, dimensionIndices);
+            // Same perplexity as the computed neighborhoods, limited by the neighbors in the graph
+            const float perplexity = std::min<uint32_t>(_params._num_neighbors, numNeighbors) / 3.f;
 
-        // Initialize HSNE with the input data and the given parameters
-        _hsne->initialize((Hsne::scalar_type*)data.data(), _numPoints, _params);
+            Hsne::sparse_scalar_matrix_type similarities;
+            computeGaussianProbabilities(distancesSquared, indices, _numPoints, numNeighbors, perplexity, similarities);
+
+            std::cout << "Computed data-level similarities from the kNN graph " << _knnGraphFile << std::endl;
+            _hsne->initialize(similarities, _params);
+        }
+        else if (_exactKnn)
+        {
+            // Same neighborhood as HDI computes internally: num_neighbors plus the point itself, perplexity num_neighbors / 3
+            std::vector<float> distancesSquared;
+            std::vector<int> indices;
+            computeExactKnn(data.data(), _numPoints, _numDimensions, _params._num_neighbors + 1, static_cast<hdi::dr::knn_distance_metric>(_params._aknn_metric), distancesSquared, indices);
+
+            Hsne::sparse_scalar_matrix_type similarities;
+            computeGaussianProbabilities(distancesSquared, indices, _numPoints, static_cast<uint32_t>(indices.size() / _numPoints), _params._num_neighbors / 3.f, similarities);
+
+            std::cout << "Computed data-level similarities with exact kNN (VP-tree)" << std::endl;
+            _hsne->initialize(similarities, _params);
+        }
+        else
+            _hsne->initialize((Hsne::scalar_type*)data.data(), _numPoints, _params);
+
+        _hsneHasParameters = true;
 
         _parentTask->setProgress(.33f, "Adding scales");
 
         float progressStep = .33f / _numScales;
 
-        // Add a number of scales as indicated by the user
+        // Add a number of scales as indicated by the user, the first checkpoint follows the data-level similarities
         for (int s = 0; s < _numScales - 1; ++s) {
-            _hsne->addScale();
+            if (takeCancelRequest())
+                break;
+
+            addScale();
             _parentTask->setProgress(.33f + (s + 1) * progressStep, "Adding scales");
         }
 
+        firstNewScale = 1;
+    }
+
+    // A cancelled construction keeps its finished scales, the top finished scale is embedded
+    const int numFinishedScales = static_cast<int>(_hsne->hierarchy().size());
+    if (numFinishedScales < _numScales)
+    {
+        if (numFinishedScales < 2)
+        {
+            std::cout << "HSNE hierarchy construction cancelled" << std::endl;
+
+            _hsne = std::make_shared<Hsne>();
+            _influenceHierarchy.getMap().clear();
+            _hsneHasParameters = false;
+            _hierarchyKey.clear();
+            _isInit = false;
+
+            emit cancelled();
+            this->moveToThread(QCoreApplication::instance()->thread());
+            return;
+        }
+
+        std::cout << "HSNE hierarchy construction cancelled, keeping " << numFinishedScales << " of " << _numScales << " scales" << std::endl;
+        _numScales = numFinishedScales;
+
+        if (firstNewScale >= _numScales)
+            firstNewScale = -1;
+    }
+
+    // The scales are not changed anymore, the top level embedding can start while the selection mapping is computed
+    emit scalesFinished();
+
+    // Without a selection mapping the new scales can still be embedded and refined, recomputing maps them
+    if (firstNewScale >= 0 && takeCancelRequest())
+    {
+        std::cout << "Selection mapping cancelled, scales " << firstNewScale << " and above are not linked to the data" << std::endl;
+        _influenceHierarchy.getMap().resize(firstNewScale);
+        firstNewScale = -1;
+    }
+
+    if (firstNewScale >= 0)
+    {
         _parentTask->setProgress(.66f, "Selection mapping");
 
         std::cout << "Initializing influence hierarchy... " << std::endl;
-        _influenceHierarchy.initialize(*this);
+        if (!_influenceHierarchy.initialize(*this, _sparseInfluence, firstNewScale))
+        {
+            takeCancelRequest();
 
+            std::cout << "Selection mapping cancelled, scales " << firstNewScale << " and above are not linked to the data" << std::endl;
+            _influenceHierarchy.getMap().resize(firstNewScale);
+        }
         // Write HSNE hierarchy to disk
-        if(_saveHierarchyToDisk)
+        else if(_saveHierarchyToDisk)
         {
+            // Release the cache file the existing maps are borrowed from before replacing the entry
+            for (LandmarkMap& landmarkMap : _influenceHierarchy.getMap())
+                landmarkMap.detach();
+
             _parentTask->setProgress(.9f, "Save to disk");
-            saveCacheHsne(_params);
+            saveCacheHsne(cacheKey, _params);
         }
-
     }
 
+    _hierarchyKey = cacheKey;
     _isInit = true;
 
     emit finished();
     this->moveToThread(QCoreApplication::instance()->thread());
 }
 
+void HsneHierarchy::addScale()
+{
+    if (_randomWalkEngine && _params._monte_carlo_sampling)
+        addScaleByRandomWalks();
+    else
+        _hsne->addScale();
+}
 
-void HsneHierarchy::saveCacheHsne(const Hsne::Parameters& internalParams) const {
-    if (!_hsne) return; // only save if initialize() has been called
+void HsneHierarchy::addScaleByRandomWalks()
+{
+    auto& scales = _hsne->hierarchy();
+    const auto scaleIndex = static_cast<std::uint64_t>(scales.size());
+    scales.emplace_back();
 
-    if (!std::filesystem::exists(_cachePath))
-        std::filesystem::create_directory(_cachePath);
+    const Hsne::scale_type& previousScale = scales[scaleIndex - 1];
+    Hsne::scale_type& scale = scales.back();
+    const auto numPrevious = static_cast<std::int64_t>(previousScale.size());
 
-    std::cout << "HsneHierarchy::saveCacheHsne(): save cache to " + _cachePathFileName.string() << std::endl;
+    // Like HDI, a negative seed draws a new one, every scale has its own streams
+    const std::uint64_t seed = _params._seed < 0 ? static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) : static_cast<std::uint64_t>(_params._seed);
+    const RandomWalkEngine engine(previousScale._transition_matrix, (seed << 8) + scaleIndex);
 
-    saveCacheHsneHierarchy(_cachePathFileName.string() + _HIERARCHY_CACHE_EXTENSION_);
-    saveCacheHsneInfluenceHierarchy(_cachePathFileName.string() + _INFLUENCE_TOPDOWN_CACHE_EXTENSION_, _influenceHierarchy.getMap());
-    saveCacheParameters(_cachePathFileName.string() + _PARAMETERS_CACHE_EXTENSION_, internalParams);
-}
+    // Landmarks: points at which clearly more fixed-length walks end than start, i.e. with a high stationary probability
+    std::vector<std::uint32_t> endPointCounts;
+    engine.countEndPoints(_params._mcmcs_num_walks, _params._mcmcs_walk_length, endPointCounts);
 
-void HsneHierarchy::saveCacheHsneHierarchy(std::string fileName) const {
-    std::cout << "Writing " + fileName << std::endl;
+    std::vector<char> isLandmark(numPrevious, 0);
+    if (_params._hard_cut_off)
+    {
+        // Fixed fraction of the points with the most walks, ties go to the lowest index
+        std::vector<std::uint32_t> order(numPrevious);
+        std::iota(order.begin(), order.end(), 0u);
 
-    std::ofstream saveFile(fileName, std::ios::out | std::ios::binary);
+        const auto numLandmarks = std::clamp<std::int64_t>(std::llround(numPrevious * _params._hard_cut_off_percentage), 1, numPrevious);
+        std::partial_sort(order.begin(), order.begin() + numLandmarks, order.end(), [&endPointCounts](std::uint32_t a, std::uint32_t b) {
+            return endPointCounts[a] > endPointCounts[b] || (endPointCounts[a] == endPointCounts[b] && a < b);
+        });
 
-    if (!saveFile.is_open())
+        for (std::int64_t k = 0; k < numLandmarks; k++)
+            isLandmark[order[k]] = 1;
+    }
+    else
     {
-        std::cerr << "Caching failed. File could not be opened. " << std::endl;
-        return;
+        const float threshold = _params._mcmcs_num_walks * _params._mcmcs_landmark_thresh;
+        for (std::int64_t i = 0; i < numPrevious; i++)
+            isLandmark[i] = endPointCounts[i] > threshold;
+
+        // A scale needs a landmark
+        if (std::find(isLandmark.begin(), isLandmark.end(), 1) == isLandmark.end())
+            isLandmark[std::max_element(endPointCounts.begin(), endPointCounts.end()) - endPointCounts.begin()] = 1;
     }
 
-    hdi::dr::IO::saveHSNE(*_hsne, saveFile, _hsne->logger());
+    scale._previous_scale_to_landmark_idx.assign(numPrevious, -1);
+    for (std::int64_t i = 0; i < numPrevious; i++)
+    {
+        if (!isLandmark[i])
+            continue;
 
-    saveFile.close();
+        scale._previous_scale_to_landmark_idx[i] = static_cast<int>(scale._landmark_to_previous_scale_idx.size());
+        scale._landmark_to_previous_scale_idx.push_back(static_cast<std::uint32_t>(i));
+        scale._landmark_to_original_data_idx.push_back(previousScale._landmark_to_original_data_idx[i]);
+    }
 
-}
+    const auto numLandmarks = static_cast<std::int64_t>(scale._landmark_to_previous_scale_idx.size());
 
-void HsneHierarchy::saveCacheHsneInfluenceHierarchy(std::string fileName, const std::vector<LandmarkMap>& influenceHierarchy) const {
-    std::cout << "Writing " + fileName << std::endl;
+    // Area of influence: fraction of the walks from a point that reach every landmark first. Landmarks reached by fewer
+    // walks than required are dropped, the most reached landmark is always kept.
+    engine.countStops(scale._previous_scale_to_landmark_idx, _params._num_walks_per_landmark, _MAX_INFLUENCE_WALK_LENGTH_, scale._area_of_influence);
 
-    std::ofstream saveFile(fileName, std::ios::out | std::ios::binary);
+    const float minWalks = static_cast<float>(_params._transition_matrix_prune_thresh);
 
-    if (!saveFile.is_open())
+#pragma omp parallel for schedule(dynamic, 256)
+    for (std::int64_t i = 0; i < numPrevious; i++)
     {
-        std::cerr << "Caching failed. File could not be opened. " << std::endl;
-        return;
+        auto& row = scale._area_of_influence[i].memory();
+        if (row.empty())
+            continue;
+
+        const float maxWalks = std::max_element(row.begin(), row.end(), [](const auto& a, const auto& b) { return a.second < b.second; })->second;
+        row.erase(std::remove_if(row.begin(), row.end(), [minWalks, maxWalks](const auto& entry) { return entry.second < minWalks && entry.second < maxWalks; }), row.end());
+
+        float sum = 0.f;
+        for (const auto& entry : row)
+            sum += entry.second;
+        for (auto& entry : row)
+            entry.second /= sum;
     }
 
-    size_t iSize = influenceHierarchy.size();
+    // Points influenced by every landmark in point order, count-then-scatter as for the influence hierarchy
+    std::vector<std::uint64_t> offsets(numLandmarks + 1, 0);
+    for (std::int64_t i = 0; i < numPrevious; i++)
+        for (const auto& entry : scale._area_of_influence[i])
+            offsets[entry.first + 1]++;
 
-    saveFile.write((const char*)&iSize, sizeof(decltype(iSize)));
-    for (size_t i = 0; i < iSize; i++)
+    for (std::int64_t landmark = 0; landmark < numLandmarks; landmark++)
+        offsets[landmark + 1] += offsets[landmark];
+
+    std::vector<std::pair<std::uint32_t, float>> influencedPoints(offsets.back());
     {
-        size_t jSize = influenceHierarchy[i].size();
-        saveFile.write((const char*)&jSize, sizeof(decltype(jSize)));
-        for (size_t j = 0; j < jSize; j++)
+        std::vector<std::uint64_t> insertPos(offsets.begin(), offsets.end() - 1);
+        for (std::int64_t i = 0; i < numPrevious; i++)
+            for (const auto& entry : scale._area_of_influence[i])
+                influencedPoints[insertPos[entry.first]++] = { static_cast<std::uint32_t>(i), entry.second };
+    }
+
+    // The weight of a landmark is the influenced weight of the previous scale, its transitions are the weighted overlap of areas of influence
+    const auto& previousWeights = previousScale._landmark_weight;
+    const auto previousWeight = [&previousWeights](std::uint32_t point) { return previousWeights.empty() ? 1.f : previousWeights[point]; };
+
+    scale._landmark_weight.assign(numLandmarks, 0.f);
+    scale._transition_matrix.clear();
+    scale._transition_matrix.resize(numLandmarks);
+
+#pragma omp parallel
+    {
+        // Dense accumulator over the landmarks, only the touched entries are visited and reset
+        std::vector<float> accumulator(numLandmarks, 0.f);
+        std::vector<char> isTouched(numLandmarks, 0);
+        std::vector<std::uint32_t> touched;
+
+#pragma omp for schedule(dynamic, 64)
+        for (std::int64_t landmark = 0; landmark < numLandmarks; landmark++)
         {
-            size_t kSize = influenceHierarchy[i][j].size();
-            saveFile.write((const char*)&kSize, sizeof(decltype(kSize)));
-            if (kSize > 0)
+            touched.clear();
+            float weight = 0.f;
+
+            for (auto k = offsets[landmark]; k < offsets[landmark + 1]; k++)
             {
-                saveFile.write((const char*)&influenceHierarchy[i][j].front(), kSize * sizeof(uint32_t));
+                const auto [point, influence] = influencedPoints[k];
+                const float pointWeight = previousWeight(point) * influence;
+                weight += pointWeight;
+
+                for (const auto& entry : scale._area_of_influence[point])
+                {
+                    if (!isTouched[entry.first])
+                    {
+                        isTouched[entry.first] = 1;
+                        touched.push_back(entry.first);
+                    }
+                    accumulator[entry.first] += pointWeight * entry.second;
+                }
+            }
+
+            scale._landmark_weight[landmark] = weight;
+
+            std::sort(touched.begin(), touched.end());
+
+            float sum = 0.f;
+            for (const std::uint32_t other : touched)
+                sum += accumulator[other];
+
+            auto& row = scale._transition_matrix[landmark].memory();
+            row.reserve(touched.size());
+
+            for (const std::uint32_t other : touched)
+            {
+                row.emplace_back(other, accumulator[other] / sum);
+                accumulator[other] = 0.f;
+                isTouched[other] = 0;
             }
         }
     }
 
-    saveFile.close();
+    std::cout << "Added scale " << scaleIndex << " with " << numLandmarks << " landmarks by parallel random walks" << std::endl;
+}
+
+
+std::string HsneHierarchy::computeCacheKey(const std::vector<float>& data, const Hsne::Parameters& internalParams, const KnnGraph* knnGraph) const {
+    HsneCacheStore::Key key;
+
+    key.addBytes(_PARAMETERS_CACHE_VERSION_, std::strlen(_PARAMETERS_CACHE_VERSION_));
+    key.add(HsneCacheFile::version);
+
+    key.add(_numPoints);
+    key.add(_numDimensions);
+    key.add(_enabledDimensions);
+    key.addData(data);
+
+    key.add(internalParams._aknn_algorithm);
+    key.add(internalParams._aknn_metric);
+    key.add(internalParams._num_neighbors);
+    key.add(_exactKnn);
+
+    // By content, the same graph may be exported to several files
+    key.add(knnGraph != nullptr);
+    if (knnGraph)
+    {
+        key.addBytes(knnGraph->offsets.data(), knnGraph->offsets.size() * sizeof(std::uint64_t));
+        key.addBytes(knnGraph->indices.data(), knnGraph->indices.size() * sizeof(std::uint32_t));
+        key.addBytes(knnGraph->distancesSquared.data(), knnGraph->distancesSquared.size() * sizeof(float));
+    }
+
+    key.add(internalParams._aknn_num_checks);
+    key.add(internalParams._aknn_num_trees);
+    key.add(internalParams._aknn_algorithmP1);
+    key.add(internalParams._aknn_algorithmP2);
+
+    key.add(internalParams._out_of_core_computation);
+    key.add(internalParams._num_walks_per_landmark);
+    key.add(internalParams._mcmcs_num_walks);
+    key.add(internalParams._mcmcs_landmark_thresh);
+    key.add(internalParams._mcmcs_walk_length);
+    key.add(internalParams._transition_matrix_prune_thresh);
+    key.add(internalParams._hard_cut_off);
+    key.add(internalParams._hard_cut_off_percentage);
+
+    key.add(internalParams._seed);
+    key.add(internalParams._monte_carlo_sampling);
+    key.add(_sparseInfluence);
+    key.add(_randomWalkEngine && internalParams._monte_carlo_sampling);
+
+    return key.toString();
+}
+
+void HsneHierarchy::saveCacheHsne(const std::string& cacheKey, const Hsne::Parameters& internalParams) const {
+    if (!_hsne) return; // only save if initialize() has been called
+
+    std::cout << "HsneHierarchy::saveCacheHsne(): save cache entry " + cacheKey + " to " + _cacheDirectory.string() << std::endl;
+
+    HsneCacheStore cacheStore(_cacheDirectory, _cacheQuotaBytes);
+
+    if (!cacheStore.store(cacheKey, *_hsne, _influenceHierarchy.getMap()))
+        return;
+
+    // Human-readable description of the entry
+    saveCacheParameters(cacheStore.getDescriptionPath(cacheKey).string(), internalParams);
+}
+
+bool HsneHierarchy::saveCacheFile(std::string fileName) const {
+    std::cout << "Writing " + fileName << std::endl;
+
+    for (int scale = 0; scale < static_cast<int>(_spilledScales.size()); scale++)
+        reloadScale(scale);
+
+    return HsneCacheFile::save(fileName, *_hsne, _influenceHierarchy.getMap());
 }
 
 
@@ -349,6 +1349,7 @@ void HsneHierarchy::saveCacheParameters(std::string fileName, const Hsne::Parame
     parameters["Knn library"] = internalParams._aknn_algorithm;
     parameters["Knn distance metric"] = internalParams._aknn_metric;
     parameters["Knn number of neighbors"] = internalParams._num_neighbors;
+    parameters["Knn exact search"] = _exactKnn;
 
     parameters["Nr. Checks in AKNN"] = internalParams._aknn_num_checks;
     parameters["Nr. Trees for AKNN"] = internalParams._aknn_num_trees;
@@ -366,6 +1367,8 @@ void HsneHierarchy::saveCacheParameters(std::string fileName, const Hsne::Parame
 
     parameters["Seed for random algorithms"] = internalParams._seed;
     parameters["Select landmarks with a MCMCS"] = internalParams._monte_carlo_sampling;
+    parameters["Influence by sparse products"] = _sparseInfluence;
+    parameters["Parallel random walks"] = _randomWalkEngine && internalParams._monte_carlo_sampling;
 
     // Write to file
     saveFile << std::setw(4) << parameters << std::endl;
@@ -373,45 +1376,42 @@ void HsneHierarchy::saveCacheParameters(std::string fileName, const Hsne::Parame
 }
 
 
-bool HsneHierarchy::loadCache(const Hsne::Parameters& internalParams, hdi::utils::CoutLog& log) {
-    if (!_saveHierarchyToDisk)
+bool HsneHierarchy::loadCache(const std::string& cacheKey, hdi::utils::CoutLog& log) {
+    if (!_saveHierarchyToDisk || !_hsne)
         return false;
 
-    std::cout << "HsneHierarchy::loadCache(): attempt to load cache from " + _cachePathFileName.string() << std::endl;
+    std::cout << "HsneHierarchy::loadCache(): attempt to load cache entry " + cacheKey + " from " + _cacheDirectory.string() << std::endl;
 
-    auto pathParameter = _cachePathFileName.string() + _PARAMETERS_CACHE_EXTENSION_;
-    auto pathHierarchy = _cachePathFileName.string() + _HIERARCHY_CACHE_EXTENSION_;
-    auto pathInfluenceTD = _cachePathFileName.string() + _INFLUENCE_TOPDOWN_CACHE_EXTENSION_;
-
-    for (const Path& path : { pathHierarchy, pathInfluenceTD, pathParameter })
-    {
-        if (!(std::filesystem::exists(path)))
-        {
-            std::cerr << "Loading cache failed: File could not be opened: " + path.string() << std::endl;
-            return false;
-        }
-    }
+    HsneCacheStore cacheStore(_cacheDirectory, _cacheQuotaBytes);
 
-    if (!checkCacheParameters(pathParameter, internalParams))
+    // The influence hierarchy is used in place from the mapped cache file
+    _hsne->setLogger(&log);
+    if (!cacheStore.load(cacheKey, *_hsne, _influenceHierarchy.getMap()))
     {
-        std::cout << "Loading cache failed: Current settings are different from cached parameters." << std::endl;
+        std::cout << "No cached hierarchy for the current data and settings." << std::endl;
         return false;
     }
 
-    auto checkChache = [](bool val, std::string path) {
-        if (val)
-            return true;
-        else
-        {
-            std::cerr << "Loading cache failed: " + path << std::endl;
-            return false;
-        }
-    };
+    std::cout << "Using the cached hierarchy " << cacheKey << ", turn off \"Save hierarchy to disk\" to recompute it" << std::endl;
 
-    _isInit = checkChache(loadCacheHsneHierarchy(pathHierarchy, log), pathHierarchy) &&
-              checkChache(loadCacheHsneInfluenceHierarchy(pathInfluenceTD, _influenceHierarchy.getMap()), pathInfluenceTD);
+    _hsneHasParameters = false;
 
-    return _isInit;
+    return true;
+}
+
+bool HsneHierarchy::loadCacheFile(std::string fileName, bool borrowInfluenceHierarchy) {
+    if (!_hsne) return false;
+
+    std::cout << "Loading " + fileName << std::endl;
+
+    if (!HsneCacheFile::load(fileName, *_hsne, _influenceHierarchy.getMap(), borrowInfluenceHierarchy))
+        return false;
+
+    _numScales = static_cast<uint32_t>(_hsne->hierarchy().size());
+    _hierarchyKey.clear();
+    _hsneHasParameters = false;
+
+    return true;
 }
 
 bool HsneHierarchy::loadCacheHsneHierarchy(std::string fileName, hdi::utils::CoutLog& log) {
@@ -431,6 +1431,8 @@ bool HsneHierarchy::loadCacheHsneHierarchy(std::string fileName, hdi::utils::Cou
     hdi::dr::IO::loadHSNE(*_hsne, loadFile, &log);
 
     _numScales = static_cast<uint32_t>(_hsne->hierarchy().size());
+    _hierarchyKey.clear();
+    _hsneHasParameters = false;
 
     return true;
 
@@ -449,25 +1451,36 @@ bool HsneHierarchy::loadCacheHsneInfluenceHierarchy(std::string fileName, std::v
     size_t iSize = 0;
     loadFile.read((char*)&iSize, sizeof(decltype(iSize)));
 
+    influenceHierarchy.clear();
     influenceHierarchy.resize(iSize);
 
     for (size_t i = 0; i < influenceHierarchy.size(); i++)
     {
         size_t jSize = 0;
         loadFile.read((char*)&jSize, sizeof(decltype(jSize)));
-        influenceHierarchy[i].resize(jSize);
 
-        for (size_t j = 0; j < influenceHierarchy[i].size(); j++)
+        // Read all landmarks of a scale into one flat array
+        std::vector<std::uint64_t> offsets(jSize + 1, 0);
+        std::vector<unsigned int> indices;
+
+        for (size_t j = 0; j < jSize; j++)
         {
             size_t kSize = 0;
             loadFile.read((char*)&kSize, sizeof(decltype(kSize)));
 
-            influenceHierarchy[i][j].resize(kSize);
+            offsets[j + 1] = offsets[j] + kSize;
             if (kSize > 0)
             {
-                loadFile.read((char*)&influenceHierarchy[i][j].front(), kSize * sizeof(uint32_t));
+                indices.resize(offsets[j + 1]);
+                loadFile.read((char*)(indices.data() + offsets[j]), kSize * sizeof(uint32_t));
             }
         }
+
+        if (!loadFile)
+            return false;
+
+        if (jSize > 0)
+            influenceHierarchy[i] = LandmarkMap(std::move(offsets), std::move(indices));
     }
 
     loadFile.close();
@@ -475,68 +1488,3 @@ bool HsneHierarchy::loadCacheHsneInfluenceHierarchy(std::string fileName, std::v
     return true;
 
 }
-
-bool HsneHierarchy::checkCacheParameters(const std::string fileName, const Hsne::Parameters& params) const {
-    if (!_hsne) return false;
-
-    std::ifstream loadFile(fileName.c_str(), std::ios::in);
-
-    if (!loadFile.is_open()) return false;
-
-    std::cout << "Loading " + fileName << std::endl;
-
-    // read a JSON file
-    nlohmann::json parameters;
-    loadFile >> parameters;
-
-    if (!parameters.contains("## VERSION ##") || parameters["## VERSION ##"] != _PARAMETERS_CACHE_VERSION_)
-    {
-        std::cout << "Version of the cache (" + std::string(parameters["## VERSION ##"]) + ") differs from analysis version (" + _PARAMETERS_CACHE_VERSION_ + "). Cannot load cache)" << std::endl;
-        return false;
-    }
-
-    // if current setting is different from params on disk, don't load from disk
-    auto checkParam = [&parameters](std::string paramName, auto localParam) -> bool {
-        auto& storedParam = parameters[paramName];
-        if (storedParam != localParam)
-        {
-            std::ostringstream localParamSS, storedParamSS;
-            localParamSS << localParam;
-            storedParamSS << storedParam;
-            std::cout << paramName + " (" + localParamSS.str() + ") does not match cache (" + storedParamSS.str() + "). Cannot load cache." << std::endl;
-            return false;
-        }
-        return true;
-    };
-
-    if (!checkParam("Input data name", _inputDataName)) return false;
-    if (!checkParam("Number of points", _numPoints)) return false;
-    if (!checkParam("Number of dimensions", _numDimensions)) return false;
-
-    if (!checkParam("Number of Scales", _numScales)) return false;
-
-    if (!checkParam("Knn library", params._aknn_algorithm)) return false;
-    if (!checkParam("Knn distance metric", params._aknn_metric)) return false;
-    if (!checkParam("Knn number of neighbors", params._num_neighbors)) return false;
-
-    if (!checkParam("Nr. Checks in AKNN", params._aknn_num_checks)) return false;
-    if (!checkParam("Nr. Trees for AKNN", params._aknn_num_trees)) return false;
-    if (!checkParam("HNSW Param 1", params._aknn_algorithmP1)) return false;
-    if (!checkParam("HNSW Param 2", params._aknn_algorithmP2)) return false;
-
-    if (!checkParam("Memory preserving computation", params._out_of_core_computation)) return false;
-    if (!checkParam("Nr. RW for influence", params._num_walks_per_landmark)) return false;
-    if (!checkParam("Nr. RW for Monte Carlo", params._mcmcs_num_walks)) return false;
-    if (!checkParam("Random walks threshold", params._mcmcs_landmark_thresh)) return false;
-    if (!checkParam("Random walks length", params._mcmcs_walk_length)) return false;
-    if (!checkParam("Pruning threshold", params._transition_matrix_prune_thresh)) return false;
-    if (!checkParam("Fixed Percentile Landmark Selection", params._hard_cut_off)) return false;
-    if (!checkParam("Percentile Landmark Selection", params._hard_cut_off_percentage)) return false;
-
-    if (!checkParam("Seed for random algorithms", params._seed)) return false;
-    if (!checkParam("Select landmarks with a MCMCS", params._monte_carlo_sampling)) return false;
-
-    std::cout << "Parameters of cache correspond to current settings." << std::endl;
-
-    return true;
-}
\ No newline at end of file
@@ -2,10 +2,13 @@
 
 #include "hdi/dimensionality_reduction/hierarchical_sne.h"
 #include "hdi/utils/cout_log.h"
-#include "hdi/utils/graph_algorithms.h"
+
+#include "LandmarkMap.h"
 
 #include "PointData/PointData.h"
 
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
 #include <memory>
 #include <string>
@@ -13,11 +16,13 @@
 #include <vector>
 
 #include <QObject>
+#include <QTemporaryDir>
 
 using HsneMatrix = std::vector<hdi::data::MapMemEff<uint32_t, float>>;
 using Hsne = hdi::dr::HierarchicalSNE<float, HsneMatrix>;
 
 class HsneParameters;
+struct KnnGraph;
 class KnnParameters;
 class HsneHierarchy;
 
@@ -29,7 +34,6 @@ namespace mv {
     }
 }
 
-using LandmarkMap = std::vector<std::vector<unsigned int>>;
 using Path = std::filesystem::path;
 
 /**
@@ -44,11 +48,25 @@ class InfluenceHierarchy : public QObject
     Q_OBJECT
 
 public:
-    void initialize(HsneHierarchy& hierarchy);
+    /**
+     * Compute for every scale except the bottom scale, which landmark influences which bottom scale point
+     * @param hierarchy Initialized HSNE hierarchy
+     * @param sparseProducts Chain the area of influence matrices of all scales instead of querying every data point
+     * @param firstScale First scale to compute, the maps of the scales below are kept, e.g. after adding scales to an existing hierarchy
+     * @return False if a cancellation of the hierarchy was requested, the maps of the new scales are then incomplete
+     */
+    bool initialize(HsneHierarchy& hierarchy, bool sparseProducts, int firstScale = 1);
 
     std::vector<LandmarkMap>& getMap() { return _influenceMap; }
     const std::vector<LandmarkMap>& getMap() const { return _influenceMap; }
 
+private:
+    /** Top influencing landmark per scale and data point from a random walk based influence query per data point */
+    void computeTopLandmarksPerDataPoint(HsneHierarchy& hierarchy, std::vector<std::vector<int>>& topLandmarks) const;
+
+    /** Top influencing landmark per scale and data point from pruned sparse products of the area of influence matrices */
+    void computeTopLandmarksBySparseProducts(const HsneHierarchy& hierarchy, std::vector<std::vector<int>>& topLandmarks) const;
+
 private:
     std::vector<LandmarkMap> _influenceMap;
 };
@@ -64,6 +82,9 @@ class HsneHierarchy : public QObject
 {
     Q_OBJECT
 
+public:
+    ~HsneHierarchy() override;
+
 public slots:
     /**
      * Initialize the HSNE hierarchy with a data-level scale. First call setDataAndParameters() and initParentTask()
@@ -71,37 +92,76 @@ public slots:
     void initialize();
 
 signals:
+    /** All scales exist, emitted before the influence hierarchy is computed and cached */
+    void scalesFinished();
+
+    /** The hierarchy and influence hierarchy are complete */
     void finished();
 
+    /** The construction was cancelled before any scale above the data scale finished, the hierarchy is empty */
+    void cancelled();
+
 public:
     void setDataAndParameters(const mv::Dataset<Points>& inputData, const mv::Dataset<Points>& outputData, const HsneParameters& parameters, const KnnParameters& knnParameters, std::vector<bool>&& enabledDimensions);
 
     // Call before moving this object to another thread
     void initParentTask();
 
-    HsneMatrix getTransitionMatrixAtScale(int scale) { return _hsne->scale(scale)._transition_matrix; }
+    /**
+     * Stop initialize() at its next checkpoint, thread safe. Checkpoints follow the data-level similarities and every
+     * added scale, a cancelled hierarchy keeps its finished scales. A request that reaches the checkpoint before or
+     * during the selection mapping skips the mapping of the new scales, their embeddings are then not linked to the data.
+     */
+    void requestCancel() { _cancelRequested = true; }
+
+    /** Whether a cancellation is pending, polled by the selection mapping */
+    bool isCancelRequested() const { return _cancelRequested; }
+
+    /**
+     * Read-only transition matrix of a scale without copying it, shares ownership of the hierarchy.
+     * While borrowed, the hierarchy is not changed in place: a recomputation continues on a new or copied hierarchy.
+     */
+    std::shared_ptr<const HsneMatrix> getTransitionMatrixAtScale(int scale) const { reloadScale(scale); return std::shared_ptr<const HsneMatrix>(_hsne, &_hsne->scale(scale)._transition_matrix); }
 
     void printScaleInfo() const;
 
     bool isInitialized() const { return _isInit; }
 
+    /** Whether the landmarks of a scale are mapped to the data points, false if the mapping was cancelled */
+    bool hasSelectionMapping(int scale) const;
+
     Hsne& getHsne() { return *_hsne.get(); }
     const Hsne& getHsne() const { return *_hsne.get(); }
 
-    Hsne::scale_type& getScale(int scaleId) { return _hsne->scale(scaleId); }
-    const Hsne::scale_type& getScale(int scaleId) const { return _hsne->scale(scaleId); }
+    /** Scale of the hierarchy, a spilled scale is reloaded first, see spillInactiveScales() */
+    Hsne::scale_type& getScale(int scaleId) { reloadScale(scaleId); return _hsne->scale(scaleId); }
+    const Hsne::scale_type& getScale(int scaleId) const { reloadScale(scaleId); return _hsne->scale(scaleId); }
 
     InfluenceHierarchy& getInfluenceHierarchy() { return _influenceHierarchy; }
     const InfluenceHierarchy& getInfluenceHierarchy() const { return _influenceHierarchy; }
 
     /**
-     * Returns a map of landmark indices and influences on the previous scale in the hierarchy,
-     * that are influenced by landmarks specified by their index in the current scale.
+     * Landmarks of the previous scale in the hierarchy that are influenced by landmarks specified by their index in the current scale.
+     * The influence on a landmark is the summed area of influence of the selected landmarks, as in HDI.
+     * Call from the GUI thread only, the lookup tables of the scale are shared by all refinements.
+     * @param currentScale Scale of the selected landmarks
+     * @param indices Selected landmarks
+     * @param threshold Minimum influence (exclusive) of the returned landmarks
+     * @param influencedLandmarks Output, landmarks with an influence above the threshold, sorted by index
+     * @return Number of landmarks with any influence
      */
-    void getInfluencedLandmarksInPreviousScale(int currentScale, std::vector<unsigned int> indices, std::map<uint32_t, float>& neighbors)
-    {
-        _hsne->getInfluencedLandmarksInPreviousScale(currentScale, indices, neighbors);
-    }
+    size_t getInfluencedLandmarksInPreviousScale(int currentScale, const std::vector<unsigned int>& indices, float threshold, std::vector<uint32_t>& influencedLandmarks);
+
+    /**
+     * Influenced landmarks in the previous scale of several selections in one sweep over the touched landmarks, e.g. one selection per cluster.
+     * Selections sharing landmarks are queried one by one.
+     * @param currentScale Scale of the selected landmarks
+     * @param selections Selected landmarks per selection
+     * @param threshold Minimum influence (exclusive) of the returned landmarks
+     * @param influencedLandmarks Output, per selection the landmarks with an influence above the threshold, sorted by index
+     * @return Per selection the number of landmarks with any influence
+     */
+    std::vector<size_t> getInfluencedLandmarksInPreviousScale(int currentScale, const std::vector<std::vector<unsigned int>>& selections, float threshold, std::vector<std::vector<uint32_t>>& influencedLandmarks);
 
     void getInfluenceOnDataPoint(unsigned int dataPointId, std::vector<std::unordered_map<unsigned int, float>>& influence, float thresh = 0, bool normalized = true)
     {
@@ -109,18 +169,76 @@ public:
     }
 
     /**
-     * Extract a subgraph with the selected indexes and the vertices connected to them by an edge with a weight higher then thresh
-     * 
+     * Extract the transition matrix of the previous scale between the selected landmarks, rows and columns in selection order.
+     * Call from the GUI thread only, the lookup table of the scale is shared by all refinements.
      */
-    void getTransitionMatrixForSelection(int currentScale, HsneMatrix& transitionMatrix, std::vector<uint32_t>& landmarkIdxs)
-    {
-        // Get full transition matrix of the previous scale
-        HsneMatrix& fullTransitionMatrix = _hsne->scale(currentScale-1)._transition_matrix;
+    void getTransitionMatrixForSelection(int currentScale, HsneMatrix& transitionMatrix, const std::vector<uint32_t>& landmarkIdxs);
 
-        // Extract the selected subportion of the transition matrix
-        std::vector<unsigned int> dummy;
-        hdi::utils::extractSubGraph(fullTransitionMatrix, landmarkIdxs, transitionMatrix, dummy, 1);
-    }
+    /**
+     * Extract the transition matrices of several selections of the previous scale in one sweep, see getTransitionMatrixForSelection().
+     * Selections sharing landmarks are extracted one by one.
+     */
+    void getTransitionMatricesForSelections(int currentScale, std::vector<HsneMatrix>& transitionMatrices, const std::vector<std::vector<uint32_t>>& selections);
+
+    /**
+     * Linked selection from landmarks of a scale to the data points in their area of influence, both in global indices.
+     * The point lists are filled in parallel and moved into the mapping, without intermediate per-landmark copies.
+     * @param scale Scale of the landmarks, above the data scale
+     * @param landmarks Landmarks to link, relative to the scale
+     * @param keys Index of every landmark in the linked selection source, same order as landmarks
+     * @param mapping Output
+     */
+    void getSelectionMapping(int scale, const std::vector<uint32_t>& landmarks, const std::vector<unsigned int>& keys, mv::SelectionMap& mapping) const;
+
+    /** Keep a scale in memory while it is displayed, see spillInactiveScales(). Counted per caller, the top scale is always kept */
+    void retainScale(int scale);
+
+    /** Undo one retainScale(), the scale is spilled by the next spillInactiveScales() once nothing retains it */
+    void releaseScale(int scale);
+
+    /**
+     * Retention policy of the scales: when enabled, scales that are not retained are written to local spill files and released.
+     * Disabling it reloads all spilled scales.
+     */
+    void setSpillInactiveScales(bool spill);
+
+    /**
+     * Write the scales that are not retained to spill files and release their matrices, if enabled.
+     * A released scale is reloaded on first use by getScale() and the selection queries, its influence map is read from the mapped spill file.
+     * The landmark to data point indices stay in memory. Call from the GUI thread only.
+     */
+    void spillInactiveScales();
+
+    /** Reload all spilled scales and remove their spill files */
+    void restoreSpilledScales();
+
+private:
+    /** Add a scale on top of the hierarchy, with RandomWalkEngine if enabled and the landmarks are selected by Monte Carlo sampling, with HDI otherwise */
+    void addScale();
+
+    /**
+     * Add a scale with the walks of RandomWalkEngine on the transition matrix of the current top scale, following the HSNE construction:
+     * landmarks are the points at which many fixed-length walks end, the area of influence of a point is the distribution of the landmarks
+     * that walks from it reach first, and landmarks transition in proportion to the weighted overlap of their areas of influence.
+     */
+    void addScaleByRandomWalks();
+
+    /** Read the arrays and matrices of a released scale back from its spill file, which is kept for spilling the scale again */
+    void reloadScale(int scale) const;
+
+    /** Landmark index to selection index of a scale, -1 for all landmarks outside of a query */
+    std::vector<int>& getSelectionLookup(int scale);
+
+    /** Previous scale points in the area of influence of every landmark of a scale, computed on first use */
+    const LandmarkMap& getTransposedAreaOfInfluence(int scale);
+
+public:
+
+    /** Index in the full data set of a data scale point, differs from the point index for subset inputs */
+    unsigned int getGlobalIndex(unsigned int dataIndex) const { return _globalIndices.empty() ? dataIndex : _globalIndices[dataIndex]; }
+
+    /** Index in the full data set of the data point of a landmark */
+    unsigned int getLandmarkGlobalIndex(int scale, unsigned int landmark) const { return getGlobalIndex(_hsne->scale(scale)._landmark_to_original_data_idx[landmark]); }
 
     int getNumScales() const { return _numScales; }
     int getTopScale() const { return _numScales - 1; }
@@ -128,35 +246,40 @@ public:
     int getNumPoints() const { return _numPoints; }
     int getNumDimensions() const { return _numDimensions; }
 
-    /** Save HSNE hierarchy from this class to disk */
-    void saveCacheHsne(const Hsne::Parameters& internalParams) const;
+    /** Key of the current data and settings in the cache store, independent of the number of scales, see HsneCacheStore */
+    std::string computeCacheKey(const std::vector<float>& data, const Hsne::Parameters& internalParams, const KnnGraph* knnGraph) const;
+
+    /** Save HSNE hierarchy from this class to the cache store */
+    void saveCacheHsne(const std::string& cacheKey, const Hsne::Parameters& internalParams) const;
 
-    /** Load HSNE hierarchy from disk */
-    bool loadCache(const Hsne::Parameters& internalParams, hdi::utils::CoutLog& log);
+    /** Load HSNE hierarchy from the cache store */
+    bool loadCache(const std::string& cacheKey, hdi::utils::CoutLog& log);
 
 protected:
-    /** Save HsneHierarchy to disk */
-    void saveCacheHsneHierarchy(std::string fileName) const;
-    /** Save InfluenceHierarchy to disk */
-    void saveCacheHsneInfluenceHierarchy(std::string fileName, const std::vector<LandmarkMap>& influenceHierarchy) const;
+    /** Save HsneHierarchy and InfluenceHierarchy to disk, see HsneCacheFile */
+    bool saveCacheFile(std::string fileName) const;
     /** Save HSNE parameters to disk */
     void saveCacheParameters(std::string fileName, const Hsne::Parameters& internalParams) const;
 
-    /** Load HsneHierarchy from disk */
+    /** Load HsneHierarchy and InfluenceHierarchy from disk, see HsneCacheFile */
+    bool loadCacheFile(std::string fileName, bool borrowInfluenceHierarchy);
+    /** Load HsneHierarchy from disk in the HDI stream format of older projects */
     bool loadCacheHsneHierarchy(std::string fileName, hdi::utils::CoutLog& _log);
-    /** Load InfluenceHierarchy from disk */
+    /** Load InfluenceHierarchy from disk in the format of older projects */
     bool loadCacheHsneInfluenceHierarchy(std::string fileName, std::vector<LandmarkMap>& influenceHierarchy);
-    /** Check whether HSNE parameters of the cached values on disk correspond with the current settings */
-    bool checkCacheParameters(const std::string fileName, const Hsne::Parameters& params) const;
 
     void setIsInitialized(bool init) { _isInit = true; }
 
 private:
-    std::unique_ptr<Hsne>   _hsne;
+    /** Whether a cancellation was requested since the last checkpoint, resets the request */
+    bool takeCancelRequest() { return _cancelRequested.exchange(false); }
+
+    std::shared_ptr<Hsne>   _hsne;
     InfluenceHierarchy      _influenceHierarchy;
 
     std::vector<bool>       _enabledDimensions;
     mv::Dataset<Points>     _inputData;
+    std::vector<unsigned int> _globalIndices;                      /** Global index of every input point for subset inputs, empty for full inputs */
     mv::Dataset<Points>     _outputData;
     std::string             _inputDataName;
     mv::Task*               _parentTask = nullptr;
@@ -165,10 +288,31 @@ private:
     unsigned int            _numPoints = 0;
     unsigned int            _numDimensions = 0;
     Hsne::Parameters        _params;
-    bool                    _isInit = false;
+    bool                    _exactKnn = false;                     /** Compute the data-level neighborhood graph with the exact VP-tree search */
+    std::string             _knnGraphFile;                         /** Precomputed data-level neighborhood graph, see KnnGraphFile, empty to compute it */
+    bool                    _sparseInfluence = false;              /** Compute the influence hierarchy with sparse matrix products */
+    bool                    _randomWalkEngine = false;             /** Construct the scales with RandomWalkEngine instead of HDI */
+    std::atomic<bool>       _isInit = false;                       /** Whether the hierarchy is complete, false while initialize() changes it */
+    bool                    _hsneHasParameters = false;            /** Whether _hsne was initialized with _params and can add scales, false for loaded hierarchies */
+    std::string             _hierarchyKey;                         /** Cache key of the hierarchy in _hsne, empty if unknown */
+    std::atomic<bool>       _cancelRequested = false;              /** Set by requestCancel() on any thread, taken at the checkpoints of initialize() */
+
+    std::vector<std::vector<int>> _selectionLookup;                /** Per scale, landmark index to selection index during a query, -1 outside of it */
+    std::vector<LandmarkMap> _transposedAreaOfInfluence;           /** Per scale, previous scale points influenced by every landmark, empty until used */
+
+    struct SpilledScale
+    {
+        std::string         fileName;                               /** Spill file of the scale, empty if not written */
+        bool                released = false;                       /** Whether the matrices are released and have to be read from the file */
+    };
+
+    bool                    _spillInactiveScales = false;          /** Release the scales that are not retained, see spillInactiveScales() */
+    std::vector<int>        _retainedScales;                       /** Per scale, the number of displayed embeddings that keep it in memory */
+    std::unique_ptr<QTemporaryDir> _spillDirectory;                /** Directory of the spill files, removed with its files */
+    mutable std::vector<SpilledScale> _spilledScales;              /** Per scale, spill state, reloading is logically const */
 
-    Path                    _cachePath;                            /** Path for saving and loading cache */
-    Path                    _cachePathFileName;                    /** cachePath() + data name */
+    Path                    _cacheDirectory;                       /** Directory of the cache store */
+    std::uint64_t           _cacheQuotaBytes = 0;                  /** Disk quota of the cache store */
     bool                    _saveHierarchyToDisk = false;
 
     friend class HsneAnalysisPlugin;
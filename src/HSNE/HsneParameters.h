@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 /**
  * HsneParameters
  *
@@ -20,7 +22,12 @@ public:
         _numWalksForAreaOfInfluence(100),
         _minWalksRequired(0),
         _useOutOfCoreComputation(true),
+        _useSparseInfluencePropagation(false),
+        _useRandomWalkEngine(false),
         _saveHierarchyToDisk(false),
+        _cacheDirectory(),
+        _cacheQuotaGB(20),
+        _knnGraphFile(),
         _numNeighbors(90)
     {
 
@@ -42,6 +49,8 @@ public:
     void setNumNearestNeighbors(int numNeighbors) { _numNeighbors = numNeighbors; }
     void useMonteCarloSampling(bool useMonteCarloSampling) { _useMonteCarloSampling = useMonteCarloSampling; }
     void useOutOfCoreComputation(bool useOutOfCoreComputation) { _useOutOfCoreComputation = useOutOfCoreComputation; }
+    void useSparseInfluencePropagation(bool useSparseInfluencePropagation) { _useSparseInfluencePropagation = useSparseInfluencePropagation; }
+    void useRandomWalkEngine(bool useRandomWalkEngine) { _useRandomWalkEngine = useRandomWalkEngine; }
 
     int getNumWalksForLandmarkSelection() const { return _numWalksForLandmarkSelection; }
     float getNumWalksForLandmarkSelectionThreshold() const { return _numWalksForLandmarkSelectionThreshold; }
@@ -51,12 +60,23 @@ public:
     int getMinWalksRequired() const { return _minWalksRequired; }
     bool useMonteCarloSampling() const { return _useOutOfCoreComputation; }
     bool useOutOfCoreComputation() const { return _useOutOfCoreComputation; }
+    bool useSparseInfluencePropagation() const { return _useSparseInfluencePropagation; }
+    bool useRandomWalkEngine() const { return _useRandomWalkEngine; }
 
     // Plugin specific
 
     void setSaveHierarchyToDisk(bool saveHierarchyToDisk) { _saveHierarchyToDisk = saveHierarchyToDisk; }
     bool getSaveHierarchyToDisk() const { return _saveHierarchyToDisk; }
 
+    void setCacheDirectory(const std::string& cacheDirectory) { _cacheDirectory = cacheDirectory; }
+    void setCacheQuotaGB(int cacheQuotaGB) { _cacheQuotaGB = cacheQuotaGB; }
+
+    const std::string& getCacheDirectory() const { return _cacheDirectory; }
+    int getCacheQuotaGB() const { return _cacheQuotaGB; }
+
+    void setKnnGraphFile(const std::string& knnGraphFile) { _knnGraphFile = knnGraphFile; }
+    const std::string& getKnnGraphFile() const { return _knnGraphFile; }
+
 private:
     // Basic
     
@@ -72,9 +92,14 @@ private:
     int _numWalksForAreaOfInfluence;                /** How many random walks to use for computing the area of influence */
     int _minWalksRequired;                          /** Minimum number of walks to be considered in the computation of the transition matrix */
     bool _useOutOfCoreComputation;                  /** Preserve memory while computing the hierarchy */
+    bool _useSparseInfluencePropagation;            /** Assign data points to landmarks by chaining the area of influence matrices instead of per-point queries */
+    bool _useRandomWalkEngine;                      /** Construct the scales with the parallel alias table walks of RandomWalkEngine instead of HDI */
     int _numNeighbors;                              /** Number nearest neighbors. In HDI internally it'll use nn = _numNeighbors + 1 and perplexity = _numNeighbors / 3 */
 
     // Plugin specific
 
     bool _saveHierarchyToDisk;                      /** Save hierarchy to disk */
+    std::string _cacheDirectory;                    /** Directory of the hierarchy cache store, empty for the default directory */
+    int _cacheQuotaGB;                              /** Disk quota of the hierarchy cache store in GB, least recently used hierarchies are evicted */
+    std::string _knnGraphFile;                      /** Precomputed neighbor graph of the data scale, see KnnGraphFile, empty to compute it */
 };
@@ -1,15 +1,22 @@
 #include "HsneScaleAction.h"
 
 #include "DataHierarchyItem.h"
+#include "EmbeddingScheduler.h"
 #include "GradientDescentSettingsAction.h"
 #include "HsneHierarchy.h"
+#include "SpeculativeRefinements.h"
 #include "TsneParameters.h"
 
 #include <event/Event.h>
 
 #include <PointData/InfoAction.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <limits>
+#include <random>
+#include <unordered_map>
 
 #include <QMenu>
 
@@ -17,20 +24,34 @@
     #define HSNE_SCALE_ACTION_VERBOSE
 #endif
 
+namespace
+{
+    // Warm-started refinements are already laid out, they only need a short exaggeration phase
+    constexpr float _WARM_START_EXAGGERATION_FRACTION_ = 0.25f;
+
+    // Jitter separates refined landmarks with the same parent, relative to the extent of the parent embedding
+    constexpr float _WARM_START_JITTER_ = 0.001f;
+}
+
 using namespace mv;
 using namespace mv::gui;
 
 
-HsneScaleAction::HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset) :
+HsneScaleAction::HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, EmbeddingScheduler& embeddingScheduler, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset) :
     GroupAction(parent, "HSNE Scale", true),
     _tsneParameters(),
     _tsneAnalysis(),
     _hsneHierarchy(hsneHierarchy),
+    _retainingHierarchy(),
+    _embeddingScheduler(embeddingScheduler),
+    _speculativeRefinements(nullptr),
     _input(inputDataset),
     _embedding(embeddingDataset),
     _refineEmbeddings(),
     _selectionHelpers(),
     _refineAction(this, "Refine selection"),
+    _queueSelectionAction(this, "Queue selection"),
+    _refineQueuedAction(this, "Refine queued (0)"),
     _refinedScaledActions(),
     _computationAction(this, &_tsneParameters),
     _initializationTask(this, "Preparing HSNE scale"),
@@ -38,20 +59,25 @@ HsneScaleAction::HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy,
     _currentScaleLevel(1),
     _tsneParametersTopLevel(nullptr)
 {
+    _embeddingScheduler.add(&_tsneAnalysis);
 }
 
-HsneScaleAction::HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset, TsneParameters* tsneParametersTopLevel) :
-    HsneScaleAction(parent, hsneHierarchy, inputDataset, embeddingDataset)
+HsneScaleAction::HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, EmbeddingScheduler& embeddingScheduler, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset, TsneParameters* tsneParametersTopLevel) :
+    HsneScaleAction(parent, hsneHierarchy, embeddingScheduler, inputDataset, embeddingDataset)
 {
     _tsneParametersTopLevel = tsneParametersTopLevel;
     initLayoutAndConnection();
 }
 
-HsneScaleAction::HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset, unsigned int scale) :
-    HsneScaleAction(parent, hsneHierarchy, inputDataset, embeddingDataset)
+HsneScaleAction::HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, EmbeddingScheduler& embeddingScheduler, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset, unsigned int scale) :
+    HsneScaleAction(parent, hsneHierarchy, embeddingScheduler, inputDataset, embeddingDataset)
 {
     _currentScaleLevel = scale;
     initLayoutAndConnection();
+
+    // Displayed scales stay in memory when inactive scales are spilled
+    _hsneHierarchy.retainScale(scale);
+    _retainingHierarchy = &_hsneHierarchy;
 }
 
 HsneScaleAction::~HsneScaleAction()
@@ -59,6 +85,19 @@ HsneScaleAction::~HsneScaleAction()
 #ifdef HSNE_SCALE_ACTION_VERBOSE
     qDebug() << __FUNCTION__ << text();
 #endif
+
+    releaseScale();
+}
+
+void HsneScaleAction::releaseScale()
+{
+    // The plugin destroys its hierarchy before the scale actions
+    if (_retainingHierarchy.isNull())
+        return;
+
+    _retainingHierarchy->releaseScale(_currentScaleLevel);
+    _retainingHierarchy->spillInactiveScales();
+    _retainingHierarchy.clear();
 }
 
 void HsneScaleAction::initLayoutAndConnection()
@@ -70,6 +109,11 @@ void HsneScaleAction::initLayoutAndConnection()
         connect(&_refineAction, &TriggerAction::triggered, this, [this]() {
             refine();
             });
+
+        _queueSelectionAction.setToolTip("Add the selected landmarks to the selections that are refined together");
+        _refineQueuedAction.setToolTip("Refine all queued selections in one pass");
+        addAction(&_queueSelectionAction);
+        addAction(&_refineQueuedAction);
     }
 
     _computationAction.addActions();
@@ -117,21 +161,7 @@ void HsneScaleAction::initLayoutAndConnection()
             qApp->processEvents();
         });
 
-        auto initUpdateEmbedding = [this]() -> void {
-            auto& datasetTask = _embedding->getTask();
-            datasetTask.setName("Embed HSNE scale");
-            datasetTask.setConfigurationFlag(Task::ConfigurationFlag::OverrideAggregateStatus);
-            _tsneAnalysis.setTask(&datasetTask);
-            datasetTask.setRunning();
-
-            connect(&_tsneAnalysis, &TsneAnalysis::embeddingUpdate, this, [this](const TsneData& tsneData) {
-                _embedding->setData(tsneData.getData().data(), tsneData.getNumPoints(), 2);
-                getNumberOfComputatedIterationsAction().setValue(_tsneAnalysis.getNumIterations() - 1);
-                events().notifyDatasetDataChanged(_embedding);
-                });
-        };
-
-        connect(&_computationAction.getStartComputationAction(), &TriggerAction::triggered, this, [this, initUpdateEmbedding]() {
+        connect(&_computationAction.getStartComputationAction(), &TriggerAction::triggered, this, [this]() {
             initUpdateEmbedding();
             
             HsneMatrix refinedTransitionMatrix;
@@ -142,7 +172,7 @@ void HsneScaleAction::initLayoutAndConnection()
             _tsneAnalysis.startComputation(_tsneParameters, refinedTransitionMatrix, _drillIndices.size());
         });
 
-        connect(&_computationAction.getContinueComputationAction(), &TriggerAction::triggered, this, [this, initUpdateEmbedding]() {
+        connect(&_computationAction.getContinueComputationAction(), &TriggerAction::triggered, this, [this]() {
             initUpdateEmbedding();
 
             _tsneAnalysis.continueComputation(_tsneParameters.getNumIterations());
@@ -160,6 +190,9 @@ void HsneScaleAction::initLayoutAndConnection()
         const auto enabled = !isReadOnly();
 
         _refineAction.setEnabled(!isReadOnly() && !selection->indices.empty() && _hsneHierarchy.getNumScales() > 1);
+        _queueSelectionAction.setEnabled(_refineAction.isEnabled());
+        _refineQueuedAction.setEnabled(!isReadOnly() && !_queuedSelections.empty() && _hsneHierarchy.getNumScales() > 1);
+        _refineQueuedAction.setText(QString("Refine queued (%1)").arg(_queuedSelections.size()));
         _computationAction.getNumIterationsAction().setEnabled(enabled);
     };
 
@@ -167,6 +200,17 @@ void HsneScaleAction::initLayoutAndConnection()
         updateReadOnly();
     });
 
+    connect(&_queueSelectionAction, &TriggerAction::triggered, this, [this, updateReadOnly]() {
+        _queuedSelections.push_back(getSelectedLandmarks());
+        updateReadOnly();
+    });
+
+    connect(&_refineQueuedAction, &TriggerAction::triggered, this, [this, updateReadOnly]() {
+        refine(_queuedSelections);
+        _queuedSelections.clear();
+        updateReadOnly();
+    });
+
     _eventListener.addSupportedEventType(static_cast<std::uint32_t>(EventType::DatasetDataSelectionChanged));
     _eventListener.addSupportedEventType(static_cast<std::uint32_t>(EventType::DatasetAboutToBeRemoved));
     _eventListener.registerDataEventByType(PointType, [this, updateReadOnly](DatasetEvent* dataEvent) {
@@ -174,8 +218,14 @@ void HsneScaleAction::initLayoutAndConnection()
         const auto& datasetID   = dataset->getId();
 
         if (dataEvent->getType() == EventType::DatasetDataSelectionChanged && datasetID == _embedding->getId())
+        {
             updateReadOnly();
 
+            // The embedding the analyst works with gets the cores first, the plugin schedules the top level embedding
+            if (!_isTopScale)
+                _embeddingScheduler.prioritize(&_tsneAnalysis);
+        }
+
         // Remove invisible selection helper dataset when scale dataset is removed
         if (dataEvent->getType() == EventType::DatasetAboutToBeRemoved && dataset->hasProperty("selectionHelperID"))
         {
@@ -194,6 +244,10 @@ void HsneScaleAction::initLayoutAndConnection()
             }
         }
 
+        // A removed embedding is no longer displayed, its scale may be spilled
+        if (dataEvent->getType() == EventType::DatasetAboutToBeRemoved && datasetID == _embedding->getId())
+            releaseScale();
+
     });
 
     updateReadOnly();
@@ -204,6 +258,8 @@ QMenu* HsneScaleAction::getContextMenu(QWidget* parent /*= nullptr*/)
     auto menu = new QMenu(text(), parent);
 
     menu->addAction(&_refineAction);
+    menu->addAction(&_queueSelectionAction);
+    menu->addAction(&_refineQueuedAction);
 
     return menu;
 }
@@ -221,15 +277,122 @@ void HsneScaleAction::initNonTopScale(const std::vector<uint32_t>& drillIndices)
 
 void HsneScaleAction::refine()
 {
-    _initializationTask.setRunning();
+    refine({ getSelectedLandmarks() });
+}
 
-    // Get the selection of points that are to be refined
-    auto selection = _embedding->getSelection<Points>();
+void HsneScaleAction::refine(const std::vector<std::vector<unsigned int>>& allSelections)
+{
+    // Selections that match a precomputed refinement continue from its embedding
+    std::vector<std::vector<unsigned int>> selections;
+    for (const auto& selection : allSelections)
+        if (!refineFromSpeculativeRefinement(selection))
+            selections.push_back(selection);
+
+    if (selections.empty())
+        return;
+
+    _initializationTask.setRunning();
 
     // Set the scale of the refined embedding to be one below the current scale
     assert(_currentScaleLevel >= 1);
     const auto refinedScaleLevel = _currentScaleLevel - 1;
 
+    // Find the points in the previous level corresponding to selected landmarks, thresholded to neighbours with enough influence
+    // These represent the indices of the refined points relative to their HSNE scale, queried for all selections at once
+    std::vector<std::vector<uint32_t>> refinedLandmarks; // Scale-relative indices per selection
+    const std::vector<size_t> numNeighbors = _hsneHierarchy.getInfluencedLandmarksInPreviousScale(_currentScaleLevel, selections, 0.5f /* QUICKPAPER */, refinedLandmarks);
+
+    for (size_t i = 0; i < selections.size(); i++)
+    {
+        std::cout << "#selected landmarks: " << selections[i].size() << std::endl;
+        std::cout << "#landmarks at refined scale: " << numNeighbors[i] << std::endl;
+        std::cout << "#thresholded landmarks at refined scale: " << refinedLandmarks[i].size() << std::endl;
+    }
+    std::cout << "Refining embedding.." << std::endl;
+
+    // Compute the transition matrices for the landmarks above the threshold
+    std::vector<HsneMatrix> refinedTransitionMatrices;
+    _hsneHierarchy.getTransitionMatricesForSelections(_currentScaleLevel, refinedTransitionMatrices, refinedLandmarks);
+
+    // Create all refined datasets before starting their embeddings
+    std::vector<std::pair<HsneScaleAction*, size_t>> refinedScaleActions;
+
+    for (size_t i = 0; i < refinedLandmarks.size(); i++)
+    {
+        if (refinedLandmarks[i].empty())
+        {
+            std::cout << "Skipping refinement without landmarks at the refined scale" << std::endl;
+            continue;
+        }
+
+        refinedScaleActions.emplace_back(addRefinedScale(refinedLandmarks[i], refinedScaleLevel), i);
+    }
+
+    // Handle tasks
+    _initializationTask.setFinished();
+
+    // Get gradient descent settings from top level if applicable
+    if (_isTopScale)
+    {
+        assert(_tsneParametersTopLevel != nullptr);
+        _tsneParameters.setExaggerationIter(_tsneParametersTopLevel->getExaggerationIter());
+        _tsneParameters.setExponentialDecayIter(_tsneParametersTopLevel->getExponentialDecayIter());
+    }
+
+    TsneParameters warmStartParameters = _tsneParameters;
+    warmStartParameters.setExaggerationIter(static_cast<int>(_tsneParameters.getExaggerationIter() * _WARM_START_EXAGGERATION_FRACTION_));
+    warmStartParameters.setExponentialDecayIter(static_cast<int>(_tsneParameters.getExponentialDecayIter() * _WARM_START_EXAGGERATION_FRACTION_));
+
+    // Every refinement is embedded by the t-SNE analysis of its own scale action, such that they run side by side
+    for (const auto& [refinedScaleAction, i] : refinedScaleActions)
+    {
+        // Start the refined points where their landmarks are in this embedding
+        const std::vector<float> warmStartEmbedding = computeWarmStartEmbedding(refinedLandmarks[i]);
+
+        if (warmStartEmbedding.empty())
+            refinedScaleAction->startRefinedEmbedding(refinedTransitionMatrices[i], _tsneParameters, nullptr);
+        else
+            refinedScaleAction->startRefinedEmbedding(refinedTransitionMatrices[i], warmStartParameters, &warmStartEmbedding);
+    }
+}
+
+bool HsneScaleAction::refineFromSpeculativeRefinement(const std::vector<unsigned int>& selectedLandmarks)
+{
+    SpeculativeRefinements::Refinement refinement;
+    if (_speculativeRefinements == nullptr || !_speculativeRefinements->take(_currentScaleLevel, selectedLandmarks, refinement))
+        return false;
+
+    assert(_currentScaleLevel >= 1);
+    HsneScaleAction* refinedScaleAction = addRefinedScale(refinement.refinedLandmarks, _currentScaleLevel - 1);
+
+    // Show the precomputed embedding right away
+    auto& refineEmbedding = refinedScaleAction->_embedding;
+    refineEmbedding->setData(refinement.embedding.data(), refinement.refinedLandmarks.size(), 2);
+    refinedScaleAction->getNumberOfComputatedIterationsAction().setValue(refinement.numIterations - 1);
+    events().notifyDatasetDataChanged(refineEmbedding);
+
+    // Get gradient descent settings from top level if applicable
+    if (_isTopScale)
+    {
+        assert(_tsneParametersTopLevel != nullptr);
+        _tsneParameters.setExaggerationIter(_tsneParametersTopLevel->getExaggerationIter());
+        _tsneParameters.setExponentialDecayIter(_tsneParametersTopLevel->getExponentialDecayIter());
+    }
+
+    // Continue with the remaining iterations
+    TsneParameters continueParameters = _tsneParameters;
+    continueParameters.setNumIterations(std::max(_tsneParameters.getNumIterations() - refinement.numIterations, 0));
+
+    refinedScaleAction->startRefinedEmbedding(refinement.transitionMatrix, continueParameters, &refinement.embedding, refinement.numIterations);
+
+    return true;
+}
+
+std::vector<unsigned int> HsneScaleAction::getSelectedLandmarks() const
+{
+    // Get the selection of points that are to be refined
+    auto selection = _embedding->getSelection<Points>();
+
     // Find proper selection indices
     std::vector<bool> selectedLocalIndices;
     _embedding->selectedLocalIndices(selection->indices, selectedLocalIndices);
@@ -243,53 +406,24 @@ void HsneScaleAction::refine()
             selectedLandmarks.push_back(_isTopScale ? i : _drillIndices[i]);
         }
     }
-    
-    // Find the points in the previous level corresponding to selected landmarks
-    std::map<uint32_t, float> neighbors;
-    _hsneHierarchy.getInfluencedLandmarksInPreviousScale(_currentScaleLevel, selectedLandmarks, neighbors);
-
-    // Threshold neighbours with enough influence, these represent the indices of the refined points relative to their HSNE scale
-    std::vector<uint32_t> refinedLandmarks; // Scale-relative indices
-    refinedLandmarks.clear();
-    for (const auto& n : neighbors) {
-        if (n.second > 0.5) //QUICKPAPER
-        {
-            refinedLandmarks.push_back(n.first);
-        }
-    }
-    std::cout << "#selected landmarks: " << selectedLandmarks.size() << std::endl;
-    std::cout << "#landmarks at refined scale: " << neighbors.size() << std::endl;
-    std::cout << "#thresholded landmarks at refined scale: " << refinedLandmarks.size() << std::endl;
-    std::cout << "Refining embedding.." << std::endl;
-    
+
+    return selectedLandmarks;
+}
+
+HsneScaleAction* HsneScaleAction::addRefinedScale(const std::vector<uint32_t>& refinedLandmarks, unsigned int refinedScaleLevel)
+{
     ////////////////////////////
     // Create refined dataset //
     ////////////////////////////
-    
-    // Compute the transition matrix for the landmarks above the threshold
-    HsneMatrix refinedTransitionMatrix;
-    _hsneHierarchy.getTransitionMatrixForSelection(_currentScaleLevel, refinedTransitionMatrix, refinedLandmarks);
 
     // Create a new data set for the embedding
     {
         auto selection = _input->getSelection<Points>();
 
-        Hsne::scale_type& refinedScale = _hsneHierarchy.getScale(refinedScaleLevel);
+        selection->indices.resize(refinedLandmarks.size());
 
-        selection->indices.clear();
-
-        if (_input->isFull())
-        {
-            for (int i = 0; i < refinedLandmarks.size(); i++)
-                selection->indices.push_back(refinedScale._landmark_to_original_data_idx[refinedLandmarks[i]]);
-        }
-        else
-        {
-            std::vector<unsigned int> globalIndices;
-            _input->getGlobalIndices(globalIndices);
-            for (int i = 0; i < refinedLandmarks.size(); i++)
-                selection->indices.push_back(globalIndices[refinedScale._landmark_to_original_data_idx[refinedLandmarks[i]]]);
-        }
+        for (int i = 0; i < refinedLandmarks.size(); i++)
+            selection->indices[i] = _hsneHierarchy.getLandmarkGlobalIndex(refinedScaleLevel, refinedLandmarks[i]);
 
         // Create invisble subset from input data, used for selection mapping
         auto selectionHelperCount = _input->getProperty("selectionHelperCount").toInt();
@@ -318,10 +452,8 @@ void HsneScaleAction::refine()
         datasetTask.setName("HSNE scale computation");
         datasetTask.setConfigurationFlag(Task::ConfigurationFlag::OverrideAggregateStatus);
 
-        _tsneAnalysis.setTask(&datasetTask);
-
         // Insert HsneScaleAction into new data set
-        _refinedScaledActions.push_back(new HsneScaleAction(this, _hsneHierarchy, _input, refineEmbedding, refinedScaleLevel));
+        _refinedScaledActions.push_back(new HsneScaleAction(this, _hsneHierarchy, _embeddingScheduler, _input, refineEmbedding, refinedScaleLevel));
         auto& _refinedScaledAction = _refinedScaledActions.back();
         _refinedScaledAction->initNonTopScale(refinedLandmarks);
 
@@ -333,75 +465,116 @@ void HsneScaleAction::refine()
     ///////////////////////////////////
     
     // Add linked selection between the refined embedding and the bottom level points
-    if (refinedScaleLevel > 0) // Only add a linked selection if it's not the bottom level already
+    if (refinedScaleLevel > 0 && _hsneHierarchy.hasSelectionMapping(refinedScaleLevel)) // Only add a linked selection if it's not the bottom level already and the scale is mapped
     {
-        LandmarkMap& landmarkMap = _hsneHierarchy.getInfluenceHierarchy().getMap()[refinedScaleLevel];
+        // Drill-in points are linked to global indices, which differ from the bottom level indices when the original input to HSNE was a subset
+        std::vector<unsigned int> keys(refinedLandmarks.size());
+        for (size_t i = 0; i < refinedLandmarks.size(); i++)
+            keys[i] = _hsneHierarchy.getLandmarkGlobalIndex(refinedScaleLevel, refinedLandmarks[i]);
 
         mv::SelectionMap mapping;
-        auto& selectionMap = mapping.getMap();
-
-        if (_input->isFull())
-        {
-            for (const unsigned int& scaleIndex : refinedLandmarks)
-            {
-                int bottomLevelIdx = _hsneHierarchy.getScale(refinedScaleLevel)._landmark_to_original_data_idx[scaleIndex];
-                selectionMap[bottomLevelIdx] = landmarkMap[scaleIndex];
-            }
-        }
-        else
-        {
-            // Link drill-in points to bottom level indices when the original input to HSNE was a subset
-            std::vector<unsigned int> globalIndices;
-            _input->getGlobalIndices(globalIndices);
-            for (const unsigned int& scaleIndex : refinedLandmarks)
-            {
-                std::vector<unsigned int> bottomMap = landmarkMap[scaleIndex];
-                // Transform bottom level indices to the global full set indices
-                for (int j = 0; j < bottomMap.size(); j++)
-                {
-                    bottomMap[j] = globalIndices[bottomMap[j]];
-                }
-                int bottomLevelIdx = _hsneHierarchy.getScale(refinedScaleLevel)._landmark_to_original_data_idx[scaleIndex];
-                selectionMap[globalIndices[bottomLevelIdx]] = bottomMap;
-            }
-        }
+        _hsneHierarchy.getSelectionMapping(refinedScaleLevel, refinedLandmarks, keys, mapping);
 
         _refineEmbeddings.back()->addLinkedData(_input, mapping);
     }
 
-    // Update embedding points when the TSNE analysis produces new data
-    connect(&_tsneAnalysis, &TsneAnalysis::embeddingUpdate, this, [this, refinedScaleLevel](const TsneData& tsneData) {
+    return _refinedScaledActions.back();
+}
 
-        auto& refineEmbedding = _refineEmbeddings.back();
+void HsneScaleAction::initUpdateEmbedding()
+{
+    auto& datasetTask = _embedding->getTask();
+    datasetTask.setName("Embed HSNE scale");
+    datasetTask.setConfigurationFlag(Task::ConfigurationFlag::OverrideAggregateStatus);
+    _tsneAnalysis.setTask(&datasetTask);
+    datasetTask.setRunning();
 
-        // Update the refine embedding with new data
-        refineEmbedding->setData(tsneData.getData().data(), tsneData.getNumPoints(), 2);
+    connect(&_tsneAnalysis, &TsneAnalysis::embeddingUpdate, this, [this](const TsneData& tsneData) {
+        _embedding->setData(tsneData.getData().data(), tsneData.getNumPoints(), 2);
+        getNumberOfComputatedIterationsAction().setValue(_tsneAnalysis.getNumIterations() - 1);
+        events().notifyDatasetDataChanged(_embedding);
+        });
+}
 
-        _refinedScaledActions.back()->getNumberOfComputatedIterationsAction().setValue(_tsneAnalysis.getNumIterations() - 1);
+void HsneScaleAction::startRefinedEmbedding(const HsneMatrix& transitionMatrix, const TsneParameters& parameters, const std::vector<float>* initEmbedding, int previousIterations)
+{
+    initUpdateEmbedding();
 
-        // Notify others that the embedding points have changed
-        events().notifyDatasetDataChanged(refineEmbedding);
-    });
+    // Start the embedding process
+    _tsneAnalysis.startComputation(parameters, transitionMatrix, static_cast<uint32_t>(transitionMatrix.size()), initEmbedding, previousIterations);
+}
 
-    // Handle tasks
-    _initializationTask.setFinished();
+std::vector<float> HsneScaleAction::computeWarmStartEmbedding(const std::vector<uint32_t>& refinedLandmarks) const
+{
+    const auto numParentPoints = _embedding->getNumPoints();
 
-    auto& datasetTask = _refineEmbeddings.back()->getTask();
-    datasetTask.setName("Embed HSNE scale");
-    datasetTask.setConfigurationFlag(Task::ConfigurationFlag::OverrideAggregateStatus);
-    _tsneAnalysis.setTask(&datasetTask);
-    datasetTask.setRunning();
+    if (numParentPoints == 0 || _embedding->getNumDimensions() != 2)
+        return {};
 
-    // Get gradient descent settings from top level if applicable
-    if (_isTopScale)
+    std::vector<float> parentPositions(2ull * numParentPoints);
+    _embedding->populateDataForDimensions<std::vector<float>, std::vector<unsigned int>>(parentPositions, { 0, 1 });
+
+    // Position of the landmarks of this scale in this embedding
+    std::unordered_map<uint32_t, uint32_t> parentLocalIndices;
+    if (!_isTopScale)
     {
-        assert(_tsneParametersTopLevel != nullptr);
-        _tsneParameters.setExaggerationIter(_tsneParametersTopLevel->getExaggerationIter());
-        _tsneParameters.setExponentialDecayIter(_tsneParametersTopLevel->getExponentialDecayIter());
+        parentLocalIndices.reserve(_drillIndices.size());
+        for (uint32_t i = 0; i < _drillIndices.size(); i++)
+            parentLocalIndices[_drillIndices[i]] = i;
     }
 
-    // Start the embedding process
-    _tsneAnalysis.startComputation(_tsneParameters, refinedTransitionMatrix, refinedLandmarks.size());
+    float minX = std::numeric_limits<float>::max(), maxX = std::numeric_limits<float>::lowest();
+    float minY = std::numeric_limits<float>::max(), maxY = std::numeric_limits<float>::lowest();
+    for (size_t i = 0; i < numParentPoints; i++)
+    {
+        minX = std::min(minX, parentPositions[2 * i]);
+        maxX = std::max(maxX, parentPositions[2 * i]);
+        minY = std::min(minY, parentPositions[2 * i + 1]);
+        maxY = std::max(maxY, parentPositions[2 * i + 1]);
+    }
+
+    // The area of influence of this scale gives the influence of its landmarks on every refined landmark
+    const auto& areaOfInfluence = _hsneHierarchy.getScale(_currentScaleLevel)._area_of_influence;
+    const auto numRefined = static_cast<std::int64_t>(refinedLandmarks.size());
+
+    std::vector<float> positions(2 * refinedLandmarks.size(), 0.f);
+
+#pragma omp parallel for
+    for (std::int64_t i = 0; i < numRefined; i++)
+    {
+        float x = 0, y = 0, sum = 0;
+
+        for (const auto& entry : areaOfInfluence[refinedLandmarks[i]])
+        {
+            uint32_t parentIndex = entry.first;
+            if (!_isTopScale)
+            {
+                const auto it = parentLocalIndices.find(entry.first);
+                if (it == parentLocalIndices.end())
+                    continue;
+                parentIndex = it->second;
+            }
+
+            if (parentIndex >= numParentPoints)
+                continue;
+
+            x += entry.second * parentPositions[2 * parentIndex];
+            y += entry.second * parentPositions[2 * parentIndex + 1];
+            sum += entry.second;
+        }
+
+        // Landmarks without an influencing landmark in this embedding start at its center
+        positions[2 * i]        = sum > 0 ? x / sum : (minX + maxX) / 2;
+        positions[2 * i + 1]    = sum > 0 ? y / sum : (minY + maxY) / 2;
+    }
+
+    std::mt19937 generator(static_cast<uint32_t>(refinedLandmarks.size()));
+    std::normal_distribution<float> jitter(0.f, std::max(_WARM_START_JITTER_ * std::max(maxX - minX, maxY - minY), std::numeric_limits<float>::min()));
+
+    for (float& position : positions)
+        position += jitter(generator);
+
+    return positions;
 }
 
 void HsneScaleAction::fromVariantMap(const QVariantMap& variantMap)
@@ -446,7 +619,7 @@ void HsneScaleAction::fromVariantMap(const QVariantMap& variantMap)
 
         _refineEmbeddings.push_back(refineEmbedding);
 
-        _refinedScaledActions.push_back(new HsneScaleAction(this, _hsneHierarchy, _input, refineEmbedding, refinedEmbeddingMap["refinedCurrentScaleLevel"].toUInt()));
+        _refinedScaledActions.push_back(new HsneScaleAction(this, _hsneHierarchy, _embeddingScheduler, _input, refineEmbedding, refinedEmbeddingMap["refinedCurrentScaleLevel"].toUInt()));
         HsneScaleAction* refinedScaledAction = _refinedScaledActions.back();
         refinedScaledAction->fromParentVariantMap(refinedEmbeddingMap);
 
@@ -12,14 +12,18 @@
 
 #include "PointData/PointData.h"
 
+#include <QPointer>
+
 using namespace mv;
 using namespace mv::gui;
 using namespace mv::util;
 
 class QMenu;
 
+class EmbeddingScheduler;
 class HsneAnalysisPlugin;
 class HsneHierarchy;
+class SpeculativeRefinements;
 class TsneParameters;
 
 namespace mv {
@@ -41,13 +45,14 @@ public:
      * Constructor
      * @param parent Pointer to parent object
      * @param hsneHierarchy Reference to HSNE hierarchy
+     * @param embeddingScheduler Reference to the scheduler of the embeddings of the plugin
      * @param inputDataset Smart pointer to input dataset
      * @param embeddingDataset Smart pointer to embedding dataset
      */
-    HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset);
+    HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, EmbeddingScheduler& embeddingScheduler, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset);
 
-    HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset, TsneParameters* tsneParametersTopLevel);
-    HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset, unsigned int scale);
+    HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, EmbeddingScheduler& embeddingScheduler, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset, TsneParameters* tsneParametersTopLevel);
+    HsneScaleAction(QObject* parent, HsneHierarchy& hsneHierarchy, EmbeddingScheduler& embeddingScheduler, Dataset<Points> inputDataset, Dataset<Points> embeddingDataset, unsigned int scale);
 
     ~HsneScaleAction();
 
@@ -58,13 +63,60 @@ public:
      */
     QMenu* getContextMenu(QWidget* parent = nullptr) override;
 
+    /**
+     * Refine several selections of this scale together, e.g. one per cluster. The influenced landmarks and transition matrices
+     * of all selections are computed in one sweep over the scale and all refined embeddings start together
+     * @param selections Per selection, the selected landmarks relative to this scale
+     */
+    void refine(const std::vector<std::vector<unsigned int>>& selections);
+
 private:
     /** Refine the landmarks based on the current selection */
     void refine();
 
+    /**
+     * Refine a selection that closely matches a precomputed refinement, see SpeculativeRefinements
+     * @param selectedLandmarks Selected landmarks, relative to this scale
+     * @return Whether a precomputed refinement was used
+     */
+    bool refineFromSpeculativeRefinement(const std::vector<unsigned int>& selectedLandmarks);
+
+    /** Selected landmarks of this embedding, relative to this scale */
+    std::vector<unsigned int> getSelectedLandmarks() const;
+
+    /**
+     * Create the embedding dataset and scale action of a refinement and link it to the input data
+     * @param refinedLandmarks Landmarks of the refined scale
+     * @param refinedScaleLevel Scale of the refinement, one below this scale
+     * @return Scale action of the refinement
+     */
+    HsneScaleAction* addRefinedScale(const std::vector<uint32_t>& refinedLandmarks, unsigned int refinedScaleLevel);
+
+    /** Show the updates of the t-SNE analysis in the embedding of this scale */
+    void initUpdateEmbedding();
+
+    /**
+     * Embed the landmarks of this refined scale, called by the scale it was refined from
+     * @param transitionMatrix Transition matrix between the landmarks of this scale
+     * @param parameters Gradient descent parameters
+     * @param initEmbedding Initial positions, nullptr for a random initialization
+     * @param previousIterations Iterations already spent on the initial positions, continues their gradient descent schedule, -1 for none
+     */
+    void startRefinedEmbedding(const std::vector<hdi::data::MapMemEff<uint32_t, float>>& transitionMatrix, const TsneParameters& parameters, const std::vector<float>* initEmbedding, int previousIterations = -1);
+
+    /**
+     * Initial positions of refined landmarks: the influence-weighted average position of their landmarks in this embedding plus a small jitter
+     * @param refinedLandmarks Landmarks of the refined scale
+     * @return Interleaved 2D positions, empty if this embedding has no positions yet
+     */
+    std::vector<float> computeWarmStartEmbedding(const std::vector<uint32_t>& refinedLandmarks) const;
+
     /** Add actions to GUI and connect them */
     void initLayoutAndConnection();
 
+    /** Stop keeping this scale in memory, once the embedding is removed or the action destroyed */
+    void releaseScale();
+
 public: // Action getters
 
     TriggerAction& getRefineAction() { return _refineAction; }
@@ -74,6 +126,9 @@ public: // Action getters
 public: // Setters
     void setScale(unsigned int scale) { _currentScaleLevel = scale; }
 
+    // Precomputed refinements of this scale, nullptr if there are none
+    void setSpeculativeRefinements(SpeculativeRefinements* speculativeRefinements) { _speculativeRefinements = speculativeRefinements; }
+
     // Sets drillIndices and add GrandienDescentSettings
     void initNonTopScale(const std::vector<uint32_t>& drillIndices);
 
@@ -100,6 +155,9 @@ private:
     TsneParameters          _tsneParameters;        /** TSNE paremeters */
     TsneAnalysis            _tsneAnalysis;          /** TSNE analysis */
     HsneHierarchy&          _hsneHierarchy;         /** Reference to HSNE hierarchy */
+    QPointer<HsneHierarchy> _retainingHierarchy;    /** Set while this scale is retained, null if the hierarchy is destroyed first */
+    EmbeddingScheduler&     _embeddingScheduler;    /** Shares the cores between the embeddings of the plugin */
+    SpeculativeRefinements* _speculativeRefinements;    /** Precomputed refinements of this scale, may be nullptr */
     Dataset<Points>         _input;                 /** Input dataset reference */
     Dataset<Points>         _embedding;             /** Embedding dataset reference */
     Datasets                _refineEmbeddings;      /** Refine embedding dataset references */
@@ -109,12 +167,15 @@ private:
 
 private:
     TriggerAction           _refineAction;          /** Refine action */
+    TriggerAction           _queueSelectionAction;  /** Queue the current selection for a batch refinement */
+    TriggerAction           _refineQueuedAction;    /** Refine all queued selections */
     TsneComputationAction   _computationAction;     /** Computation action */
 
     EventListener           _eventListener;         /** Listen to ManiVault events */
     mv::ForegroundTask      _initializationTask;    /** Task for reporting computation preparation progress */
 
     RefineScaleActions      _refinedScaledActions;  /** Scale actions of the refined datasets */
+    std::vector<std::vector<unsigned int>> _queuedSelections;   /** Selected landmarks of the queued selections, relative to this scale */
 
 protected:
     std::vector<uint32_t>   _drillIndices;          /** Vector relating local indices to scale relative indices */
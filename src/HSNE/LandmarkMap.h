@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * LandmarkMap
+ *
+ * Data points influenced by every landmark of one scale, stored flat in compressed sparse row layout:
+ * the points of landmark l are indices[offsets[l]] ... indices[offsets[l + 1] - 1].
+ * Replaces one heap allocation per landmark with two arrays per scale.
+ *
+ * The arrays are either owned or borrowed from memory kept alive by a shared storage handle,
+ * e.g. the pages of a memory-mapped cache file.
+ */
+class LandmarkMap
+{
+public:
+    /** Read-only range over the data points of one landmark */
+    class View
+    {
+    public:
+        View(const unsigned int* begin, const unsigned int* end) : _begin(begin), _end(end) {}
+
+        const unsigned int* begin() const { return _begin; }
+        const unsigned int* end() const { return _end; }
+        size_t size() const { return static_cast<size_t>(_end - _begin); }
+        bool empty() const { return _begin == _end; }
+        unsigned int operator[](size_t i) const { return _begin[i]; }
+
+    private:
+        const unsigned int* _begin;
+        const unsigned int* _end;
+    };
+
+public:
+    LandmarkMap() = default;
+
+    LandmarkMap(std::vector<std::uint64_t>&& offsets, std::vector<unsigned int>&& indices) :
+        _offsets(std::move(offsets)),
+        _indices(std::move(indices)),
+        _numLandmarks(_offsets.empty() ? 0 : _offsets.size() - 1)
+    {
+        assert(_offsets.empty() || _offsets.back() == _indices.size());
+    }
+
+    /**
+     * Borrow the arrays from external memory
+     * @param offsets numLandmarks + 1 offsets into indices
+     * @param indices Data point indices of all landmarks
+     * @param numLandmarks Number of landmarks
+     * @param storage Keeps the memory of offsets and indices valid for the lifetime of this map and its copies
+     */
+    LandmarkMap(const std::uint64_t* offsets, const unsigned int* indices, size_t numLandmarks, std::shared_ptr<const void> storage) :
+        _storage(std::move(storage)),
+        _borrowedOffsets(offsets),
+        _borrowedIndices(indices),
+        _numLandmarks(numLandmarks)
+    {
+    }
+
+    /** Number of landmarks */
+    size_t size() const { return _numLandmarks; }
+
+    /** Data points influenced by a landmark */
+    View operator[](size_t landmark) const {
+        assert(landmark < size());
+        const std::uint64_t* offsets = offsetsData();
+        return View(indicesData() + offsets[landmark], indicesData() + offsets[landmark + 1]);
+    }
+
+    /** Number of landmarks + 1 offsets, nullptr when empty */
+    const std::uint64_t* offsetsData() const { return _storage ? _borrowedOffsets : (_offsets.empty() ? nullptr : _offsets.data()); }
+    const unsigned int* indicesData() const { return _storage ? _borrowedIndices : _indices.data(); }
+
+    /** Total number of data point indices */
+    size_t numIndices() const { return _numLandmarks == 0 ? 0 : static_cast<size_t>(offsetsData()[_numLandmarks]); }
+
+    /** Copy borrowed arrays into owned storage and release the external memory */
+    void detach() {
+        if (!_storage)
+            return;
+
+        const std::uint64_t* offsets = offsetsData();
+        _offsets.assign(offsets, offsets + _numLandmarks + 1);
+        _indices.assign(indicesData(), indicesData() + numIndices());
+
+        _storage.reset();
+        _borrowedOffsets = nullptr;
+        _borrowedIndices = nullptr;
+    }
+
+    void clear() {
+        _offsets.clear();
+        _indices.clear();
+        _storage.reset();
+        _borrowedOffsets = nullptr;
+        _borrowedIndices = nullptr;
+        _numLandmarks = 0;
+    }
+
+private:
+    std::vector<std::uint64_t>  _offsets;                       /** Start of every landmark in _indices, number of landmarks + 1 entries */
+    std::vector<unsigned int>   _indices;                       /** Data point indices of all landmarks, sorted per landmark */
+
+    std::shared_ptr<const void> _storage;                       /** Owner of the borrowed arrays, empty for owned arrays */
+    const std::uint64_t*        _borrowedOffsets = nullptr;     /** Offsets in external memory */
+    const unsigned int*         _borrowedIndices = nullptr;     /** Indices in external memory */
+
+    size_t                      _numLandmarks = 0;              /** Number of landmarks */
+};
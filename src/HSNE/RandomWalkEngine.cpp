@@ -0,0 +1,194 @@
+#include "RandomWalkEngine.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+    // Finalizer of splitmix64, a bijection that mixes all bits
+    inline std::uint64_t mix(std::uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // Separate streams for the walk types, a start point draws different numbers for the landmark selection and the area of influence
+    constexpr std::uint64_t _END_POINT_STREAM_ = 1;
+    constexpr std::uint64_t _STOP_STREAM_ = 2;
+
+    /** Counter-based random stream: the k-th number only depends on the key and k */
+    class WalkRandom
+    {
+    public:
+        WalkRandom(std::uint64_t seed, std::uint64_t stream, std::uint64_t point, std::uint64_t walk) :
+            _key(mix(mix(mix(seed) ^ stream) ^ point) ^ walk),
+            _counter(0)
+        {
+        }
+
+        std::uint64_t next() { return mix(_key + ++_counter * 0x9e3779b97f4a7c15ULL); }
+
+    private:
+        std::uint64_t _key;
+        std::uint64_t _counter;
+    };
+}
+
+RandomWalkEngine::RandomWalkEngine(const HsneMatrix& transitionMatrix, std::uint64_t seed) :
+    _seed(seed),
+    _offsets(transitionMatrix.size() + 1, 0),
+    _slots()
+{
+    const auto numPoints = static_cast<std::int64_t>(transitionMatrix.size());
+
+    for (std::int64_t i = 0; i < numPoints; i++)
+        _offsets[i + 1] = _offsets[i] + transitionMatrix[i].size();
+
+    _slots.resize(_offsets.back());
+
+    // Vose's alias method per row, every row only writes its own slots
+#pragma omp parallel
+    {
+        std::vector<float> scaled;
+        std::vector<std::uint32_t> small, large;
+
+#pragma omp for schedule(dynamic, 256)
+        for (std::int64_t i = 0; i < numPoints; i++)
+        {
+            const auto& row = transitionMatrix[i].memory();
+            Slot* slots = _slots.data() + _offsets[i];
+            const auto numSlots = static_cast<std::uint32_t>(row.size());
+
+            float sum = 0.f;
+            for (const auto& entry : row)
+                sum += entry.second;
+
+            scaled.resize(numSlots);
+            small.clear();
+            large.clear();
+
+            for (std::uint32_t k = 0; k < numSlots; k++)
+            {
+                scaled[k] = sum > 0.f ? row[k].second * numSlots / sum : 1.f;
+                slots[k] = { row[k].first, row[k].first, 1.f };
+
+                if (scaled[k] < 1.f)
+                    small.push_back(k);
+                else
+                    large.push_back(k);
+            }
+
+            while (!small.empty() && !large.empty())
+            {
+                const std::uint32_t s = small.back();
+                const std::uint32_t l = large.back();
+                small.pop_back();
+
+                slots[s].threshold = scaled[s];
+                slots[s].alias = row[l].first;
+
+                scaled[l] -= 1.f - scaled[s];
+                if (scaled[l] < 1.f)
+                {
+                    large.pop_back();
+                    small.push_back(l);
+                }
+            }
+
+            // Rounding leaves slots that are (almost) full, they always move to their own target
+            for (const std::uint32_t k : small)
+                slots[k].threshold = 1.f;
+            for (const std::uint32_t k : large)
+                slots[k].threshold = 1.f;
+        }
+    }
+}
+
+std::uint32_t RandomWalkEngine::step(std::uint32_t point, std::uint64_t random) const
+{
+    const std::uint64_t begin = _offsets[point];
+    const std::uint64_t numSlots = _offsets[point + 1] - begin;
+
+    if (numSlots == 0)
+        return point;
+
+    // The upper 32 bits pick the slot, the lower 24 bits decide between target and alias
+    const Slot& slot = _slots[begin + (((random >> 32) * numSlots) >> 32)];
+    const float u = static_cast<float>(random & 0xffffff) * (1.f / 16777216.f);
+
+    return u < slot.threshold ? slot.target : slot.alias;
+}
+
+void RandomWalkEngine::countEndPoints(std::uint32_t numWalks, std::uint32_t walkLength, std::vector<std::uint32_t>& endPointCounts) const
+{
+    const auto numPoints = static_cast<std::int64_t>(getNumPoints());
+
+    endPointCounts.assign(numPoints, 0);
+
+    // Sums of counts do not depend on the order of the increments
+#pragma omp parallel for schedule(dynamic, 256)
+    for (std::int64_t i = 0; i < numPoints; i++)
+    {
+        for (std::uint32_t w = 0; w < numWalks; w++)
+        {
+            WalkRandom random(_seed, _END_POINT_STREAM_, i, w);
+
+            auto point = static_cast<std::uint32_t>(i);
+            for (std::uint32_t s = 0; s < walkLength; s++)
+                point = step(point, random.next());
+
+#pragma omp atomic
+            endPointCounts[point]++;
+        }
+    }
+}
+
+void RandomWalkEngine::countStops(const std::vector<int>& stoppingPoints, std::uint32_t numWalks, std::uint32_t maxWalkLength, HsneMatrix& stopCounts) const
+{
+    assert(stoppingPoints.size() == getNumPoints());
+
+    const auto numPoints = static_cast<std::int64_t>(getNumPoints());
+
+    stopCounts.clear();
+    stopCounts.resize(numPoints);
+
+#pragma omp parallel
+    {
+        std::vector<std::uint32_t> stops;
+
+#pragma omp for schedule(dynamic, 256)
+        for (std::int64_t i = 0; i < numPoints; i++)
+        {
+            stops.clear();
+
+            for (std::uint32_t w = 0; w < numWalks; w++)
+            {
+                WalkRandom random(_seed, _STOP_STREAM_, i, w);
+
+                auto point = static_cast<std::uint32_t>(i);
+                for (std::uint32_t s = 0; s < maxWalkLength && stoppingPoints[point] < 0; s++)
+                    point = step(point, random.next());
+
+                if (stoppingPoints[point] >= 0)
+                    stops.push_back(static_cast<std::uint32_t>(stoppingPoints[point]));
+            }
+
+            std::sort(stops.begin(), stops.end());
+
+            auto& row = stopCounts[i].memory();
+            for (size_t k = 0; k < stops.size();)
+            {
+                size_t end = k;
+                while (end < stops.size() && stops[end] == stops[k])
+                    end++;
+
+                row.emplace_back(stops[k], static_cast<float>(end - k));
+                k = end;
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "hdi/data/map_mem_eff.h"
+
+#include <cstdint>
+#include <vector>
+
+using HsneMatrix = std::vector<hdi::data::MapMemEff<uint32_t, float>>;
+
+/**
+ * RandomWalkEngine
+ *
+ * Random walks on the transition matrix of an HSNE scale, as used for the landmark selection and the area of influence.
+ * Every row is turned into an alias table once, all tables are stored in one flat array: a step costs one random
+ * number and a single lookup, independent of the number of neighbors.
+ * Walks run in parallel. Every walk draws from its own counter-based random stream, keyed by the seed, the start point
+ * and the walk number, so the results only depend on the seed and not on the number of threads or their scheduling.
+ */
+class RandomWalkEngine
+{
+public:
+    /**
+     * Build the alias tables of all rows
+     * @param transitionMatrix Transition probabilities, rows do not have to sum to one. Points without transitions stay in place.
+     * @param seed Seed of all random streams
+     */
+    RandomWalkEngine(const HsneMatrix& transitionMatrix, std::uint64_t seed);
+
+    std::uint32_t getNumPoints() const { return static_cast<std::uint32_t>(_offsets.size() - 1); }
+
+    /**
+     * Walks of a fixed length from every point
+     * @param numWalks Walks per point
+     * @param walkLength Steps per walk
+     * @param endPointCounts Output, per point the number of walks that ended there
+     */
+    void countEndPoints(std::uint32_t numWalks, std::uint32_t walkLength, std::vector<std::uint32_t>& endPointCounts) const;
+
+    /**
+     * Walks from every point that stop at the first stopping point they reach, walks from a stopping point stop right away
+     * @param stoppingPoints Per point, its index among the stopping points or -1
+     * @param numWalks Walks per point
+     * @param maxWalkLength Walks that do not reach a stopping point within this number of steps are discarded
+     * @param stopCounts Output, per point the number of walks that stopped at every stopping point, sorted by stopping point index
+     */
+    void countStops(const std::vector<int>& stoppingPoints, std::uint32_t numWalks, std::uint32_t maxWalkLength, HsneMatrix& stopCounts) const;
+
+private:
+    /** Alias table entry: the slot moves to target with probability threshold, to alias otherwise */
+    struct Slot
+    {
+        std::uint32_t   target;
+        std::uint32_t   alias;
+        float           threshold;
+    };
+
+    /** Next point of a walk at point, drawn with one 64 bit random number */
+    std::uint32_t step(std::uint32_t point, std::uint64_t random) const;
+
+    std::uint64_t               _seed;
+    std::vector<std::uint64_t>  _offsets;       /** Start of the alias table of every point in _slots, number of points + 1 entries */
+    std::vector<Slot>           _slots;         /** Alias tables of all points, one slot per transition */
+};
@@ -0,0 +1,299 @@
+#include "SpeculativeRefinements.h"
+
+#include "EmbeddingScheduler.h"
+
+#include <QThread>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <utility>
+
+namespace
+{
+    // Only clusters of this size take long enough to refine to be worth precomputing
+    constexpr size_t _MIN_CLUSTER_SIZE_ = 10;
+
+    // Largest clusters that are precomputed
+    constexpr size_t _MAX_CLUSTERS_ = 8;
+
+    constexpr int _MAX_PROPAGATION_ITERATIONS_ = 20;
+
+    // Minimum Jaccard index between a selection and a cluster to use the precomputed refinement
+    constexpr float _MIN_JACCARD_INDEX_ = 0.9f;
+
+    /** Cluster label per landmark from label propagation on the symmetrized transition matrix, deterministic */
+    std::vector<unsigned int> propagateLabels(const HsneMatrix& transitionMatrix)
+    {
+        const size_t numLandmarks = transitionMatrix.size();
+
+        std::vector<std::vector<std::pair<uint32_t, float>>> neighbors(numLandmarks);
+        for (uint32_t i = 0; i < numLandmarks; i++)
+        {
+            for (const auto& [j, probability] : transitionMatrix[i])
+            {
+                if (j == i)
+                    continue;
+
+                neighbors[i].emplace_back(j, probability);
+                neighbors[j].emplace_back(i, probability);
+            }
+        }
+
+        std::vector<unsigned int> labels(numLandmarks);
+        std::iota(labels.begin(), labels.end(), 0u);
+
+        std::vector<float> labelWeights(numLandmarks, 0.f);
+        std::vector<unsigned int> neighborLabels;
+
+        // Asynchronous updates in index order, ties go to the smallest label
+        for (int iteration = 0; iteration < _MAX_PROPAGATION_ITERATIONS_; iteration++)
+        {
+            size_t numChanged = 0;
+
+            for (uint32_t i = 0; i < numLandmarks; i++)
+            {
+                if (neighbors[i].empty())
+                    continue;
+
+                neighborLabels.clear();
+                for (const auto& [j, weight] : neighbors[i])
+                {
+                    if (labelWeights[labels[j]] == 0.f)
+                        neighborLabels.push_back(labels[j]);
+
+                    labelWeights[labels[j]] += weight;
+                }
+
+                unsigned int bestLabel = labels[i];
+                float bestWeight = -1.f;
+                for (const unsigned int label : neighborLabels)
+                {
+                    if (labelWeights[label] > bestWeight || (labelWeights[label] == bestWeight && label < bestLabel))
+                    {
+                        bestLabel = label;
+                        bestWeight = labelWeights[label];
+                    }
+
+                    labelWeights[label] = 0.f;
+                }
+
+                if (bestLabel != labels[i])
+                {
+                    labels[i] = bestLabel;
+                    numChanged++;
+                }
+            }
+
+            if (numChanged == 0)
+                break;
+        }
+
+        return labels;
+    }
+
+    float jaccardIndex(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b)
+    {
+        size_t numShared = 0;
+        for (auto itA = a.begin(), itB = b.begin(); itA != a.end() && itB != b.end();)
+        {
+            if (*itA < *itB)
+                ++itA;
+            else if (*itB < *itA)
+                ++itB;
+            else
+            {
+                numShared++;
+                ++itA;
+                ++itB;
+            }
+        }
+
+        const size_t numUnion = a.size() + b.size() - numShared;
+        return numUnion > 0 ? static_cast<float>(numShared) / numUnion : 0.f;
+    }
+}
+
+SpeculativeRefinements::SpeculativeRefinements(HsneHierarchy& hierarchy, EmbeddingScheduler& embeddingScheduler, QObject* parent) :
+    QObject(parent),
+    _hierarchy(hierarchy),
+    _embeddingScheduler(embeddingScheduler),
+    _scale(-1),
+    _generation(0),
+    _precomputations()
+{
+}
+
+SpeculativeRefinements::~SpeculativeRefinements()
+{
+    clear();
+}
+
+void SpeculativeRefinements::start(int scale, const TsneParameters& parameters)
+{
+    clear();
+
+    assert(scale >= 1);
+    _scale = scale;
+
+    // Cluster the landmarks of the scale on a copy of its transition matrix, the thread does not access this object
+    auto transitionMatrix = std::make_shared<const HsneMatrix>(_hierarchy.getScale(scale)._transition_matrix);
+    auto labels = std::make_shared<std::vector<unsigned int>>();
+
+    QThread* thread = QThread::create([transitionMatrix, labels]() {
+        *labels = propagateLabels(*transitionMatrix);
+        });
+
+    // Queued to this thread, the labels are dropped if clear() was called in the meantime
+    connect(thread, &QThread::finished, this, [this, scale, parameters, labels, generation = _generation]() {
+        if (generation == _generation)
+            startEmbeddings(scale, *labels, parameters);
+        });
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    thread->start();
+}
+
+void SpeculativeRefinements::startEmbeddings(int scale, const std::vector<unsigned int>& labels, const TsneParameters& parameters)
+{
+    const size_t numLandmarks = labels.size();
+
+    std::vector<std::vector<unsigned int>> clusters;
+    {
+        std::vector<int> clusterOfLabel(numLandmarks, -1);
+        for (unsigned int landmark = 0; landmark < numLandmarks; landmark++)
+        {
+            int& cluster = clusterOfLabel[labels[landmark]];
+            if (cluster < 0)
+            {
+                cluster = static_cast<int>(clusters.size());
+                clusters.emplace_back();
+            }
+
+            clusters[cluster].push_back(landmark);
+        }
+    }
+
+    // Refining (almost) the whole scale is not what an analyst selects
+    clusters.erase(std::remove_if(clusters.begin(), clusters.end(), [numLandmarks](const auto& cluster) {
+        return cluster.size() < _MIN_CLUSTER_SIZE_ || 2 * cluster.size() > numLandmarks;
+        }), clusters.end());
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const auto& a, const auto& b) { return a.size() > b.size(); });
+
+    if (clusters.size() > _MAX_CLUSTERS_)
+        clusters.resize(_MAX_CLUSTERS_);
+
+    std::cout << "Pre-embedding the refinements of " << clusters.size() << " clusters of scale " << scale << std::endl;
+
+    if (clusters.empty())
+        return;
+
+    // Extract all refinements at once, like a batch refinement
+    std::vector<std::vector<uint32_t>> refinedLandmarks;
+    _hierarchy.getInfluencedLandmarksInPreviousScale(scale, clusters, 0.5f /* QUICKPAPER */, refinedLandmarks);
+
+    std::vector<HsneMatrix> transitionMatrices;
+    _hierarchy.getTransitionMatricesForSelections(scale, transitionMatrices, refinedLandmarks);
+
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        if (refinedLandmarks[c].empty())
+            continue;
+
+        auto precomputation = std::make_unique<Precomputation>();
+        precomputation->cluster = std::move(clusters[c]);
+        precomputation->refinement.refinedLandmarks = std::move(refinedLandmarks[c]);
+        precomputation->refinement.transitionMatrix = std::move(transitionMatrices[c]);
+        precomputation->task = std::make_unique<mv::BackgroundTask>(nullptr, QString("Pre-embed HSNE cluster %1").arg(c + 1));
+        precomputation->analysis = std::make_unique<TsneAnalysis>();
+
+        TsneAnalysis* analysis = precomputation->analysis.get();
+        analysis->setTask(precomputation->task.get());
+
+        _embeddingScheduler.add(analysis, /* background = */ true);
+
+        // Looked up by analysis, the precomputation may have been taken in the meantime
+        connect(analysis, &TsneAnalysis::embeddingUpdate, this, [this, analysis](const TsneData& tsneData) {
+            auto it = std::find_if(_precomputations.begin(), _precomputations.end(), [analysis](const auto& precomputation) { return precomputation->analysis.get() == analysis; });
+            if (it == _precomputations.end())
+                return;
+
+            (*it)->refinement.embedding = tsneData.getData();
+            (*it)->refinement.numIterations = analysis->getNumIterations();
+        });
+
+        const auto numPoints = static_cast<uint32_t>(precomputation->refinement.refinedLandmarks.size());
+
+        precomputation->task->setRunning();
+        analysis->startComputation(parameters, precomputation->refinement.transitionMatrix, numPoints);
+
+        _precomputations.push_back(std::move(precomputation));
+    }
+
+    // The transition matrices were extracted, the refined scale is not displayed yet
+    _hierarchy.spillInactiveScales();
+}
+
+void SpeculativeRefinements::clear()
+{
+    for (auto& precomputation : _precomputations)
+    {
+        TsneAnalysis* analysis = precomputation->analysis.release();
+        analysis->stopComputation();
+        disconnect(analysis, nullptr, this, nullptr);
+
+        // The worker finishes its current iteration before the analysis and then its task are deleted
+        analysis->deleteLater();
+        precomputation->task.release()->deleteLater();
+    }
+
+    _precomputations.clear();
+    _scale = -1;
+    _generation++;
+}
+
+bool SpeculativeRefinements::take(int scale, const std::vector<unsigned int>& selectedLandmarks, Refinement& refinement)
+{
+    if (scale != _scale)
+        return false;
+
+    std::vector<unsigned int> selection(selectedLandmarks);
+    std::sort(selection.begin(), selection.end());
+
+    auto bestMatch = _precomputations.end();
+    float bestJaccardIndex = _MIN_JACCARD_INDEX_;
+
+    for (auto it = _precomputations.begin(); it != _precomputations.end(); ++it)
+    {
+        if ((*it)->refinement.embedding.empty())
+            continue;
+
+        const float jaccard = jaccardIndex(selection, (*it)->cluster);
+        if (jaccard >= bestJaccardIndex)
+        {
+            bestMatch = it;
+            bestJaccardIndex = jaccard;
+        }
+    }
+
+    if (bestMatch == _precomputations.end())
+        return false;
+
+    std::cout << "Refining from a pre-embedded cluster (Jaccard index " << bestJaccardIndex << ")" << std::endl;
+
+    Precomputation& precomputation = **bestMatch;
+
+    TsneAnalysis* analysis = precomputation.analysis.release();
+    analysis->stopComputation();
+    disconnect(analysis, nullptr, this, nullptr);
+    analysis->deleteLater();
+    precomputation.task.release()->deleteLater();
+
+    refinement = std::move(precomputation.refinement);
+    _precomputations.erase(bestMatch);
+
+    return true;
+}
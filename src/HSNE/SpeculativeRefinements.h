@@ -0,0 +1,82 @@
+#pragma once
+
+#include "HsneHierarchy.h"
+#include "TsneAnalysis.h"
+#include "TsneParameters.h"
+
+#include <Task.h>
+
+#include <QObject>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class EmbeddingScheduler;
+
+/**
+ * SpeculativeRefinements
+ *
+ * Refined embeddings of likely selections, computed in the background while the analyst looks at an embedding.
+ * The landmarks of a scale are clustered by label propagation on its transition matrix and the refinement
+ * of every cluster is embedded at low priority, see EmbeddingScheduler. A refinement of a selection that
+ * closely matches a cluster then starts from the precomputed embedding.
+ */
+class SpeculativeRefinements : public QObject
+{
+    Q_OBJECT
+
+public:
+    /** Precomputed refinement of a cluster, handed over by take() */
+    struct Refinement
+    {
+        std::vector<uint32_t>   refinedLandmarks;       /** Landmarks of the refined scale */
+        HsneMatrix              transitionMatrix;       /** Transition matrix between the refined landmarks */
+        std::vector<float>      embedding;              /** Interleaved 2D positions of the refined landmarks */
+        int                     numIterations = 0;      /** Gradient descent iterations of the embedding */
+    };
+
+public:
+    SpeculativeRefinements(HsneHierarchy& hierarchy, EmbeddingScheduler& embeddingScheduler, QObject* parent = nullptr);
+    ~SpeculativeRefinements() override;
+
+    /**
+     * Cluster a scale on a worker thread and then start embedding the refinement of every cluster in the background
+     * @param scale Scale to cluster, must be above the data scale
+     * @param parameters Gradient descent parameters of the refined embeddings
+     */
+    void start(int scale, const TsneParameters& parameters);
+
+    /** Stop all precomputations and discard their results, e.g. when the hierarchy changes */
+    void clear();
+
+    /** Whether start() was called for this scale since the last clear() */
+    bool isStarted(int scale) const { return _scale == scale; }
+
+    /**
+     * Hand over the precomputed refinement of a selection, its precomputation stops
+     * @param scale Scale of the selected landmarks
+     * @param selectedLandmarks Selected landmarks, relative to the scale
+     * @param refinement Output, the precomputed refinement
+     * @return Whether a cluster with an embedding matches the selection, by a Jaccard index of at least 0.9
+     */
+    bool take(int scale, const std::vector<unsigned int>& selectedLandmarks, Refinement& refinement);
+
+private:
+    /** Start embedding the refinements of the clusters, called with the labels of the worker */
+    void startEmbeddings(int scale, const std::vector<unsigned int>& labels, const TsneParameters& parameters);
+
+    struct Precomputation
+    {
+        std::vector<unsigned int>           cluster;    /** Landmarks of the clustered scale, sorted */
+        Refinement                          refinement;
+        std::unique_ptr<mv::BackgroundTask> task;
+        std::unique_ptr<TsneAnalysis>       analysis;
+    };
+
+    HsneHierarchy&              _hierarchy;
+    EmbeddingScheduler&         _embeddingScheduler;
+    int                         _scale;                 /** Clustered scale, -1 if not started */
+    unsigned int                _generation;            /** Incremented by clear(), labels of an earlier start() are discarded */
+    std::vector<std::unique_ptr<Precomputation>> _precomputations;
+};
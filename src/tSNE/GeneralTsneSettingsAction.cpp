@@ -1,6 +1,9 @@
 #include "GeneralTsneSettingsAction.h"
 #include "TsneSettingsAction.h"
 
+#include <QDebug>
+#include <QRegularExpression>
+
 using namespace mv::gui;
 
 GeneralTsneSettingsAction::GeneralTsneSettingsAction(TsneSettingsAction& tsneSettingsAction) :
@@ -9,28 +12,51 @@ GeneralTsneSettingsAction::GeneralTsneSettingsAction(TsneSettingsAction& tsneSet
     _knnAlgorithmAction(this, "kNN Algorithm"),
     _distanceMetricAction(this, "Distance metric"),
     _perplexityAction(this, "Perplexity"),
+    _similarityTypeAction(this, "Similarities"),
+    _numNeighborsUniformAction(this, "Uniform kernel kNN"),
+    _progressiveSimilaritiesAction(this, "Progressive kNN", false),
+    _multiscaleAction(this, "Multi-scale perplexity", false),
+    _multiscalePerplexitiesAction(this, "Perplexities", "10, 30, 100"),
     _computationAction(this),
     _reinitAction(this, "Reintialize instead of recompute", false),
-    _saveProbDistAction(this, "Save analysis to projects", false)
+    _saveProbDistAction(this, "Save analysis to projects", false),
+    _collapseDuplicatesAction(this, "Collapse duplicate points", false)
 {
     addAction(&_knnAlgorithmAction);
     addAction(&_distanceMetricAction);
     addAction(&_perplexityAction);
+    addAction(&_similarityTypeAction);
+    addAction(&_numNeighborsUniformAction);
+    addAction(&_multiscaleAction);
+    addAction(&_multiscalePerplexitiesAction);
+    addAction(&_progressiveSimilaritiesAction);
     
     _computationAction.addActions();
 
     addAction(&_reinitAction);
     addAction(&_saveProbDistAction);
+    addAction(&_collapseDuplicatesAction);
 
     _knnAlgorithmAction.setDefaultWidgetFlags(OptionAction::ComboBox);
     _distanceMetricAction.setDefaultWidgetFlags(OptionAction::ComboBox);
     _perplexityAction.setDefaultWidgetFlags(IntegralAction::SpinBox | IntegralAction::Slider);
+    _similarityTypeAction.setDefaultWidgetFlags(OptionAction::ComboBox);
+    _numNeighborsUniformAction.setDefaultWidgetFlags(IntegralAction::SpinBox | IntegralAction::Slider);
 
-    _knnAlgorithmAction.initialize(QStringList({ "FLANN", "HNSW", "ANNOY" }), "FLANN");
+    _knnAlgorithmAction.initialize(QStringList({ "FLANN", "HNSW", "ANNOY", "VP-Tree (exact)" }), "FLANN");
     _distanceMetricAction.initialize(QStringList({ "Euclidean", "Cosine", "Inner Product", "Manhattan", "Hamming", "Dot" }), "Euclidean");
     _perplexityAction.initialize(2, 50, 30);
+    _similarityTypeAction.initialize(QStringList({ "Gaussian", "Uniform" }), "Gaussian");
+    _numNeighborsUniformAction.initialize(2, 100, 15);
 
+    _knnAlgorithmAction.setToolTip("VP-Tree (exact): exact nearest neighbors, fast for data with few dimensions.\nSupports the Euclidean, Cosine and Manhattan metrics, other metrics use the approximate library.");
     _reinitAction.setToolTip("Instead of recomputing knn, simply re-initialize t-SNE embedding and recompute gradient descent.");
+    _similarityTypeAction.setToolTip("Gaussian: perplexity-calibrated kernel over 3 * perplexity nearest neighbors.\nUniform: equal weights for a small number of nearest neighbors, no bandwidth search (faster).");
+    _multiscaleAction.setToolTip("Average the Gaussian similarities of several perplexities, computed from a single kNN search for the largest perplexity.");
+    _multiscalePerplexitiesAction.setToolTip("Comma-separated perplexities for the multi-scale similarities, e.g. 10, 30, 100");
+    _progressiveSimilaritiesAction.setToolTip("Start the embedding on a coarse, fast kNN graph and swap in the similarities of the configured kNN search once they are computed in the background.\nNot used with the exact VP-tree search.");
+    _numNeighborsUniformAction.setToolTip("Number of nearest neighbors used by the uniform kernel, e.g. 10-15");
+    _collapseDuplicatesAction.setToolTip("Embed identical data points only once, weighted by their number, and place all duplicates at the same position.");
     _saveProbDistAction.setToolTip("When saving the t-SNE analysis with your project, you can compute additional iterations without recomputing similarities from scratch.");
 
     const auto updateKnnAlgorithm = [this]() -> void {
@@ -42,6 +68,9 @@ GeneralTsneSettingsAction::GeneralTsneSettingsAction(TsneSettingsAction& tsneSet
 
         if (_knnAlgorithmAction.getCurrentText() == "ANNOY")
             _tsneSettingsAction.getKnnParameters().setKnnAlgorithm(hdi::dr::knn_library::KNN_ANNOY);
+
+        // Falls back to the previously selected library for metrics that the exact search does not support
+        _tsneSettingsAction.getKnnParameters().setExactKnn(_knnAlgorithmAction.getCurrentText() == "VP-Tree (exact)");
     };
 
     const auto updateDistanceMetric = [this]() -> void {
@@ -72,6 +101,42 @@ GeneralTsneSettingsAction::GeneralTsneSettingsAction(TsneSettingsAction& tsneSet
         _tsneSettingsAction.getTsneParameters().setPerplexity(_perplexityAction.getValue());
     };
 
+    const auto updateSimilarityType = [this]() -> void {
+        if (_similarityTypeAction.getCurrentText() == "Gaussian")
+            _tsneSettingsAction.getTsneParameters().setSimilarityType(SimilarityType::Gaussian);
+
+        if (_similarityTypeAction.getCurrentText() == "Uniform")
+            _tsneSettingsAction.getTsneParameters().setSimilarityType(SimilarityType::Uniform);
+    };
+
+    const auto updateMultiscalePerplexities = [this]() -> void {
+        std::vector<float> perplexities;
+
+        if (_multiscaleAction.isChecked())
+        {
+            for (const auto& token : _multiscalePerplexitiesAction.getString().split(QRegularExpression("[,;\\s]+"), Qt::SkipEmptyParts))
+            {
+                bool ok = false;
+                const auto perplexity = token.toFloat(&ok);
+                if (ok && perplexity >= 1.f)
+                    perplexities.push_back(perplexity);
+            }
+
+            if (perplexities.empty())
+                qWarning() << "GeneralTsneSettingsAction: no valid multi-scale perplexities, using the single perplexity instead";
+        }
+
+        _tsneSettingsAction.getTsneParameters().setMultiscalePerplexities(perplexities);
+    };
+
+    const auto updateProgressiveSimilarities = [this]() -> void {
+        _tsneSettingsAction.getTsneParameters().setProgressiveSimilarities(_progressiveSimilaritiesAction.isChecked());
+    };
+
+    const auto updateNumNeighborsUniform = [this]() -> void {
+        _tsneSettingsAction.getTsneParameters().setNumNeighborsUniform(_numNeighborsUniformAction.getValue());
+    };
+
     const auto updateCoreUpdate = [this]() -> void {
         _tsneSettingsAction.getTsneParameters().setUpdateCore(_computationAction.getUpdateIterationsAction().getValue());
     };
@@ -102,10 +167,16 @@ GeneralTsneSettingsAction::GeneralTsneSettingsAction(TsneSettingsAction& tsneSet
         _knnAlgorithmAction.setEnabled(enable);
         _distanceMetricAction.setEnabled(enable);
         _computationAction.getNumIterationsAction().setEnabled(enable);
-        _perplexityAction.setEnabled(enable);
+        _perplexityAction.setEnabled(enable && _similarityTypeAction.getCurrentText() == "Gaussian" && !_multiscaleAction.isChecked());
+        _multiscaleAction.setEnabled(enable && _similarityTypeAction.getCurrentText() == "Gaussian");
+        _multiscalePerplexitiesAction.setEnabled(enable && _similarityTypeAction.getCurrentText() == "Gaussian" && _multiscaleAction.isChecked());
+        _similarityTypeAction.setEnabled(enable);
+        _numNeighborsUniformAction.setEnabled(enable && _similarityTypeAction.getCurrentText() == "Uniform");
+        _progressiveSimilaritiesAction.setEnabled(enable);
         _computationAction.getUpdateIterationsAction().setEnabled(enable);
         _reinitAction.setEnabled(enable);
         _saveProbDistAction.setEnabled(enable);
+        _collapseDuplicatesAction.setEnabled(enable);
     };
 
     connect(&_knnAlgorithmAction, &OptionAction::currentIndexChanged, this, [this, updateKnnAlgorithm](const std::int32_t& currentIndex) {
@@ -124,6 +195,28 @@ GeneralTsneSettingsAction::GeneralTsneSettingsAction(TsneSettingsAction& tsneSet
         updatePerplexity();
     });
 
+    connect(&_similarityTypeAction, &OptionAction::currentIndexChanged, this, [this, updateSimilarityType, updateReadOnly](const std::int32_t& currentIndex) {
+        updateSimilarityType();
+        updateReadOnly();
+    });
+
+    connect(&_numNeighborsUniformAction, &IntegralAction::valueChanged, this, [this, updateNumNeighborsUniform](const std::int32_t& value) {
+        updateNumNeighborsUniform();
+    });
+
+    connect(&_multiscaleAction, &ToggleAction::toggled, this, [this, updateMultiscalePerplexities, updateReadOnly](const bool toggled) {
+        updateMultiscalePerplexities();
+        updateReadOnly();
+    });
+
+    connect(&_multiscalePerplexitiesAction, &StringAction::stringChanged, this, [this, updateMultiscalePerplexities](const QString& value) {
+        updateMultiscalePerplexities();
+    });
+
+    connect(&_progressiveSimilaritiesAction, &ToggleAction::toggled, this, [this, updateProgressiveSimilarities](const bool toggled) {
+        updateProgressiveSimilarities();
+    });
+
     connect(&_computationAction.getUpdateIterationsAction(), &IntegralAction::valueChanged, this, [this, updateCoreUpdate](const std::int32_t& value) {
         updateCoreUpdate();
     });
@@ -141,6 +234,10 @@ GeneralTsneSettingsAction::GeneralTsneSettingsAction(TsneSettingsAction& tsneSet
     updateDistanceMetric();
     updateNumIterations();
     updatePerplexity();
+    updateSimilarityType();
+    updateNumNeighborsUniform();
+    updateMultiscalePerplexities();
+    updateProgressiveSimilarities();
     updateCoreUpdate();
     updateReadOnly();
 
@@ -155,9 +252,15 @@ void GeneralTsneSettingsAction::fromVariantMap(const QVariantMap& variantMap)
     _knnAlgorithmAction.fromParentVariantMap(variantMap);
     _distanceMetricAction.fromParentVariantMap(variantMap);
     _perplexityAction.fromParentVariantMap(variantMap);
+    _similarityTypeAction.fromParentVariantMap(variantMap);
+    _numNeighborsUniformAction.fromParentVariantMap(variantMap);
+    _progressiveSimilaritiesAction.fromParentVariantMap(variantMap);
+    _multiscaleAction.fromParentVariantMap(variantMap);
+    _multiscalePerplexitiesAction.fromParentVariantMap(variantMap);
     _computationAction.fromParentVariantMap(variantMap);
     _reinitAction.fromParentVariantMap(variantMap);
     _saveProbDistAction.fromParentVariantMap(variantMap);
+    _collapseDuplicatesAction.fromParentVariantMap(variantMap);
 }
 
 QVariantMap GeneralTsneSettingsAction::toVariantMap() const
@@ -167,9 +270,15 @@ QVariantMap GeneralTsneSettingsAction::toVariantMap() const
     _knnAlgorithmAction.insertIntoVariantMap(variantMap);
     _distanceMetricAction.insertIntoVariantMap(variantMap);
     _perplexityAction.insertIntoVariantMap(variantMap);
+    _similarityTypeAction.insertIntoVariantMap(variantMap);
+    _numNeighborsUniformAction.insertIntoVariantMap(variantMap);
+    _progressiveSimilaritiesAction.insertIntoVariantMap(variantMap);
+    _multiscaleAction.insertIntoVariantMap(variantMap);
+    _multiscalePerplexitiesAction.insertIntoVariantMap(variantMap);
     _computationAction.insertIntoVariantMap(variantMap);
     _reinitAction.insertIntoVariantMap(variantMap);
     _saveProbDistAction.insertIntoVariantMap(variantMap);
+    _collapseDuplicatesAction.insertIntoVariantMap(variantMap);
 
     return variantMap;
 }
@@ -2,6 +2,7 @@
 
 #include "actions/IntegralAction.h"
 #include "actions/OptionAction.h"
+#include "actions/StringAction.h"
 #include "actions/ToggleAction.h"
 
 #include "TsneComputationAction.h"
@@ -35,9 +36,15 @@ public: // Action getters
     IntegralAction& getNumIterationsAction() { return _computationAction.getNumIterationsAction(); };
     IntegralAction& getNumberOfComputatedIterationsAction() { return _computationAction.getNumberOfComputatedIterationsAction(); };
     IntegralAction& getPerplexityAction() { return _perplexityAction; };
+    OptionAction& getSimilarityTypeAction() { return _similarityTypeAction; };
+    IntegralAction& getNumNeighborsUniformAction() { return _numNeighborsUniformAction; };
+    ToggleAction& getProgressiveSimilaritiesAction() { return _progressiveSimilaritiesAction; };
+    ToggleAction& getMultiscaleAction() { return _multiscaleAction; };
+    StringAction& getMultiscalePerplexitiesAction() { return _multiscalePerplexitiesAction; };
     TsneComputationAction& getComputationAction() { return _computationAction; }
     ToggleAction& getReinitAction() { return _reinitAction; }
     ToggleAction& getSaveProbDistAction() { return _saveProbDistAction; }
+    ToggleAction& getCollapseDuplicatesAction() { return _collapseDuplicatesAction; }
 
 public: // Serialization
 
@@ -58,7 +65,13 @@ protected:
     OptionAction            _knnAlgorithmAction;                    /** KNN algorithm action */
     OptionAction            _distanceMetricAction;                  /** Distance metric action */
     IntegralAction          _perplexityAction;                      /** Perplexity action */
+    OptionAction            _similarityTypeAction;                  /** Similarity kernel action */
+    IntegralAction          _numNeighborsUniformAction;             /** Number of nearest neighbors for the uniform kernel action */
+    ToggleAction            _progressiveSimilaritiesAction;         /** Start embedding on a coarse kNN graph and refine it in the background */
+    ToggleAction            _multiscaleAction;                      /** Average the similarities of several perplexities */
+    StringAction            _multiscalePerplexitiesAction;          /** Comma-separated perplexities for the multi-scale similarities */
     TsneComputationAction   _computationAction;                     /** Computation action */
     ToggleAction            _reinitAction;                          /** Whether to re-initialize instead of recomputing from scratch */
     ToggleAction            _saveProbDistAction;                    /** Save t-SNE to projects action */
+    ToggleAction            _collapseDuplicatesAction;              /** Whether to embed identical points only once */
 };
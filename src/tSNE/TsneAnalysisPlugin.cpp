@@ -26,7 +26,8 @@ TsneAnalysisPlugin::TsneAnalysisPlugin(const PluginFactory* factory) :
     _tsneAnalysis(),
     _tsneSettingsAction(nullptr),
     _dataPreparationTask(this, "Prepare data"),
-    _probDistMatrix()
+    _probDistMatrix(),
+    _deduplication()
 {
     setObjectName("TSNE");
 
@@ -140,8 +141,14 @@ void TsneAnalysisPlugin::init()
 
     connect(&_tsneAnalysis, &TsneAnalysis::embeddingUpdate, this, [this](const TsneData tsneData) {
 
-        // Update the output points dataset with new data from the TSNE analysis
-        getOutputDataset<Points>()->setData(tsneData.getData().data(), tsneData.getNumPoints(), 2);
+        // Update the output points dataset with new data from the TSNE analysis, duplicates share the position of their representative
+        if (_deduplication.hasDuplicates())
+        {
+            const auto positions = _deduplication.expand(tsneData.getData(), 2);
+            getOutputDataset<Points>()->setData(positions.data(), _deduplication.getNumPoints(), 2);
+        }
+        else
+            getOutputDataset<Points>()->setData(tsneData.getData().data(), tsneData.getNumPoints(), 2);
 
         _tsneSettingsAction->getGeneralTsneSettingsAction().getNumberOfComputatedIterationsAction().setValue(_tsneAnalysis.getNumIterations() - 1);
 
@@ -209,9 +216,28 @@ void TsneAnalysisPlugin::startComputation()
     // Init embedding: random or set from other dataset, e.g. PCA
     auto initEmbedding = _tsneSettingsAction->getInitalEmbeddingSettingsAction().getInitEmbedding(numPoints);
 
+    // Embed identical points only once, weighted by their multiplicity
+    _deduplication.clear();
+    if (_tsneSettingsAction->getGeneralTsneSettingsAction().getCollapseDuplicatesAction().isChecked())
+    {
+        _deduplication.compute(data, numEnabledDimensions);
+
+        if (_deduplication.hasDuplicates())
+        {
+            qDebug() << "TsneAnalysisPlugin::startComputation: collapsed " << numPoints << " points into " << _deduplication.getNumRepresentatives() << " unique points";
+
+            data = _deduplication.reduce(data, numEnabledDimensions);
+            initEmbedding = _deduplication.reduce(initEmbedding, 2);
+        }
+        else
+            _deduplication.clear();
+    }
+
     _dataPreparationTask.setFinished();
 
-    _tsneAnalysis.startComputation(_tsneSettingsAction->getTsneParameters(), _tsneSettingsAction->getKnnParameters(), std::move(data), numEnabledDimensions, &initEmbedding);
+    const auto* pointWeights = _deduplication.hasDuplicates() ? &_deduplication.getMultiplicities() : nullptr;
+
+    _tsneAnalysis.startComputation(_tsneSettingsAction->getTsneParameters(), _tsneSettingsAction->getKnnParameters(), std::move(data), numEnabledDimensions, &initEmbedding, pointWeights);
 }
 
 void TsneAnalysisPlugin::reinitializeComputation()
@@ -234,7 +260,11 @@ void TsneAnalysisPlugin::reinitializeComputation()
 
     auto initEmbedding = initSettings.getInitEmbedding(numPoints);
 
-    _tsneAnalysis.startComputation(_tsneSettingsAction->getTsneParameters(), std::move(_probDistMatrix), numPoints, &initEmbedding);
+    // The probability distribution only covers the collapsed duplicates
+    if (_deduplication.hasDuplicates())
+        initEmbedding = _deduplication.reduce(initEmbedding, 2);
+
+    _tsneAnalysis.startComputation(_tsneSettingsAction->getTsneParameters(), std::move(_probDistMatrix), static_cast<uint32_t>(initEmbedding.size() / 2), &initEmbedding);
 }
 
 void TsneAnalysisPlugin::continueComputation()
@@ -255,7 +285,10 @@ void TsneAnalysisPlugin::continueComputation()
         currentEmbeddingPositions.resize(2ull * currentEmbedding->getNumPoints());
         currentEmbedding->populateDataForDimensions<std::vector<float>, std::vector<unsigned int>>(currentEmbeddingPositions, { 0, 1 });
 
-        _tsneAnalysis.startComputation(_tsneSettingsAction->getTsneParameters(), std::move(_probDistMatrix), currentEmbedding->getNumPoints(), &currentEmbeddingPositions, _tsneSettingsAction->getGeneralTsneSettingsAction().getNumberOfComputatedIterationsAction().getValue());
+        if (_deduplication.hasDuplicates())
+            currentEmbeddingPositions = _deduplication.reduce(currentEmbeddingPositions, 2);
+
+        _tsneAnalysis.startComputation(_tsneSettingsAction->getTsneParameters(), std::move(_probDistMatrix), static_cast<uint32_t>(currentEmbeddingPositions.size() / 2), &currentEmbeddingPositions, _tsneSettingsAction->getGeneralTsneSettingsAction().getNumberOfComputatedIterationsAction().getValue());
     }
     else
     {
@@ -291,6 +324,14 @@ void TsneAnalysisPlugin::fromVariantMap(const QVariantMap& variantMap)
             {
                 hdi::data::IO::loadSparseMatrix(_probDistMatrix, loadFile, nullptr);
 
+                // The probability distribution was computed on collapsed duplicates
+                if (variantMap.contains("duplicatesMapping"))
+                {
+                    std::vector<uint32_t> pointToRepresentative(static_cast<size_t>(variantMap["duplicatesMappingSize"].toULongLong()));
+                    populateDataBufferFromVariantMap(variantMap["duplicatesMapping"].toMap(), (char*)pointToRepresentative.data());
+                    _deduplication.setPointToRepresentative(std::move(pointToRepresentative));
+                }
+
                 _tsneSettingsAction->getComputationAction().getContinueComputationAction().setEnabled(true);
             }
             else
@@ -323,6 +364,13 @@ QVariantMap TsneAnalysisPlugin::toVariantMap() const
             hdi::data::IO::saveSparseMatrix(*probabilityDistribution.value(), saveFile, nullptr);
             saveFile.close();
             variantMap["probabilityDistribution"] = fileName;
+
+            if (_deduplication.hasDuplicates())
+            {
+                const auto& pointToRepresentative = _deduplication.getPointToRepresentative();
+                variantMap["duplicatesMapping"]     = rawDataToVariantMap((char*)pointToRepresentative.data(), pointToRepresentative.size() * sizeof(uint32_t), true);
+                variantMap["duplicatesMappingSize"] = QVariant::fromValue(pointToRepresentative.size());
+            }
         }
     }
 
@@ -3,6 +3,7 @@
 #include <AnalysisPlugin.h>
 #include <Task.h>
 
+#include "DataDeduplication.h"
 #include "TsneAnalysis.h"
 
 using namespace mv::plugin;
@@ -45,6 +46,7 @@ private:
 
 private:
     ProbDistMatrix                      _probDistMatrix;        /** Probability distribution matrix used for serialization */
+    DataDeduplication                   _deduplication;         /** Maps input points to the collapsed duplicates that are embedded */
 };
 
 class TsneAnalysisPluginFactory : public AnalysisPluginFactory